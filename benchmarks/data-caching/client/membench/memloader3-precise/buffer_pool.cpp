@@ -0,0 +1,62 @@
+#include "buffer_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "numa_utils.h"
+
+static __thread buffer_pool *cur_thread_pool = NULL;
+
+buffer_pool *buffer_pool::of_thread(int numa_node) {
+	if (cur_thread_pool == NULL) {
+		cur_thread_pool = new buffer_pool(numa_node);
+	}
+	return cur_thread_pool;
+}
+
+buffer_pool::buffer_pool(int numa_node) : numa_node(numa_node) {
+	slab_next = NULL;
+	slab_left = 0;
+}
+
+int buffer_pool::size_class(int size) {
+	int cls = 0;
+	while ((1 << (cls + min_class_shift)) < size) {
+		cls++;
+	}
+	if (cls >= class_cnt) {
+		fprintf(stderr, "buffer_pool: buffer too large: %d\n", size);
+		exit(1);
+	}
+	return cls;
+}
+
+char *buffer_pool::get(int size, int *cap) {
+	int cls = size_class(size);
+	*cap = 1 << (cls + min_class_shift);
+	if (!free_bufs[cls].empty()) {
+		char *buf = free_bufs[cls].back();
+		free_bufs[cls].pop_back();
+		return buf;
+	}
+	if (cls + min_class_shift > slab_class_shift) {
+		return (char*) numa_alloc_on_node(*cap, numa_node);
+	}
+	// Slab memory is never unmapped, the free lists keep what is not in use.
+	if (slab_left < *cap) {
+		slab_next = (char*) numa_alloc_on_node(slab_size, numa_node);
+		slab_left = slab_size;
+	}
+	char *buf = slab_next;
+	slab_next += *cap;
+	slab_left -= *cap;
+	return buf;
+}
+
+void buffer_pool::put(char *buf, int cap) {
+	int cls = size_class(cap);
+	if (cls + min_class_shift > slab_class_shift && (long) (free_bufs[cls].size() + 1) * cap > pool_keep_bytes) {
+		numa_free(buf, cap);
+		return;
+	}
+	free_bufs[cls].push_back(buf);
+}
@@ -0,0 +1,41 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+
+// Send and receive buffers shared by the connections of one thread. Connections only hold a
+// buffer while a request or response is partly sent or received, so memory follows the bytes
+// in flight instead of the number of connections. Buffers come in power-of-two size classes;
+// small ones are carved from NUMA-local slabs (one mapping for many buffers), large ones are
+// mapped on their own. Freed buffers are kept for reuse, large ones up to pool_keep_bytes per
+// class.
+
+class buffer_pool {
+private:
+	static const int min_class_shift = 8; // 256B
+	static const int max_class_shift = 21; // 2MB, fits max_request_size and max_response_size
+	static const int class_cnt = max_class_shift - min_class_shift + 1;
+	static const int slab_class_shift = 16; // classes up to 64KB are carved from slabs
+	static const int slab_size = 1 << 20;
+	static const long pool_keep_bytes = 8L << 20;
+
+	int numa_node;
+	std::vector<char*> free_bufs[class_cnt];
+	char *slab_next; // unused part of the current slab
+	int slab_left;
+
+public:
+	// The pool of the calling thread, created on first use with memory on numa_node.
+	static buffer_pool *of_thread(int numa_node);
+
+	// A buffer of at least size bytes, its actual size is stored in *cap.
+	char *get(int size, int *cap);
+	// Returns a buffer from get, only on the thread that got it.
+	void put(char *buf, int cap);
+
+private:
+	buffer_pool(int numa_node);
+	static int size_class(int size);
+};
+
+#endif
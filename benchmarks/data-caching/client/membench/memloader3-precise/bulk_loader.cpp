@@ -0,0 +1,332 @@
+#include "bulk_loader.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.h"
+#include "memcached_cmd.h"
+#include "memdb.h"
+#include "randnum.h"
+#include "clock.h"
+#include "util.h"
+
+static const int batch_size = 256 * 1024; // bytes of SETs per write
+static const double progress_interval = 1.0e9; // ns between "B:" lines
+static const int max_printed_errors = 10; // per connection
+
+// One loading connection, with its share of every tenant's database on its server.
+class bulk_part {
+public:
+	int sid;
+	int index; // among the connections of the server
+	int part_cnt; // connections of the server
+	std::atomic<uint64_t> keys; // sent
+	std::atomic<uint64_t> bytes;
+	std::atomic_bool done;
+	int error_replies;
+};
+
+// Lines the server sends while loading. With noreply, the only one expected is the answer to
+// the final "version"; anything else is an error reply to a SET.
+class bulk_reply_reader {
+private:
+	std::string pending;
+
+public:
+	bool synced; // VERSION seen, every SET before it is processed
+
+public:
+	bulk_reply_reader() : synced(false) {}
+
+	void read(int sock, bulk_part *part) {
+		char buf[4096];
+		int res = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			perror("bulk_preload: can't receive");
+			exit(1);
+		}
+		if (res == 0) {
+			fprintf(stderr, "bulk_preload: server closed the connection\n");
+			exit(1);
+		}
+		pending.append(buf, res);
+		size_t line_end;
+		while ((line_end = pending.find('\n')) != std::string::npos) {
+			std::string line = pending.substr(0, line_end + 1);
+			pending.erase(0, line_end + 1);
+			if (line.compare(0, 7, "VERSION") == 0) {
+				synced = true;
+			} else if (part->error_replies++ < max_printed_errors) {
+				fprintf(stderr, "bulk_preload: error reply: %s", line.c_str());
+			}
+		}
+	}
+};
+
+static int open_bulk_sock(const server_addr &saddr) {
+	sockaddr sa;
+	get_sockaddr(&sa, saddr.hostname, saddr.port, SOCK_STREAM);
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("bulk_preload: can't create socket");
+		exit(1);
+	}
+	if (connect(sock, &sa, sizeof(sa)) < 0) {
+		perror("bulk_preload: can't connect");
+		exit(1);
+	}
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return sock;
+}
+
+static const server_addr &nth_addr(const server_record &sr, int n) {
+	auto it = sr.addrs.begin();
+	std::advance(it, n % sr.addrs.size());
+	return *it;
+}
+
+// Sends len bytes, reading error replies meanwhile so that neither side blocks on a full buffer.
+static void send_all(int sock, const char *buf, int len, bulk_part *part, bulk_reply_reader *reader) {
+	while (len > 0) {
+		pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN | POLLOUT;
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("bulk_preload: can't poll");
+			exit(1);
+		}
+		if (pfd.revents & POLLIN) {
+			reader->read(sock, part);
+		}
+		if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+			int res = send(sock, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (res < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					continue;
+				}
+				perror("bulk_preload: can't send");
+				exit(1);
+			}
+			buf += res;
+			len -= res;
+		}
+	}
+}
+
+static void load_part(bulk_part *part) {
+	int sock = open_bulk_sock(nth_addr(conf.servers[part->sid], part->index));
+	bulk_reply_reader reader;
+	std::vector<char> buf(batch_size + max_request_size + 8);
+	int len = 0;
+	int keys = 0;
+	for (const auto &t : conf.tenants) {
+		const memdb *db = t.dbs[part->sid];
+		int first = (long) db->get_dbsize() * part->index / part->part_cnt;
+		int last = (long) db->get_dbsize() * (part->index + 1) / part->part_cnt;
+		for (int e = first; e < last; e++) {
+			request r;
+			db->fill_request(&r, e);
+			r.cmd = mcm_set;
+			len += fill_noreply_set(r, buf.data() + len, buf.size() - len);
+			keys++;
+			if (len >= batch_size) {
+				send_all(sock, buf.data(), len, part, &reader);
+				part->keys.fetch_add(keys);
+				part->bytes.fetch_add(len);
+				len = 0;
+				keys = 0;
+			}
+		}
+	}
+	len += sprintf(buf.data() + len, "version\r\n");
+	send_all(sock, buf.data(), len, part, &reader);
+	part->keys.fetch_add(keys);
+	part->bytes.fetch_add(len);
+	while (!reader.synced) {
+		pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			perror("bulk_preload: can't poll");
+			exit(1);
+		}
+		reader.read(sock, part);
+	}
+	close(sock);
+	part->done = true;
+}
+
+enum verify_result {vr_ok, vr_missing, vr_bad};
+
+// Sends a GET of r and checks the reply against the value a SET of r stores.
+static verify_result verify_key(int sock, const request &r, std::vector<char> *buf) {
+	int len = fill_send_buf(r, buf->data(), buf->size());
+	for (int off = 0; off < len; ) {
+		int res = send(sock, buf->data() + off, len - off, MSG_NOSIGNAL);
+		if (res < 0) {
+			perror("bulk_preload: verify: can't send");
+			exit(1);
+		}
+		off += res;
+	}
+	char *p = buf->data();
+	int have = 0;
+	int head_len = 0; // once the head line is in, terminated like tcp_response_receiver::get_line
+	response resp;
+	while (true) {
+		char *nl;
+		if (head_len == 0 && (nl = (char*) find_line_end(p, p + have)) != NULL) {
+			*nl = '\0';
+			head_len = nl - p + 1;
+			if (memcmp(p, "END", 3) == 0) {
+				return vr_missing;
+			}
+			if (memcmp(p, "VALUE ", 6) != 0) {
+				fprintf(stderr, "bulk_preload: verify: unexpected reply: %s\n", p);
+				return vr_bad;
+			}
+			parse_response_head(&resp, p);
+		}
+		if (head_len > 0) {
+			if (have >= head_len + resp.val_size + 7) { // value, "\r\n" and "END\r\n"
+				bool good = resp.key_seed == r.key_seed && resp.val_size == r.val_size
+					&& check_val(p + head_len, r.key_seed, r.val_size);
+				return good ? vr_ok : vr_bad;
+			}
+		}
+		if (have == (int) buf->size()) {
+			fprintf(stderr, "bulk_preload: verify: reply too large\n");
+			exit(1);
+		}
+		int res = recv(sock, p + have, buf->size() - have, 0);
+		if (res <= 0) {
+			fprintf(stderr, "bulk_preload: verify: connection lost\n");
+			exit(1);
+		}
+		have += res;
+	}
+}
+
+// Reads back cnt random keys, spread evenly over the servers. Returns the number of failures.
+static int verify_sample(int cnt) {
+	rand_engine_t rg(derive_seed(conf.seed, 3ULL << 32));
+	std::vector<char> buf(max_response_size + 64);
+	int missing = 0, bad = 0;
+	for (int sid = 0; sid < (int) conf.servers.size(); sid++) {
+		long entry_cnt = 0;
+		for (const auto &t : conf.tenants) {
+			entry_cnt += t.dbs[sid]->get_dbsize();
+		}
+		int sock = open_bulk_sock(nth_addr(conf.servers[sid], 0));
+		rand_uniform_int_t dist(0, entry_cnt - 1);
+		for (int i = sid; i < cnt; i += conf.servers.size()) {
+			long e = dist(rg);
+			size_t t = 0;
+			while (e >= conf.tenants[t].dbs[sid]->get_dbsize()) {
+				e -= conf.tenants[t].dbs[sid]->get_dbsize();
+				t++;
+			}
+			request r;
+			conf.tenants[t].dbs[sid]->fill_request(&r, e);
+			r.cmd = mcm_get;
+			switch (verify_key(sock, r, &buf)) {
+			case vr_missing:
+				missing++;
+				break;
+			case vr_bad:
+				bad++;
+				break;
+			default:
+				break;
+			}
+		}
+		close(sock);
+	}
+	printf("===verify: %d keys, %d missing, %d bad values===\n", cnt, missing, bad);
+	return missing + bad;
+}
+
+int bulk_preload(int conns_per_server, int verify_cnt) {
+	uint64_t total_keys = 0;
+	for (const auto &t : conf.tenants) {
+		total_keys += (uint64_t) t.db_size * (conf.mirror ? conf.servers.size() : 1);
+	}
+	int part_cnt = conf.servers.size() * conns_per_server;
+	bulk_part *parts = new bulk_part[part_cnt];
+	std::vector<std::thread> threads;
+	printf("===bulk preload started (%d connections, %llu keys)===\n", part_cnt, (unsigned long long) total_keys);
+	fflush(stdout);
+	double start_tv = clock_mono_nsec();
+	for (int i = 0; i < part_cnt; i++) {
+		parts[i].sid = i / conns_per_server;
+		parts[i].index = i % conns_per_server;
+		parts[i].part_cnt = conns_per_server;
+		parts[i].keys = 0;
+		parts[i].bytes = 0;
+		parts[i].done = false;
+		parts[i].error_replies = 0;
+		threads.push_back(std::thread(load_part, &parts[i]));
+	}
+
+	uint64_t old_keys = 0, old_bytes = 0;
+	double old_tv = start_tv;
+	bool done = false;
+	while (!done) {
+		usleep(100000);
+		done = true;
+		for (int i = 0; i < part_cnt; i++) {
+			done = done && parts[i].done;
+		}
+		double new_tv = clock_mono_nsec();
+		if (new_tv - old_tv < progress_interval && !done) {
+			continue;
+		}
+		uint64_t keys = 0, bytes = 0;
+		for (int i = 0; i < part_cnt; i++) {
+			keys += parts[i].keys;
+			bytes += parts[i].bytes;
+		}
+		double t = (new_tv - old_tv) / 1.0e9;
+		printf("B: keys %llu/%llu (%.1f%%) key_rate %.0f bytes %.1fMB byte_rate %.1fMB/s\n",
+			(unsigned long long) keys, (unsigned long long) total_keys, keys * 100.0 / total_keys,
+			(keys - old_keys) / t, bytes / 1.0e6, (bytes - old_bytes) / 1.0e6 / t);
+		fflush(stdout);
+		old_keys = keys;
+		old_bytes = bytes;
+		old_tv = new_tv;
+	}
+	int error_replies = 0;
+	for (int i = 0; i < part_cnt; i++) {
+		threads[i].join();
+		error_replies += parts[i].error_replies;
+	}
+	double t = (clock_mono_nsec() - start_tv) / 1.0e9;
+	printf("===bulk preload finished (time: %.1fs, key_rate %.0f, byte_rate %.1fMB/s, error replies %d)===\n",
+		t, old_keys / t, old_bytes / 1.0e6 / t, error_replies);
+	delete[] parts;
+
+	int failed = error_replies;
+	if (verify_cnt > 0) {
+		failed += verify_sample(verify_cnt);
+	}
+	fflush(stdout);
+	return failed;
+}
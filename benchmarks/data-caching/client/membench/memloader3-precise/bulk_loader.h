@@ -0,0 +1,14 @@
+#ifndef BULK_LOADER_H
+#define BULK_LOADER_H
+
+// Bulk preload (--bulk-preload), a separate path from the paced workers: every server gets
+// conns_per_server connections, each owning a contiguous part of the key range of every
+// tenant's database. SETs are sent "noreply", back to back in large writes, and a final
+// "version" round trip tells when the server has processed them all. Progress is printed by
+// keys and bytes ("B:" lines), and verify_cnt random keys are read back at the end.
+
+// Loads the databases of conf.tenants into conf.servers. Returns the number of keys that
+// failed verification (missing or wrong values) plus the number of error replies.
+int bulk_preload(int conns_per_server, int verify_cnt);
+
+#endif
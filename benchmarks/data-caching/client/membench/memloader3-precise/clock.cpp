@@ -9,6 +9,14 @@ void init_clock_mono_nsec() {
 	start_point_sec = start_point.tv_sec;
 }
 
+int64_t clock_offset_nsec(clockid_t clock_id) {
+	timespec other;
+	clock_gettime(clock_id, &other);
+	double mono = clock_mono_nsec();
+	// in integers, doubles would lose the last bits of absolute times
+	return (int64_t) other.tv_sec * 1000000000 + other.tv_nsec - (int64_t) mono;
+}
+
 double clock_mono_nsec() {
 	timespec now;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
@@ -1,6 +1,9 @@
 #ifndef CLOCK_H
 #define CLOCK_H
 
+#include <stdint.h>
+#include <time.h>
+
 // set starting point to current time 
 // (CLOCK_MONOTONIC_RAW time, ignore nano second component)
 void init_clock_mono_nsec();
@@ -8,4 +11,8 @@ void init_clock_mono_nsec();
 // return nano seconds after staring point
 double clock_mono_nsec();
 
+// Time of clock_id (e.g., CLOCK_REALTIME) minus clock_mono_nsec() time, in ns. Add it to a
+// clock_mono_nsec() time to get the same instant on clock_id.
+int64_t clock_offset_nsec(clockid_t clock_id);
+
 #endif
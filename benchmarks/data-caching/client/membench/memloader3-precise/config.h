@@ -5,8 +5,11 @@
 #include <vector>
 #include <sys/socket.h>
 #include <atomic>
+#include <time.h>
 #include "memdb.h"
 #include "memcached_cmd.h"
+#include "near_cache.h"
+#include "interval_stream.h"
 
 class server_addr {
 public:
@@ -17,7 +20,20 @@ public:
 class server_record {
 public:
 	std::list<server_addr> addrs;
-	const memdb *db;
+};
+
+// A workload class sharing the servers with the others (--tenant): its own database, which
+// uses key seeds no other tenant uses, connections, load, QoS target and op mix.
+class tenant_workload {
+public:
+	const char *name; // NULL for the single workload of the plain options
+	const char *db_sample_file; // NULL for a generated database
+	int db_size;
+	int vclients;
+	double load;
+	double qos; // in ms
+	double set_ratio;
+	std::vector<const memdb*> dbs; // per server, or the same db for all of them when mirrored
 };
 
 class work_round {
@@ -35,11 +51,19 @@ public:
 	double param;
 };
 
+enum timestamping_t {tst_off, tst_software, tst_hardware};
+
 class config {
 public:
 	/* db stuff */
-	const char *db_sample_file;
+	const char *db_sample_file; // "gen" for a generated database
 	int db_size;
+	// laws of generated databases, generate is set once one of them is given
+	bool generate;
+	size_dist gen_key_size;
+	size_dist gen_val_size;
+	popularity_dist gen_popularity;
+	const char *key_template; // NULL for the 'K' padded hex keys
 	/**/
 
 	/* server stuff */
@@ -53,6 +77,10 @@ public:
 	int vclients;
 	/**/
 
+	// From the --tenant options, or one unnamed tenant made of the db, vclients, load, qos and
+	// set_ratio options above.
+	std::vector<tenant_workload> tenants;
+
 	/* benchmark stuff */
 	double load;
 	double qos; // in ms
@@ -69,6 +97,14 @@ public:
 	/**/
 
 	bool preload;
+	int bulk_preload_conns; // connections per server of the bulk preload, 0 if not bulk preloading
+	int bulk_verify_cnt; // keys read back after the bulk preload
+
+	uint64_t seed; // base of the per-connection random streams
+	bool random_seed; // pick the seed from the clock
+	const char *record_file; // log of issued requests, NULL if not recording
+	const char *replay_file; // log to send requests from, NULL if not replaying
+	double replay_speed; // 1.0 is the recorded pace, 0.0 is as fast as possible
 
 	int base_port;
 
@@ -76,19 +112,73 @@ public:
 
 	int per_connection_work;
 
+	bool profile; // per-stage cycle counts of the worker threads
+	double profile_warn; // warn if client overhead exceeds this fraction of the latency
+
+	bool size_classes; // also report per op and log2 value size class
+	bool per_server; // also report per server, and per address of servers with several
+
+	// client side cache emulation, off if near_cache_cap is 0
+	int near_cache_cap; // entries per vclient
+	near_policy_t near_cache_policy;
+	double near_cache_ttl; // in seconds, 0.0 to invalidate entries on SETs instead
+
 	int histogram_head;
 	int histogram_body;
+	const char *histogram_file;
+
+	// steady state detection, off if steady_window is 0
+	int steady_window; // intervals that have to agree before warm-up is over
+	double steady_tolerance; // allowed spread of reply rate, latency and hit ratio over the window
+	double steady_p99_ci; // end a round once the p99 confidence interval is within this fraction
+
+	const char *stream_file; // NULL unless --stream
+	stream_format_t stream_format;
+
+	bool lat_bins; // per connection latency bins, for --steady-state, --stream and --per-server
 
 	traffic_shape send_traffic_shape;
 
 	bool busy_loop_receive;
 	int receive_burst;
+	bool epoll_receive; // receive with a native epoll loop instead of libevent
+	int busy_poll; // SO_BUSY_POLL in us, 0 to leave it off
+	bool prefer_busy_poll;
+	int busy_poll_budget; // packets per busy poll, 0 for the kernel default
+
+	double rebalance_lag; // us a send thread may fall behind before others take connections from it, 0.0 for off
 
 	double connect_speed; // new connection per second
 	double connection_init_load;
 	double connection_ramp_up_speed; // per connection load increament per second
 
+	// connection churn (tcp only): reconnect after churn_requests requests or churn_time seconds
+	bool churn;
+	int churn_requests; // 0 means no limit
+	double churn_time; // 0.0 means no limit
+	double churn_connect_rate; // reconnects per second, 0.0 means unlimited
+
+	// tls (tcp only)
+	bool tls;
+	const char *tls_ciphers; // TLS 1.2 cipher list, NULL for the OpenSSL default
+	const char *tls_ciphersuites; // TLS 1.3 cipher suites, NULL for the OpenSSL default
+	bool tls_resume; // resume the last session of a vclient when reconnecting
+	bool tls_ktls; // let the kernel do the record crypto when possible
+
+	timestamping_t timestamping; // kernel TX/RX timestamps for wire-to-wire latency
+
+	// udp only: hand datagrams to the kernel up to txtime_lead us ahead with SO_TXTIME, instead
+	// of spinning until their send time; 0.0 to spin
+	double txtime_lead;
+	clockid_t txtime_clock; // CLOCK_MONOTONIC for the fq qdisc, CLOCK_TAI for etf
+
 	int mtu;
+	int recv_buf_max; // tcp receive buffers grow up to this size (bytes)
+	bool validate_values; // read and check every value body instead of discarding it
+	bool server_stats; // poll the statistics of the servers at every round interval
+
+	bool numa; // numa aware placement of worker threads and per-connection state
+	const char *numa_nic; // prefer the numa node of this interface, NULL if none
 };
 
 extern config conf;
@@ -97,8 +187,10 @@ class controller {
 public:
 	std::atomic_bool started;
 	std::atomic_int ramp_up_cnt;
+	double replay_base; // when the first recorded request is replayed, in clock_mono_nsec time
+	std::atomic_bool warmed_up; // histograms only take samples from here on
 public:
-	controller() : started(false), ramp_up_cnt(0) {}
+	controller() : started(false), ramp_up_cnt(0), replay_base(0.0), warmed_up(true) {}
 };
 
 extern controller control;
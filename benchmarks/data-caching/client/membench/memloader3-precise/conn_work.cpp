@@ -4,26 +4,64 @@
 #include <assert.h>
 #include <string>
 #include <limits>
+#include <algorithm>
 #include "config.h"
 #include "memcached_cmd.h"
+#include "timestamping.h"
+#include "clock.h"
 
-conn_work::conn_work(const int id, const memdb *db, const server_addr &saddr, double init_send_rate, double send_rate, double ramp_up_speed):
-id(id), db(db), saddr(saddr), init_send_rate(init_send_rate), send_rate(send_rate), ramp_up_speed(ramp_up_speed),
+conn_work::conn_work(const int id, const memdb *db, const tenant_workload *tenant, const server_addr &saddr, double init_send_rate, double send_rate, double ramp_up_speed):
+id(id), db(db), tenant(tenant), saddr(saddr), init_send_rate(init_send_rate), send_rate(send_rate), ramp_up_speed(ramp_up_speed),
 hist_latency("hist_latency", 1.0e3),
 hist_request_interval("hist_request_interval", 1.0e4),
 hist_response_interval("hist_response_interval", 1.0e4) {
 
 	db_idx = 0;
+	numa_node = -1;
+	replay = NULL;
 
 	for (int i = 0; i < cwc_core_end; i++) {
 		core_counters[i] = 0.0;
 	}
 	core_counters[cwc_min_latency] = std::numeric_limits<double>::infinity();
+
+	core_class_counters = NULL;
+	all_class_counters = NULL;
+	if (conf.size_classes) {
+		core_class_counters = new double[latency_class_counter_cnt]();
+		all_class_counters = new double[latency_class_counter_cnt]();
+	}
+	core_lat_bins = NULL;
+	all_lat_bins = NULL;
+	if (conf.lat_bins) {
+		core_lat_bins = new double[lat_bin_cnt]();
+		all_lat_bins = new double[lat_bin_cnt]();
+	}
+	near = NULL;
+	if (conf.near_cache_cap > 0) {
+		// sharded, a vclient has one connection per server, and every key belongs to one of them
+		int cap = conf.mirror ? conf.near_cache_cap : std::max(1, conf.near_cache_cap / (int) conf.servers.size());
+		near = new near_cache(cap, conf.near_cache_policy, conf.near_cache_ttl * 1.0e9);
+	}
 }
 
 void conn_work::make_request(request *r, rand_engine_t *rg) {
 
 	int entry_index = -1;
+	r->conn_first = false;
+
+	if (replay != NULL) {
+		const request_record &rec = replay->next();
+		replay->pos++;
+		r->cmd = (memcmd_t) (rec.conn_op & 1);
+		entry_index = db->key_seed_to_entry(rec.key_seed);
+		if (entry_index < 0 || entry_index >= db->get_dbsize()) {
+			fprintf(stderr, "replay: key seed %d is not in the db of connection %d, was the log recorded with another db or server setup?\n", rec.key_seed, id);
+			exit(1);
+		}
+		db->fill_request(r, entry_index);
+		return;
+	}
 
 	if (conf.set_miss) {
 		miss_lock.lock();
@@ -37,9 +75,9 @@ void conn_work::make_request(request *r, rand_engine_t *rg) {
 
 	if (entry_index == -1) {
 		r->cmd = conf.default_cmd;
-		if (conf.set_ratio != 0.0) {
+		if (tenant->set_ratio != 0.0) {
 			rand_uniform_real_t dist(0.0, 1.0);
-			if (dist(*rg) < conf.set_ratio) {
+			if (dist(*rg) < tenant->set_ratio) {
 				r->cmd = mcm_set;
 			}
 		}
@@ -54,6 +92,36 @@ void conn_work::make_request(request *r, rand_engine_t *rg) {
 	db->fill_request(r, entry_index);
 }
 
+bool conn_work::near_cache_serve(const request &r) {
+	if (near == NULL) {
+		return false;
+	}
+	if (r.cmd == mcm_set) {
+		near_cache_invalidate(r.key_seed);
+		near_lock.lock();
+		near->erase(r.key_seed);
+		near_lock.unlock();
+		return false;
+	}
+	double start_point = clock_mono_nsec();
+	bool stale;
+	near_lock.lock();
+	bool hit = near->lookup(r.key_seed, start_point, &stale);
+	near_lock.unlock();
+	double finish_point = clock_mono_nsec();
+	cwc_lock.lock();
+	core_counters[cwc_near_lookup]++;
+	if (hit) {
+		core_counters[cwc_near_hit]++;
+		core_counters[cwc_near_latency_sum] += (finish_point - start_point) / 1.0e3;
+		if (stale) {
+			core_counters[cwc_near_stale]++;
+		}
+	}
+	cwc_lock.unlock();
+	return hit;
+}
+
 void conn_work::count_send_timing(double target_start_point, double start_point, double finish_point) {
 	assert(target_start_point <= start_point);
 	assert(start_point <= finish_point);
@@ -76,7 +144,12 @@ void conn_work::count_sent(const request &r) {
 			fprintf(stderr, "unknown request cmd\n");
 			exit(1);
 	}
-	hist_request_interval.add_sample(r.send_time);
+	if (control.warmed_up) {
+		hist_request_interval.add_sample(r.send_time);
+	}
+	if (core_class_counters != NULL) {
+		core_class_counters[latency_class_index(r.cmd, val_size_class(r.val_size), lcc_sent)]++;
+	}
 	cwc_lock.unlock();
 }
 
@@ -98,8 +171,10 @@ void conn_work::count_replied(const request &r, const response &resp) {
 			exit(1);
 	}
 
-	hist_response_interval.add_sample(resp.recv_time);
-	hist_latency.add_sample(resp.recv_time, r.send_time);
+	if (control.warmed_up) {
+		hist_response_interval.add_sample(resp.recv_time);
+		hist_latency.add_sample(resp.recv_time, r.send_time);
+	}
 
 	double latency = (resp.recv_time - r.send_time) / 1.0e6;
 
@@ -109,7 +184,11 @@ void conn_work::count_replied(const request &r, const response &resp) {
 	}
 
 	core_counters[cwc_latency_sum] += latency;
-	if (latency <= conf.qos) {
+	if (r.conn_first) {
+		core_counters[cwc_replied_first_query]++;
+		core_counters[cwc_first_latency_sum] += latency;
+	}
+	if (latency <= tenant->qos) {
 		core_counters[cwc_good_qos_query]++;
 	}
 
@@ -120,8 +199,27 @@ void conn_work::count_replied(const request &r, const response &resp) {
 		core_counters[cwc_min_latency] = latency;
 	}
 
+	if (core_class_counters != NULL) {
+		double *cc = core_class_counters + latency_class_index(r.cmd, val_size_class(r.val_size), 0);
+		cc[lcc_replied]++;
+		if (resp.err == mer_get_found) {
+			cc[lcc_hit]++;
+		}
+		cc[lcc_latency_sum] += latency;
+		cc[lcc_bins + latency_bin(latency * 1.0e3)]++;
+	}
+	if (core_lat_bins != NULL) {
+		core_lat_bins[latency_bin(latency * 1.0e3)]++;
+	}
+
 	cwc_lock.unlock();
 
+	if (resp.err == mer_get_found && near != NULL) {
+		near_lock.lock();
+		near->fill(r.key_seed, resp.recv_time);
+		near_lock.unlock();
+	}
+
 	if (resp.err == mer_get_not_found && conf.set_miss) {
 		miss_lock.lock();
 		missed_key_seeds.push_back(r.key_seed);
@@ -129,6 +227,81 @@ void conn_work::count_replied(const request &r, const response &resp) {
 	}
 }
 
+void conn_work::count_lost(int cnt) {
+	cwc_lock.lock();
+	core_counters[cwc_lost_query] += cnt;
+	cwc_lock.unlock();
+}
+
+void conn_work::count_migration() {
+	cwc_lock.lock();
+	core_counters[cwc_migration]++;
+	cwc_lock.unlock();
+}
+
+void conn_work::count_connect(double start_point, double finish_point) {
+	cwc_lock.lock();
+	core_counters[cwc_connect]++;
+	core_counters[cwc_connect_time_sum] += (finish_point - start_point) / 1.0e6;
+	cwc_lock.unlock();
+}
+
+void conn_work::count_tls_handshake(double start_point, double finish_point, bool resumed) {
+	cwc_lock.lock();
+	core_counters[cwc_tls_handshake]++;
+	core_counters[cwc_tls_handshake_time_sum] += (finish_point - start_point) / 1.0e6;
+	if (resumed) {
+		core_counters[cwc_tls_resumed]++;
+	}
+	cwc_lock.unlock();
+}
+
+void conn_work::count_tls_send(double duration) {
+	cwc_lock.lock();
+	core_counters[cwc_tls_send_time_sum] += duration / 1.0e3;
+	cwc_lock.unlock();
+}
+
+void conn_work::count_tls_recv(double duration) {
+	cwc_lock.lock();
+	core_counters[cwc_tls_recv_time_sum] += duration / 1.0e3;
+	cwc_lock.unlock();
+}
+
+void conn_work::count_wire(const request &r, const response &resp, const wire_stamp &tx_stamp) {
+	double wire_latency_ns;
+	bool hw;
+	if (!wire_latency(tx_stamp, resp.wire_recv_time, &wire_latency_ns, &hw)) {
+		return;
+	}
+	double wire_latency = wire_latency_ns / 1.0e6;
+	double latency = (resp.recv_time - r.send_time) / 1.0e6;
+	cwc_lock.lock();
+	core_counters[cwc_wire_query]++;
+	if (hw) {
+		core_counters[cwc_wire_hw_query]++;
+	}
+	core_counters[cwc_wire_latency_sum] += wire_latency;
+	core_counters[cwc_stack_latency_sum] += latency - wire_latency;
+	cwc_lock.unlock();
+}
+
+// r.send_time is the transmit time given to the kernel (or the hand-off time, if that was later).
+void conn_work::count_txtime(const request &r, const wire_stamp &tx_stamp) {
+	if (tx_stamp.sw == 0) {
+		return;
+	}
+	int64_t intended = (int64_t) r.send_time + clock_offset_nsec(CLOCK_REALTIME);
+	double lag = (tx_stamp.sw - intended) / 1.0e3;
+	cwc_lock.lock();
+	core_counters[cwc_txtime_query]++;
+	if (lag < 0.0) {
+		core_counters[cwc_txtime_early]++;
+	}
+	core_counters[cwc_txtime_lag_sum] += lag;
+	cwc_lock.unlock();
+}
+
 void conn_work::count_udp_timeout() {
 	cwc_lock.lock();
 	core_counters[cwc_udp_timeout]++;
@@ -143,22 +316,48 @@ void conn_work::update_counters() {
 	}
 	core_counters[cwc_max_latency] = 0.0;
 	core_counters[cwc_min_latency] = std::numeric_limits<double>::infinity();
+	if (core_class_counters != NULL) {
+		for (int i = 0; i < latency_class_counter_cnt; i++) {
+			all_class_counters[i] = core_class_counters[i];
+		}
+	}
+	if (core_lat_bins != NULL) {
+		for (int i = 0; i < lat_bin_cnt; i++) {
+			all_lat_bins[i] = core_lat_bins[i];
+		}
+	}
 	cwc_lock.unlock();
 
 	all_counters[cwc_sent_query] = all_counters[cwc_sent_set_query] + all_counters[cwc_sent_get_query];
 	all_counters[cwc_replied_query] = all_counters[cwc_replied_set_query] + all_counters[cwc_replied_get_query];
-	all_counters[cwc_retired_query] = all_counters[cwc_replied_query] + all_counters[cwc_udp_timeout];
+	all_counters[cwc_retired_query] = all_counters[cwc_replied_query] + all_counters[cwc_udp_timeout] + all_counters[cwc_lost_query];
 	all_counters[cwc_outstanding_query] = all_counters[cwc_sent_query] - all_counters[cwc_retired_query];
 }
 
-void conn_work::dump_histogram(const char* directory) {
-	char filename_prefix_cstr[1024];
-	sprintf(filename_prefix_cstr, "%s/sip-%s-sport-%s-cip-%s-cport-%d", directory, saddr.hostname, saddr.port, client_ip, client_port);
-	std::string filename_prefix(filename_prefix_cstr);
+void conn_work::export_histogram(histogram_section *section) {
+	char label[1024];
+	if (tenant->name != NULL) {
+		sprintf(label, "%s:sip-%s-sport-%s-cip-%s-cport-%d", tenant->name, saddr.hostname, saddr.port, client_ip, client_port);
+	} else {
+		sprintf(label, "sip-%s-sport-%s-cip-%s-cport-%d", saddr.hostname, saddr.port, client_ip, client_port);
+	}
+	section->label = label;
 
 	cwc_lock.lock();
-	hist_latency.dump(filename_prefix + ".latency");
-	hist_request_interval.dump(filename_prefix + ".request_interval");
-	hist_response_interval.dump(filename_prefix + ".response_interval");
+	section->sample_cnt[hk_latency] = hist_latency.export_slots(&section->slots[hk_latency]);
+	section->sample_cnt[hk_request_interval] = hist_request_interval.export_slots(&section->slots[hk_request_interval]);
+	section->sample_cnt[hk_response_interval] = hist_response_interval.export_slots(&section->slots[hk_response_interval]);
 	cwc_lock.unlock();
+
+	for (int k = 0; k < hk_end; k++) {
+		if ((int) section->sample_cnt[k] < conf.histogram_head + conf.histogram_body) {
+			fprintf(stderr, "%s %s: not enough samples: %u\n", label, hist_kind_names[k], section->sample_cnt[k]);
+		}
+	}
+}
+
+void conn_work::histogram_scales(double scale[hk_end]) const {
+	scale[hk_latency] = hist_latency.get_scale();
+	scale[hk_request_interval] = hist_request_interval.get_scale();
+	scale[hk_response_interval] = hist_response_interval.get_scale();
 }
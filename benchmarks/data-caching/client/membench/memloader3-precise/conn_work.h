@@ -10,6 +10,10 @@
 #include "randnum.h"
 #include "memcached_cmd.h"
 #include "histogram.h"
+#include "histogram_file.h"
+#include "latency_classes.h"
+#include "request_log.h"
+#include "near_cache.h"
 
 #define IP_BUF_SZ 16
 
@@ -26,6 +30,28 @@ enum cwc_names {
 	cwc_send_delay_sum,
 	cwc_send_duration_sum,
 	cwc_udp_timeout,
+	cwc_lost_query, // outstanding when the connection was closed
+	cwc_connect,
+	cwc_connect_time_sum,
+	cwc_replied_first_query, // replied first requests of connections
+	cwc_first_latency_sum,
+	cwc_tls_handshake,
+	cwc_tls_handshake_time_sum,
+	cwc_tls_resumed,
+	cwc_tls_send_time_sum, // time spent in tls_send (encryption and write)
+	cwc_tls_recv_time_sum, // time spent in tls_recv (read and decryption)
+	cwc_wire_query, // replied queries with TX and RX timestamps
+	cwc_wire_hw_query, // ... taken by the NIC
+	cwc_wire_latency_sum,
+	cwc_stack_latency_sum, // latency minus wire latency
+	cwc_txtime_query, // replied queries sent with SO_TXTIME and with a TX timestamp
+	cwc_txtime_early, // ... that left before their transmit time (txtime not honored)
+	cwc_txtime_lag_sum, // TX timestamp minus transmit time
+	cwc_near_lookup, // GETs looked up in the near cache
+	cwc_near_hit, // ... answered by it, never sent
+	cwc_near_stale, // ... whose key was SET since it was cached
+	cwc_near_latency_sum, // in us, time of the lookups that hit
+	cwc_migration, // moves of the send side to another send thread (--rebalance)
 	cwc_core_end,
 	// derived counters
 	cwc_sent_query,
@@ -39,23 +65,33 @@ class conn_work {
 public:
 	const int id;
 	const memdb * const db;
+	const tenant_workload * const tenant;
 	const server_addr saddr;
 	const double init_send_rate;
 	const double send_rate;
 	const double ramp_up_speed; // unit is rate increament per second
 	double all_counters[cwc_end];
+	double *all_class_counters; // latency_class_counter_cnt counters, NULL unless conf.size_classes
+	double *all_lat_bins; // lat_bin_cnt latency bins of all requests, NULL unless conf.lat_bins
 
 	int client_port;
 	char client_ip[IP_BUF_SZ];
 
+	int numa_node; // node of the worker threads serving this connection, -1 if unknown
+	replay_stream *replay; // requests are taken from here instead of the db if not NULL
+
 private:
 	std::mutex cwc_lock;
 	std::mutex miss_lock;
+	std::mutex near_lock; // lookups come from the send thread, fills from the recv thread
+	near_cache *near; // NULL unless conf.near_cache_cap
 
 	int db_idx; // for enum work
 	std::list<int> missed_key_seeds;
 
 	double core_counters[cwc_core_end];
+	double *core_class_counters;
+	double *core_lat_bins;
 
 	time_diff_histogram hist_latency;
 	interval_histogram hist_request_interval;
@@ -63,16 +99,29 @@ private:
 
 public:
 	// If send_rate is 0.0, it means infinite, and requests will be sent as fast as possible (conf.max_outstanding is still effective).
-	conn_work(int id, const memdb *db, const server_addr &saddr, double init_send_rate, double send_rate, double ramp_up_speed);
+	conn_work(int id, const memdb *db, const tenant_workload *tenant, const server_addr &saddr, double init_send_rate, double send_rate, double ramp_up_speed);
 
 	void make_request(request *r, rand_engine_t *rg);
+	// Returns true if r is a GET answered by the near cache, which then must not be sent.
+	// A SET invalidates its key.
+	bool near_cache_serve(const request &r);
 	void count_send_timing(double target_start_point, double start_point, double finish_point);
 	void count_sent(const request &r);
 	void count_replied(const request &r, const response &resp);
 	void count_udp_timeout();
+	void count_lost(int cnt);
+	void count_migration();
+	void count_connect(double start_point, double finish_point);
+	void count_tls_handshake(double start_point, double finish_point, bool resumed);
+	void count_tls_send(double duration);
+	void count_tls_recv(double duration);
+	void count_wire(const request &r, const response &resp, const wire_stamp &tx_stamp);
+	void count_txtime(const request &r, const wire_stamp &tx_stamp);
 	void update_counters();
 
-	void dump_histogram(const char *directory);
+	// Copies the histograms, labeled with the connection's addresses.
+	void export_histogram(histogram_section *section);
+	void histogram_scales(double scale[hk_end]) const;
 };
 
 #endif
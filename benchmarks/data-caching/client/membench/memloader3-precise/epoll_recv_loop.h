@@ -0,0 +1,70 @@
+#ifndef EPOLL_RECV_LOOP_H
+#define EPOLL_RECV_LOOP_H
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "config.h"
+
+static const int epoll_batch_size = 256;
+
+// Registers a receive context for edge-triggered readiness. Safe to call from the send thread
+// while the recv thread is waiting in epoll_recv_loop.
+static inline void epoll_watch(int epfd, int sock, void *context) {
+	epoll_event ev;
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = context;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+		perror("epoll_watch: can't add socket");
+		exit(1);
+	}
+}
+
+// Receive loop of one recv thread, used instead of libevent with --epoll-receive.
+// Ready events are harvested in batches of up to epoll_batch_size. A context (CT) provides
+// 'bool drain(int budget)', which receives until its socket would block (returns true) or
+// the budget runs out (returns false), and a 'bool backlogged' flag owned by this loop.
+// With edge-triggered events a context that is not drained gets no further event, so it is
+// kept in a backlog and revisited after the newly ready sockets of the next iteration.
+// A context may free itself in drain (when its connection is closed), so it is not touched
+// after drain returns true.
+template<typename CT> void epoll_recv_loop(int epfd) {
+
+	epoll_event events[epoll_batch_size];
+	std::vector<CT*> backlog;
+	std::vector<CT*> next_backlog;
+
+	while (true) {
+		int timeout = (conf.busy_loop_receive || !backlog.empty()) ? 0 : -1;
+		int cnt = epoll_wait(epfd, events, epoll_batch_size, timeout);
+		if (cnt < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_recv_loop: epoll_wait failed");
+			exit(1);
+		}
+
+		for (int i = 0; i < cnt; i++) {
+			CT *ct = (CT*) events[i].data.ptr;
+			if (ct->backlogged) continue; // drained below
+			if (!ct->drain(conf.receive_burst)) {
+				ct->backlogged = true;
+				next_backlog.push_back(ct);
+			}
+		}
+
+		for (CT *ct : backlog) {
+			ct->backlogged = false;
+			if (!ct->drain(conf.receive_burst)) {
+				ct->backlogged = true;
+				next_backlog.push_back(ct);
+			}
+		}
+
+		backlog.swap(next_backlog);
+		next_backlog.clear();
+	}
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include <string>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <vector>
 #include "config.h"
 
 #define HISTOGRAM_SIZE 10000
@@ -11,19 +13,21 @@
 class histogram {
 private:
 	const std::string name;
-	int histogram_slots[HISTOGRAM_SIZE];
+	int *histogram_slots; // only allocated with conf.histogram_body, every connection has three
 	int overflow;
 	int sample_cnt;
 
 public:
 	histogram(const std::string& name) : name(name) {
-		for (int i = 0; i < HISTOGRAM_SIZE; i++) {
-			histogram_slots[i] = 0;
-		}
+		histogram_slots = conf.histogram_body > 0 ? new int[HISTOGRAM_SIZE]() : NULL;
 		overflow = 0;
 		sample_cnt = 0;
 	}
 
+	~histogram() {
+		delete[] histogram_slots;
+	}
+
 	void add_sample(double val) {
 		sample_cnt++;
 		if (sample_cnt > conf.histogram_head && sample_cnt <= conf.histogram_head + conf.histogram_body) {
@@ -35,21 +39,15 @@ public:
 		}
 	}
 
-	void dump(const std::string& filename) {
-		if (sample_cnt < conf.histogram_head + conf.histogram_body) {
-			fprintf(stderr, "%s: not enough samples: %d\n", name.c_str(), sample_cnt);
-			exit(0);
-		}
-		FILE *fp = fopen(filename.c_str(), "w");
-		if (!fp) {
-			fprintf(stderr, "Unable to create output file '%s': %s\n", filename.c_str(), strerror(errno));
-			exit(0);
+	// Copies the slots followed by the overflow count, returns the number of samples seen
+	// (fewer than head + body if the body is incomplete).
+	int export_slots(std::vector<uint64_t> *slots) const {
+		slots->assign(HISTOGRAM_SIZE + 1, 0);
+		for (int i = 0; histogram_slots != NULL && i < HISTOGRAM_SIZE; i++) {
+			(*slots)[i] = histogram_slots[i];
 		}
-		for (int i = 0; i < HISTOGRAM_SIZE; i++) {
-			fprintf(fp, "%d\n", histogram_slots[i]);
-		}
-		fprintf(fp, "%d\n", overflow);
-		fclose(fp);
+		(*slots)[HISTOGRAM_SIZE] = overflow;
+		return sample_cnt;
 	}
 };
 
@@ -71,8 +69,12 @@ public:
 		hist.add_sample(delta / scale);
 	}
 
-	void dump(const std::string& filename) {
-		hist.dump(filename);
+	int export_slots(std::vector<uint64_t> *slots) const {
+		return hist.export_slots(slots);
+	}
+
+	double get_scale() const {
+		return scale;
 	}
 };
 
@@ -98,8 +100,12 @@ public:
 		last_time = time;
 	}
 
-	void dump(const std::string& filename) {
-		td_hist.dump(filename);
+	int export_slots(std::vector<uint64_t> *slots) const {
+		return td_hist.export_slots(slots);
+	}
+
+	double get_scale() const {
+		return td_hist.get_scale();
 	}
 };
 
@@ -0,0 +1,184 @@
+#include "histogram_file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *hist_kind_names[hk_end] = {
+	"latency",
+	"request_interval",
+	"response_interval"
+};
+
+histogram_section::histogram_section(const std::string &label, int slot_cnt) : label(label) {
+	for (int k = 0; k < hk_end; k++) {
+		sample_cnt[k] = 0;
+		slots[k].assign(slot_cnt, 0);
+	}
+}
+
+void histogram_section::add(const histogram_section &other) {
+	for (int k = 0; k < hk_end; k++) {
+		sample_cnt[k] += other.sample_cnt[k];
+		for (size_t i = 0; i < slots[k].size() && i < other.slots[k].size(); i++) {
+			slots[k][i] += other.slots[k][i];
+		}
+	}
+}
+
+void histogram_section::add(const packed_histogram_section &other) {
+	for (int k = 0; k < hk_end; k++) {
+		sample_cnt[k] += other.sample_cnt[k];
+		for (size_t n = 0; n < other.slot_ids[k].size(); n++) {
+			if (other.slot_ids[k][n] < slots[k].size()) {
+				slots[k][other.slot_ids[k][n]] += other.counts[k][n];
+			}
+		}
+	}
+}
+
+packed_histogram_section::packed_histogram_section(const histogram_section &s) : label(s.label) {
+	for (int k = 0; k < hk_end; k++) {
+		sample_cnt[k] = s.sample_cnt[k];
+		for (uint32_t i = 0; i < s.slots[k].size(); i++) {
+			if (s.slots[k][i] != 0) {
+				slot_ids[k].push_back(i);
+				counts[k].push_back(s.slots[k][i]);
+			}
+		}
+	}
+}
+
+static void put(FILE *fp, const void *p, size_t len, const char *filename) {
+	if (fwrite(p, len, 1, fp) != 1) {
+		fprintf(stderr, "Unable to write '%s': %s\n", filename, strerror(errno));
+		exit(1);
+	}
+}
+
+static void get(FILE *fp, void *p, size_t len, const char *filename) {
+	if (fread(p, len, 1, fp) != 1) {
+		fprintf(stderr, "%s: truncated histogram file\n", filename);
+		exit(1);
+	}
+}
+
+static void write_section(FILE *fp, const packed_histogram_section &s, const char *filename) {
+	uint16_t label_len = s.label.size();
+	put(fp, &label_len, sizeof(label_len), filename);
+	put(fp, s.label.data(), label_len, filename);
+	for (int k = 0; k < hk_end; k++) {
+		uint32_t nonzero = s.slot_ids[k].size();
+		put(fp, &s.sample_cnt[k], sizeof(s.sample_cnt[k]), filename);
+		put(fp, &nonzero, sizeof(nonzero), filename);
+		for (uint32_t n = 0; n < nonzero; n++) {
+			put(fp, &s.slot_ids[k][n], sizeof(s.slot_ids[k][n]), filename);
+			put(fp, &s.counts[k][n], sizeof(s.counts[k][n]), filename);
+		}
+	}
+}
+
+static void read_section(FILE *fp, int slot_cnt, packed_histogram_section *s, const char *filename) {
+	uint16_t label_len;
+	get(fp, &label_len, sizeof(label_len), filename);
+	s->label.resize(label_len);
+	if (label_len > 0) {
+		get(fp, &s->label[0], label_len, filename);
+	}
+	for (int k = 0; k < hk_end; k++) {
+		uint32_t nonzero;
+		get(fp, &s->sample_cnt[k], sizeof(s->sample_cnt[k]), filename);
+		get(fp, &nonzero, sizeof(nonzero), filename);
+		s->slot_ids[k].resize(nonzero);
+		s->counts[k].resize(nonzero);
+		for (uint32_t n = 0; n < nonzero; n++) {
+			get(fp, &s->slot_ids[k][n], sizeof(s->slot_ids[k][n]), filename);
+			get(fp, &s->counts[k][n], sizeof(s->counts[k][n]), filename);
+			if (s->slot_ids[k][n] >= (uint32_t) slot_cnt) {
+				fprintf(stderr, "%s: bad slot %u\n", filename, s->slot_ids[k][n]);
+				exit(1);
+			}
+		}
+	}
+}
+
+void histogram_write(const char *filename, const histogram_file_header &h, const histogram_section &all,
+	const std::vector<packed_histogram_section> &sections, const std::string &server_stats) {
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to create output file '%s': %s\n", filename, strerror(errno));
+		exit(1);
+	}
+	static char buf[1 << 16];
+	setvbuf(fp, buf, _IOFBF, sizeof(buf));
+
+	put(fp, &h, sizeof(h), filename);
+	write_section(fp, packed_histogram_section(all), filename);
+	for (auto &s : sections) {
+		write_section(fp, s, filename);
+	}
+	if (!server_stats.empty()) {
+		uint32_t len = server_stats.size();
+		put(fp, server_stats_magic, sizeof(server_stats_magic), filename);
+		put(fp, &len, sizeof(len), filename);
+		put(fp, server_stats.data(), len, filename);
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Unable to write '%s': %s\n", filename, strerror(errno));
+		exit(1);
+	}
+}
+
+void histogram_read(const char *filename, histogram_file_header *h, histogram_section *all,
+	std::vector<packed_histogram_section> *conns, std::string *server_stats) {
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "Unable to open '%s': %s\n", filename, strerror(errno));
+		exit(1);
+	}
+	get(fp, h, sizeof(*h), filename);
+	if (memcmp(h->magic, histogram_file_magic, sizeof(h->magic)) != 0) {
+		fprintf(stderr, "%s: not a memloader histogram file\n", filename);
+		exit(1);
+	}
+
+	packed_histogram_section packed_all;
+	read_section(fp, h->slot_cnt, &packed_all, filename);
+	*all = histogram_section(packed_all.label, h->slot_cnt);
+	all->add(packed_all);
+	conns->assign(h->conn_cnt, packed_histogram_section());
+	for (auto &s : *conns) {
+		read_section(fp, h->slot_cnt, &s, filename);
+	}
+	server_stats->clear();
+	char magic[sizeof(server_stats_magic)];
+	if (fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, server_stats_magic, sizeof(magic)) == 0) {
+		uint32_t len;
+		get(fp, &len, sizeof(len), filename);
+		server_stats->resize(len);
+		if (len > 0) {
+			get(fp, &(*server_stats)[0], len, filename);
+		}
+	}
+	fclose(fp);
+}
+
+int histogram_quantile_slot(const std::vector<uint64_t> &slots, double q) {
+	uint64_t total = 0;
+	for (uint64_t c : slots) {
+		total += c;
+	}
+	if (total == 0) {
+		return -1;
+	}
+	double rank = q * total;
+	uint64_t cum = 0;
+	for (size_t i = 0; i < slots.size(); i++) {
+		cum += slots[i];
+		if (cum >= rank && cum > 0) {
+			return i;
+		}
+	}
+	return slots.size() - 1;
+}
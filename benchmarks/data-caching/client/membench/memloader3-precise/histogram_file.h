@@ -0,0 +1,81 @@
+#ifndef HISTOGRAM_FILE_H
+#define HISTOGRAM_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// All histograms of a run in one binary file (--histogram), read back by histtool.
+// The file is a histogram_file_header, a section with the sum over all connections, then one
+// section per connection. A section is its label (uint16 length + bytes), then for each kind
+// the number of samples seen (uint32), the number of non-empty slots (uint32), and that many
+// (uint32 slot, uint64 count) pairs. The last slot of a kind counts the overflow.
+// With --server-stats, the sections are followed by server_stats_magic, a uint32 length and
+// the "SS:" lines of the run (see server_stats.h); readers that stop after the sections
+// don't see it.
+
+static const char histogram_file_magic[8] = {'M', 'L', 'H', 'I', 'S', 'T', '0', '1'};
+static const char server_stats_magic[8] = {'M', 'L', 'S', 'S', 'T', 'A', 'T', '1'};
+
+enum hist_kind {
+	hk_latency,
+	hk_request_interval,
+	hk_response_interval,
+	hk_end
+};
+
+extern const char *hist_kind_names[hk_end];
+
+class histogram_file_header {
+public:
+	char magic[8];
+	uint32_t conn_cnt;
+	uint32_t slot_cnt; // including the overflow slot
+	uint32_t head;
+	uint32_t body;
+	double scale[hk_end]; // ns per slot
+};
+
+class packed_histogram_section;
+
+class histogram_section {
+public:
+	std::string label;
+	uint32_t sample_cnt[hk_end];
+	std::vector<uint64_t> slots[hk_end]; // dense, slot_cnt each
+
+public:
+	histogram_section(const std::string &label, int slot_cnt);
+	void add(const histogram_section &other);
+	void add(const packed_histogram_section &other);
+};
+
+// Only the non-empty slots of a section, as stored in the file. Writers and readers keep the
+// sections of many connections this way, a dense section is about 80KB per kind.
+class packed_histogram_section {
+public:
+	std::string label;
+	uint32_t sample_cnt[hk_end];
+	std::vector<uint32_t> slot_ids[hk_end];
+	std::vector<uint64_t> counts[hk_end];
+
+public:
+	packed_histogram_section() {}
+	explicit packed_histogram_section(const histogram_section &s);
+};
+
+// Writes the header, all (the sum of the sections), the sections and the server statistics if
+// there are any. Will exit program on failure.
+void histogram_write(const char *filename, const histogram_file_header &h, const histogram_section &all,
+	const std::vector<packed_histogram_section> &sections, const std::string &server_stats);
+
+// Reads a file written by histogram_write: the sum into all (dense), the connections' sections
+// into conns (packed). server_stats is left empty if the file has none. Will exit program if
+// the file is unreadable.
+void histogram_read(const char *filename, histogram_file_header *h, histogram_section *all,
+	std::vector<packed_histogram_section> *conns, std::string *server_stats);
+
+// Slot below which a fraction q of the samples lies, -1 if there are none.
+int histogram_quantile_slot(const std::vector<uint64_t> &slots, double q);
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "histogram_file.h"
+
+// Reads histogram files written by "memloader --histogram", merges them and prints percentiles.
+
+static hist_kind kind = hk_latency;
+static std::vector<double> quantiles = {0.5, 0.9, 0.99, 0.999};
+static bool per_conn = false;
+static bool per_tenant = false;
+static bool dump_slots = false;
+static bool show_server_stats = false;
+static std::vector<const char*> files;
+
+static void usage() {
+	fprintf(stderr, "usage: histtool [--kind latency|request_interval|response_interval] [--percentiles p1,p2,...] [--per-conn] [--per-tenant] [--server-stats] [--dump] <file>...\n");
+	exit(1);
+}
+
+static void parse_arguments(int argc, char **argv) {
+	int i = 1;
+	while (i < argc) {
+		const char *key = argv[i++];
+		if (strcmp(key, "--kind") == 0 && i < argc) {
+			const char *name = argv[i++];
+			int k = 0;
+			while (k < hk_end && strcmp(name, hist_kind_names[k]) != 0) {
+				k++;
+			}
+			if (k == hk_end) {
+				fprintf(stderr, "unknown histogram kind: %s\n", name);
+				exit(1);
+			}
+			kind = (hist_kind) k;
+		} else if (strcmp(key, "--percentiles") == 0 && i < argc) {
+			quantiles.clear();
+			char *p = argv[i++];
+			while (*p != '\0') {
+				char *end;
+				double pct = strtod(p, &end);
+				if (end == p || pct < 0.0 || pct > 100.0) {
+					fprintf(stderr, "bad percentile list: %s\n", argv[i - 1]);
+					exit(1);
+				}
+				quantiles.push_back(pct / 100.0);
+				p = *end == ',' ? end + 1 : end;
+			}
+		} else if (strcmp(key, "--per-conn") == 0) {
+			per_conn = true;
+		} else if (strcmp(key, "--per-tenant") == 0) {
+			per_tenant = true;
+		} else if (strcmp(key, "--server-stats") == 0) {
+			show_server_stats = true;
+		} else if (strcmp(key, "--dump") == 0) {
+			dump_slots = true;
+		} else if (key[0] == '-') {
+			usage();
+		} else {
+			files.push_back(key);
+		}
+	}
+	if (files.empty()) {
+		usage();
+	}
+}
+
+// Sums the connection sections of each tenant, whose labels start with "<tenant>:".
+static std::vector<histogram_section> tenant_sections(const std::vector<packed_histogram_section> &sections, int slot_cnt) {
+	std::vector<histogram_section> tenants;
+	for (size_t c = 0; c < sections.size(); c++) {
+		size_t colon = sections[c].label.find(':');
+		if (colon == std::string::npos) {
+			continue;
+		}
+		std::string name = sections[c].label.substr(0, colon);
+		size_t t = 0;
+		while (t < tenants.size() && tenants[t].label != name) {
+			t++;
+		}
+		if (t == tenants.size()) {
+			tenants.push_back(histogram_section(name, slot_cnt));
+		}
+		tenants[t].add(sections[c]);
+	}
+	return tenants;
+}
+
+// Slots are floor(value / scale), so slot i stands for values from i * scale; the last slot is the overflow.
+static void print_percentiles(const char *label, const histogram_section &s, double scale, bool show_samples) {
+	const std::vector<uint64_t> &slots = s.slots[kind];
+	uint64_t total = 0;
+	for (uint64_t c : slots) {
+		total += c;
+	}
+	printf("%s: count %llu", label, (unsigned long long) total);
+	if (show_samples) {
+		printf(" samples %u", s.sample_cnt[kind]);
+	}
+	for (double q : quantiles) {
+		int slot = histogram_quantile_slot(slots, q);
+		printf(" p%g ", q * 100.0);
+		if (slot < 0) {
+			printf("-");
+		} else if (slot == (int) slots.size() - 1) {
+			printf(">=%.1fus", slot * scale / 1.0e3);
+		} else {
+			printf("%.1fus", slot * scale / 1.0e3);
+		}
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	parse_arguments(argc, argv);
+
+	histogram_file_header first;
+	histogram_section merged("merged", 0);
+	for (size_t f = 0; f < files.size(); f++) {
+		histogram_file_header h;
+		histogram_section all("", 0);
+		std::vector<packed_histogram_section> sections; // of the connections
+		std::string server_stats;
+		histogram_read(files[f], &h, &all, &sections, &server_stats);
+		if (f == 0) {
+			first = h;
+			merged = histogram_section("merged", h.slot_cnt);
+		} else if (h.slot_cnt != first.slot_cnt || memcmp(h.scale, first.scale, sizeof(h.scale)) != 0) {
+			fprintf(stderr, "%s: histogram layout differs from %s, can't merge\n", files[f], files[0]);
+			exit(1);
+		}
+		merged.add(all);
+
+		if (dump_slots) {
+			continue;
+		}
+		int short_cnt = 0;
+		for (size_t c = 0; c < sections.size(); c++) {
+			if (sections[c].sample_cnt[kind] < h.head + h.body) {
+				short_cnt++;
+			}
+		}
+		printf("%s: %s, %u connections, head %u body %u", files[f], hist_kind_names[kind], h.conn_cnt, h.head, h.body);
+		if (short_cnt > 0) {
+			printf(", %d short of samples", short_cnt);
+		}
+		printf("\n");
+		print_percentiles("all", all, h.scale[kind], false);
+		if (per_tenant) {
+			for (const auto &t : tenant_sections(sections, h.slot_cnt)) {
+				print_percentiles(t.label.c_str(), t, h.scale[kind], false);
+			}
+		}
+		if (per_conn) {
+			for (const auto &s : sections) {
+				histogram_section conn(s.label, h.slot_cnt);
+				conn.add(s);
+				print_percentiles(conn.label.c_str(), conn, h.scale[kind], true);
+			}
+		}
+		if (show_server_stats) {
+			fputs(server_stats.empty() ? "no server statistics (run without --server-stats)\n" : server_stats.c_str(), stdout);
+		}
+	}
+
+	if (dump_slots) {
+		// the text layout of the old per-connection files: one count per slot, overflow last
+		for (uint64_t c : merged.slots[kind]) {
+			printf("%llu\n", (unsigned long long) c);
+		}
+	} else if (files.size() > 1) {
+		print_percentiles("merged", merged, first.scale[kind], false);
+	}
+	return 0;
+}
@@ -0,0 +1,245 @@
+#include "interval_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "config.h"
+#include "conn_work.h"
+#include "latency_classes.h"
+
+// In cwc_names order, NULL for what the stream leaves out.
+static const char *counter_names[] = {
+	"sent_set_query",
+	"sent_get_query",
+	"replied_set_query",
+	"replied_get_query",
+	"hit_get_query",
+	"good_qos_query",
+	"latency_sum",
+	NULL, // max_latency
+	NULL, // min_latency
+	"send_delay_sum",
+	"send_duration_sum",
+	"udp_timeout",
+	"lost_query",
+	"connect",
+	"connect_time_sum",
+	"replied_first_query",
+	"first_latency_sum",
+	"tls_handshake",
+	"tls_handshake_time_sum",
+	"tls_resumed",
+	"tls_send_time_sum",
+	"tls_recv_time_sum",
+	"wire_query",
+	"wire_hw_query",
+	"wire_latency_sum",
+	"stack_latency_sum",
+	"txtime_query",
+	"txtime_early",
+	"txtime_lag_sum",
+	"near_lookup",
+	"near_hit",
+	"near_stale",
+	"near_latency_sum",
+	"migration",
+	NULL, // core_end
+	"sent_query",
+	"replied_query",
+	"retired_query",
+	"outstanding_query",
+};
+static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == cwc_end, "counter_names doesn't match cwc_names");
+
+static const int quantile_cnt = 4;
+static const double quantiles[quantile_cnt] = {0.5, 0.9, 0.99, 0.999};
+static const char *quantile_names[quantile_cnt] = {"p50_ms", "p90_ms", "p99_ms", "p999_ms"};
+
+static stream_format_t stream_format;
+static FILE *stream_fp = NULL;
+static std::thread writer;
+static std::mutex queue_lock;
+static std::condition_variable queue_cond;
+static std::deque<std::string> queue;
+static bool closing = false;
+
+static void write_run() {
+	std::unique_lock<std::mutex> lock(queue_lock);
+	while (true) {
+		queue_cond.wait(lock, [] { return !queue.empty() || closing; });
+		if (queue.empty()) {
+			break;
+		}
+		std::deque<std::string> batch;
+		batch.swap(queue);
+		lock.unlock();
+		for (const auto &s : batch) {
+			fputs(s.c_str(), stream_fp);
+		}
+		fflush(stream_fp);
+		lock.lock();
+	}
+}
+
+static void enqueue(const std::string &s) {
+	queue_lock.lock();
+	queue.push_back(s);
+	queue_lock.unlock();
+	queue_cond.notify_one();
+}
+
+static std::string json_string(const char *s) {
+	std::string res = "\"";
+	for (; *s != '\0'; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			res += '\\';
+			res += c;
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			res += buf;
+		} else {
+			res += c;
+		}
+	}
+	return res + "\"";
+}
+
+// A number, or the null value of the format if it isn't finite.
+static std::string number(double v, const char *fmt = "%.17g") {
+	if (!isfinite(v)) {
+		return stream_format == sfm_json ? "null" : "";
+	}
+	char buf[64];
+	snprintf(buf, sizeof(buf), fmt, v);
+	return buf;
+}
+
+static std::string run_json(int argc, char **argv, int conn_cnt) {
+	std::string s = "{\"type\":\"run\",\"args\":[";
+	for (int i = 0; i < argc; i++) {
+		s += (i > 0 ? "," : "") + json_string(argv[i]);
+	}
+	s += "],\"start_time\":" + number(time(NULL), "%.0f");
+	s += ",\"seed\":" + std::to_string((unsigned long long) conf.seed);
+	s += ",\"conns\":" + std::to_string(conn_cnt);
+	s += ",\"protocol\":" + json_string(conf.udp ? "udp" : (conf.tls ? "tls" : "tcp"));
+	s += std::string(",\"mirror\":") + (conf.mirror ? "true" : "false");
+	s += ",\"load\":" + number(conf.load);
+	s += ",\"servers\":[";
+	for (int sid = 0; sid < (int) conf.servers.size(); sid++) {
+		s += sid > 0 ? ",[" : "[";
+		bool first = true;
+		for (const auto &a : conf.servers[sid].addrs) {
+			s += (first ? "" : ",") + json_string((std::string(a.hostname) + ":" + a.port).c_str());
+			first = false;
+		}
+		s += "]";
+	}
+	s += "],\"tenants\":[";
+	for (int i = 0; i < (int) conf.tenants.size(); i++) {
+		const tenant_workload &t = conf.tenants[i];
+		s += i > 0 ? ",{" : "{";
+		s += "\"name\":" + json_string(t.name != NULL ? t.name : "default");
+		s += ",\"db_size\":" + std::to_string(t.db_size);
+		s += ",\"vclients\":" + std::to_string(t.vclients);
+		s += ",\"load\":" + number(t.load);
+		s += ",\"qos_ms\":" + number(t.qos);
+		s += ",\"set_ratio\":" + number(t.set_ratio);
+		s += "}";
+	}
+	return s + "]}\n";
+}
+
+static std::string run_csv(int argc, char **argv, int conn_cnt) {
+	std::string s = "# args";
+	for (int i = 0; i < argc; i++) {
+		s += std::string(" ") + argv[i];
+	}
+	s += "\n# start_time " + number(time(NULL), "%.0f") + "\n";
+	s += "# seed " + std::to_string((unsigned long long) conf.seed) + "\n";
+	s += "# conns " + std::to_string(conn_cnt) + "\n";
+	s += "round,iter,kind,time,duration,scope,conns";
+	for (int c = 0; c < cwc_end; c++) {
+		if (counter_names[c] != NULL) {
+			s += std::string(",") + counter_names[c];
+		}
+	}
+	s += ",send_rate,reply_rate,qos,hit_ratio,avg_lat_ms";
+	for (int q = 0; q < quantile_cnt; q++) {
+		s += std::string(",") + quantile_names[q];
+	}
+	return s + "\n";
+}
+
+void stream_open(const char *filename, stream_format_t format, int argc, char **argv, int conn_cnt) {
+	stream_fp = fopen(filename, "w");
+	if (stream_fp == NULL) {
+		perror("stream_open: can't create stream file");
+		exit(1);
+	}
+	stream_format = format;
+	enqueue(format == sfm_json ? run_json(argc, argv, conn_cnt) : run_csv(argc, argv, conn_cnt));
+	writer = std::thread(write_run);
+}
+
+static std::string scope_record(int round, int iter, char kind, double time, double duration, const stream_scope &sc) {
+	const double *d = sc.counters;
+	const bool json = stream_format == sfm_json;
+	std::string s;
+	if (json) {
+		s = "{\"type\":\"interval\",\"round\":" + std::to_string(round) + ",\"iter\":" + std::to_string(iter);
+		s += std::string(",\"kind\":\"") + kind + "\",\"time\":" + number(time, "%.3f");
+		s += ",\"duration\":" + number(duration, "%.3f") + ",\"scope\":" + json_string(sc.name);
+		s += ",\"conns\":" + std::to_string(sc.conn_cnt);
+	} else {
+		s = std::to_string(round) + "," + std::to_string(iter) + "," + kind + "," + number(time, "%.3f");
+		s += "," + number(duration, "%.3f") + "," + sc.name + "," + std::to_string(sc.conn_cnt);
+	}
+	auto field = [&](const char *name, const std::string &v) {
+		if (json) {
+			s += std::string(",\"") + name + "\":" + v;
+		} else {
+			s += "," + v;
+		}
+	};
+	for (int c = 0; c < cwc_end; c++) {
+		if (counter_names[c] != NULL) {
+			field(counter_names[c], number(d[c]));
+		}
+	}
+	field("send_rate", number(d[cwc_sent_query] / duration, "%.1f"));
+	field("reply_rate", number(d[cwc_replied_query] / duration, "%.1f"));
+	field("qos", number(d[cwc_good_qos_query] / d[cwc_retired_query] * 100.0, "%.3f"));
+	field("hit_ratio", number(d[cwc_hit_get_query] / d[cwc_replied_get_query], "%.4f"));
+	field("avg_lat_ms", number(d[cwc_latency_sum] / d[cwc_replied_query], "%.4f"));
+	for (int q = 0; q < quantile_cnt; q++) {
+		double v = d[cwc_replied_query] > 0.0 ? latency_bins_quantile_interp(sc.lat_bins, quantiles[q]) : NAN;
+		field(quantile_names[q], number(v, "%.4f"));
+	}
+	return s + (json ? "}\n" : "\n");
+}
+
+void stream_report(int round, int iter, char kind, double time, double duration, const std::vector<stream_scope> &scopes) {
+	std::string s;
+	for (const auto &sc : scopes) {
+		s += scope_record(round, iter, kind, time, duration, sc);
+	}
+	enqueue(s);
+}
+
+void stream_close() {
+	queue_lock.lock();
+	closing = true;
+	queue_lock.unlock();
+	queue_cond.notify_one();
+	writer.join();
+	fclose(stream_fp);
+}
@@ -0,0 +1,47 @@
+#ifndef INTERVAL_STREAM_H
+#define INTERVAL_STREAM_H
+
+#include <vector>
+
+// Machine readable copy of the interval reports (--stream), for tools that would otherwise
+// scrape the D:/A: lines. The report thread only formats records, a writer thread of its own
+// does the file I/O, so a slow disk holds up neither the workers nor the report intervals.
+//
+// With json, every line is an object. The first one, {"type":"run",...}, has the command line,
+// seed, servers and tenants; then every report adds one {"type":"interval",...} per scope.
+// With csv, the run metadata comes as "# " lines, then a header line and one row per scope and
+// report. The fields of a scope's record are:
+//   round, iter               round number, and interval number in the round (both from 0)
+//   kind                      "D" for the interval, "A" for the round so far (see --round)
+//   time, duration            seconds since work started, and seconds covered
+//   scope, conns              "all" or a report group (numa node, tenant, server), and its
+//                             connections
+//   <counter>                 every conn_work counter (cwc_* without the prefix) summed over the
+//                             connections, as differences over the duration; outstanding_query
+//                             is a snapshot. The non additive min/max latencies are left out.
+//   send_rate, reply_rate, qos, hit_ratio, avg_lat_ms
+//                             as on the D:/A: lines
+//   p50_ms ... p999_ms        latency percentiles, interpolated in log-linear bins
+// Ratios without a denominator are null in json and empty in csv.
+
+enum stream_format_t {sfm_json, sfm_csv};
+
+class stream_scope {
+public:
+	const char *name;
+	int conn_cnt;
+	const double *counters; // cwc_end differences
+	const double *lat_bins; // lat_bin_cnt differences
+};
+
+// Creates the file, writes the run metadata and starts the writer thread. Will exit program if
+// the file can't be created.
+void stream_open(const char *filename, stream_format_t format, int argc, char **argv, int conn_cnt);
+
+// Queues the records of one report.
+void stream_report(int round, int iter, char kind, double time, double duration, const std::vector<stream_scope> &scopes);
+
+// Writes out everything queued and stops the writer thread.
+void stream_close();
+
+#endif
@@ -0,0 +1,175 @@
+#include "key_template.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const key_template legacy_keys(NULL);
+const key_template *response_key_template = &legacy_keys;
+
+static const char *base62_alphabet = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+static const char *hex_alphabet = "0123456789abcdef";
+static const char *decimal_alphabet = "0123456789";
+
+// An invertible 32-bit hash (two multiply-xorshift rounds, after an offset so that seed 0
+// doesn't stay 0).
+uint32_t key_template::scramble(uint32_t x) {
+	x ^= 0x9e3779b9;
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+uint32_t key_template::unscramble(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x43021123; // inverse of 0x846ca68b mod 2^32
+	x ^= x >> 15 ^ x >> 30;
+	x *= 0x1d69e2a5; // inverse of 0x7feb352d mod 2^32
+	x ^= x >> 16;
+	return x ^ 0x9e3779b9;
+}
+
+bool key_template::valid_key_text(const char *s) {
+	for (; *s != '\0'; s++) {
+		if (*s <= ' ' || *s > '~') {
+			return false;
+		}
+	}
+	return true;
+}
+
+key_template::key_template(const char *spec) {
+	legacy = spec == NULL;
+	has_ns = false;
+	alphabet = hex_alphabet;
+	radix = 16;
+	seed_chars = sizeof(int) * 2;
+	memset(digit_values, -1, sizeof(digit_values));
+	if (legacy) {
+		return;
+	}
+
+	if (!valid_key_text(spec)) {
+		fprintf(stderr, "key_template: \"%s\" has spaces or control characters\n", spec);
+		exit(1);
+	}
+	std::string text;
+	bool has_id = false;
+	for (const char *p = spec; *p != '\0'; ) {
+		if (*p != '{') {
+			text += *p++;
+			continue;
+		}
+		const char *end = strchr(p, '}');
+		if (end == NULL) {
+			fprintf(stderr, "key_template: unterminated field in \"%s\"\n", spec);
+			exit(1);
+		}
+		std::string field(p + 1, end - p - 1);
+		p = end + 1;
+		if (field == "ns") {
+			if (has_ns || has_id) {
+				fprintf(stderr, "key_template: {ns} must come once, before the id field\n");
+				exit(1);
+			}
+			has_ns = true;
+			head = text;
+		} else if (field == "id" || field == "hex" || field == "num") {
+			if (has_id) {
+				fprintf(stderr, "key_template: \"%s\" has more than one id field\n", spec);
+				exit(1);
+			}
+			has_id = true;
+			if (field == "id") {
+				alphabet = base62_alphabet;
+				radix = 62;
+				seed_chars = 6; // 62^6 > 2^32
+			} else if (field == "num") {
+				alphabet = decimal_alphabet;
+				radix = 10;
+				seed_chars = 10;
+			}
+			if (has_ns) {
+				middle = text.substr(head.size());
+			} else {
+				head = text;
+			}
+		} else {
+			fprintf(stderr, "key_template: unknown field {%s}, expected {ns}, {id}, {hex} or {num}\n", field.c_str());
+			exit(1);
+		}
+	}
+	if (!has_id) {
+		fprintf(stderr, "key_template: \"%s\" has no id field ({id}, {hex} or {num})\n", spec);
+		exit(1);
+	}
+	tail = text.substr(head.size() + middle.size());
+	for (int d = 0; d < radix; d++) {
+		digit_values[(unsigned char) alphabet[d]] = d;
+	}
+}
+
+int key_template::min_key_size(const char *ns) const {
+	if (legacy) {
+		return seed_chars;
+	}
+	return head.size() + (has_ns ? strlen(ns) : 0) + middle.size() + seed_chars + tail.size();
+}
+
+void key_template::render(char *key, int key_size, int key_seed, const char *ns) const {
+	if (legacy) {
+		const int pad_size = key_size - seed_chars;
+		memset(key, 'K', pad_size);
+		uint32_t v = key_seed;
+		for (int i = key_size - 1; i >= pad_size; i--) {
+			key[i] = "0123456789ABCDEF"[v & 0x0f];
+			v >>= 4;
+		}
+		return;
+	}
+
+	char *p = key;
+	memcpy(p, head.data(), head.size());
+	p += head.size();
+	if (has_ns) {
+		memcpy(p, ns, strlen(ns));
+		p += strlen(ns);
+	}
+	memcpy(p, middle.data(), middle.size());
+	p += middle.size();
+	char *id_end = key + key_size - tail.size();
+	// filler from a generator seeded by the key, so a key is the same in every run
+	uint64_t h = (uint64_t) (uint32_t) key_seed * 0x9e3779b97f4a7c15ULL + 1;
+	for (; p < id_end - seed_chars; p++) {
+		h = h * 6364136223846793005ULL + 1442695040888963407ULL;
+		*p = alphabet[(h >> 33) % radix];
+	}
+	uint64_t v = scramble(key_seed);
+	for (char *d = id_end - 1; d >= p; d--) {
+		*d = alphabet[v % radix];
+		v /= radix;
+	}
+	memcpy(id_end, tail.data(), tail.size());
+}
+
+int key_template::decode_id(const char *key, int key_size) const {
+	const char *p = key + key_size - tail.size() - seed_chars;
+	if (p < key) {
+		return -1;
+	}
+	uint64_t v = 0;
+	for (int i = 0; i < seed_chars; i++) {
+		int d = digit_values[(unsigned char) p[i]];
+		if (d < 0) {
+			return -1;
+		}
+		v = v * radix + d;
+	}
+	if (v > UINT32_MAX) {
+		return -1;
+	}
+	return unscramble(v);
+}
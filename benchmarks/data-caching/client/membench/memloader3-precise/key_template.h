@@ -0,0 +1,63 @@
+#ifndef KEY_TEMPLATE_H
+#define KEY_TEMPLATE_H
+
+#include <stdint.h>
+#include <string>
+
+// Layout of the keys. Without --key-template, a key is its seed in 8 upper case hex digits,
+// padded in front with 'K' up to the key size of its sample entry. A template such as
+// "app:{ns}:user:{id}:profile" is literal text, the tenant name in place of {ns}, and one id
+// field that stretches to fill the key size. The id is filler characters followed by the key
+// seed, scrambled by a bijection and written in the field's alphabet, so that neighbouring
+// seeds give unrelated ids and a key still decodes back to its seed from a fixed position.
+//   {id}  base62 [0-9A-Za-z], 6 characters hold the seed
+//   {hex} lower case hex, 8 characters
+//   {num} decimal digits, 10 characters
+// Keys are rendered once per database (see memdb), never per request.
+class key_template {
+private:
+	bool legacy; // the 'K' padded hex layout
+	std::string head; // before {ns}, or before the id without {ns}
+	bool has_ns;
+	std::string middle; // between {ns} and the id
+	std::string tail; // after the id
+	const char *alphabet;
+	int radix;
+	int seed_chars;
+	int8_t digit_values[256]; // -1 for characters outside the alphabet
+
+	static uint32_t scramble(uint32_t x);
+	static uint32_t unscramble(uint32_t x);
+	int decode_id(const char *key, int key_size) const;
+
+public:
+	key_template(const char *spec); // NULL for the 'K' padded layout
+
+	// Shortest key the template can render for a tenant named ns.
+	int min_key_size(const char *ns) const;
+	// Writes the key_size bytes of the key of key_seed.
+	void render(char *key, int key_size, int key_seed, const char *ns) const;
+	// Key seed of a key written by render, or -1 when it can't be one.
+	int decode(const char *key, int key_size) const {
+		if (legacy) {
+			const int key_seed_str_size = sizeof(int) * 2;
+			if (key_size < key_seed_str_size) {
+				return -1;
+			}
+			uint32_t key_seed = 0;
+			for (const char *h = key + key_size - key_seed_str_size; h != key + key_size; h++) {
+				key_seed = (key_seed << 4) | (*h <= '9' ? *h - '0' : *h - 'A' + 10);
+			}
+			return key_seed;
+		}
+		return decode_id(key, key_size);
+	}
+
+	// Whether s only has characters allowed in memcached keys.
+	static bool valid_key_text(const char *s);
+};
+
+// The layout parse_response_head decodes keys with.
+extern const key_template *response_key_template;
+
+#endif
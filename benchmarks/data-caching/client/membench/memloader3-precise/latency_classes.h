@@ -0,0 +1,109 @@
+#ifndef LATENCY_CLASSES_H
+#define LATENCY_CLASSES_H
+
+#include <math.h>
+#include <limits>
+#include "memcached_cmd.h"
+
+// Counters of requests grouped by op and value size class (floor(log2(val_size))), kept when
+// conf.size_classes is set. Each class has a few counters plus a log-linear latency histogram
+// (4 bins per power of two, from 1us up to ~1s), all stored in one flat array of doubles so they
+// can be summed and subtracted like the cwc_* counters.
+
+static const int val_class_cnt = 21; // max_val_size is 2^20
+static const int lat_bin_octaves = 20;
+static const int lat_bin_cnt = 1 + lat_bin_octaves * 4 + 1; // under 1us, octaves, overflow
+
+enum lcc_names {
+	lcc_sent,
+	lcc_replied,
+	lcc_hit,
+	lcc_latency_sum, // in ms
+	lcc_bins,
+	lcc_end = lcc_bins + lat_bin_cnt
+};
+
+static const int memcmd_cnt = 2;
+static const int latency_class_counter_cnt = memcmd_cnt * val_class_cnt * lcc_end;
+
+static inline int val_size_class(int val_size) {
+	int cls = 0;
+	while (val_size > 1 && cls < val_class_cnt - 1) {
+		val_size >>= 1;
+		cls++;
+	}
+	return cls;
+}
+
+static inline int latency_class_index(memcmd_t cmd, int val_class, int lcc) {
+	return ((int) cmd * val_class_cnt + val_class) * lcc_end + lcc;
+}
+
+static inline int latency_bin(double latency_us) {
+	if (latency_us < 1.0) {
+		return 0;
+	}
+	int e;
+	double m = frexp(latency_us, &e); // latency_us = m * 2^e, 0.5 <= m < 1
+	int octave = e - 1;
+	if (octave >= lat_bin_octaves) {
+		return lat_bin_cnt - 1;
+	}
+	int sub = (int) ((m * 2.0 - 1.0) * 4.0);
+	return 1 + octave * 4 + sub;
+}
+
+// Upper bound of a latency bin in us.
+static inline double latency_bin_upper(int bin) {
+	if (bin == 0) {
+		return 1.0;
+	}
+	if (bin == lat_bin_cnt - 1) {
+		return std::numeric_limits<double>::infinity();
+	}
+	int octave = (bin - 1) / 4;
+	int sub = (bin - 1) % 4;
+	return ldexp(1.0 + (sub + 1) / 4.0, octave);
+}
+
+// Latency (in ms) below which a fraction q of the samples in bins lies, rounded up to a bin bound.
+static inline double latency_bins_quantile(const double *bins, double q) {
+	double total = 0.0;
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		total += bins[b];
+	}
+	double rank = q * total;
+	double cum = 0.0;
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		cum += bins[b];
+		if (cum >= rank && cum > 0.0) {
+			return latency_bin_upper(b) / 1.0e3;
+		}
+	}
+	return 0.0;
+}
+
+// Like latency_bins_quantile, but interpolated linearly inside the bin, so that shifts smaller
+// than a bin still move the estimate (the overflow bin gives its lower bound).
+static inline double latency_bins_quantile_interp(const double *bins, double q) {
+	double total = 0.0;
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		total += bins[b];
+	}
+	double rank = q * total;
+	double cum = 0.0;
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		if (cum + bins[b] >= rank && bins[b] > 0.0) {
+			double lower = b == 0 ? 0.0 : latency_bin_upper(b - 1);
+			if (b == lat_bin_cnt - 1) {
+				return lower / 1.0e3;
+			}
+			double upper = latency_bin_upper(b);
+			return (lower + (upper - lower) * (rank - cum) / bins[b]) / 1.0e3;
+		}
+		cum += bins[b];
+	}
+	return 0.0;
+}
+
+#endif
@@ -6,6 +6,10 @@
 #include <stdio.h>
 #include <pthread.h>
 #include "util.h"
+#include "key_template.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 static const char *hexa_table = "0123456789ABCDEF";
@@ -17,35 +21,9 @@ template<typename NT> void number_to_hexas(NT number, char *hexas) {
 	}
 }
 
-static void fill_key(char *key, int key_seed, int key_size) {
-	const int min_key_size = sizeof(key_seed) * 2;
-	if (key_size < min_key_size) {
-		fprintf(stderr, "key_seed2chars: key_size < min_key_size: %d, %d\n", key_size, min_key_size);
-		exit(1);
-	}
-	const int pad_size = key_size - min_key_size;
-	memset(key, 'K', pad_size);
-	key += pad_size;
-	number_to_hexas(key_seed, key);
-}
-
-static int extract_key_seed(char *key, int key_size) {
-	int key_seed_str_size = sizeof(int) * 2;
-	char *key_seed_str = key + key_size - key_seed_str_size;
-	char *p = NULL;
-	for (p = key_seed_str; *p == '0'; p++)
-		;
-	if (*p == '\0') {
-		return 0;
-	} else {
-		return strtol(p, NULL, 16);
-	}
-}
-
 static void fill_val(char *val, int key_seed, int val_size) {
 	const int key_seed_str_size = sizeof(int) * 2;
 	const int meta_size = 1/*|*/ + 16/*thread id*/ + 1/*|*/ + 16/*rdtsc*/ + 1/*|*/;
-	const int min_val_size = meta_size + key_seed_str_size + 1/*|*/;
 	if (val_size < min_val_size) {
 		fprintf(stderr, "sprint_val: val_size < min_val_size: %d, %d\n", val_size, min_val_size);
 		exit(1);
@@ -67,19 +45,50 @@ static void fill_val(char *val, int key_seed, int val_size) {
 	}
 }
 
-static int fill_set(const request &r, char *buf, int buf_size) {
+bool check_val(const char *val, int key_seed, int val_size) {
+	const int key_seed_str_size = sizeof(int) * 2;
+	const int meta_size = 1/*|*/ + 16/*thread id*/ + 1/*|*/ + 16/*rdtsc*/ + 1/*|*/;
+	const char *p = val;
+	if (p[0] != '|' || p[17] != '|' || p[34] != '|') {
+		return false;
+	}
+	p += meta_size;
+	const int pad_size = (val_size - meta_size) % (key_seed_str_size + 1);
+	if (pad_size > 0) {
+		for (int i = 0; i < pad_size - 1; i++) {
+			if (*p++ != 'V') return false;
+		}
+		if (*p++ != '|') return false;
+	}
+	char key_seed_str[key_seed_str_size + 1];
+	number_to_hexas(key_seed, key_seed_str);
+	key_seed_str[key_seed_str_size] = '|';
+	for (int i = 0; i < (val_size - meta_size) / (key_seed_str_size + 1); i++) {
+		if (memcmp(p, key_seed_str, key_seed_str_size + 1) != 0) return false;
+		p += key_seed_str_size + 1;
+	}
+	return true;
+}
+
+static int fill_set(const request &r, char *buf, int buf_size, bool noreply) {
 
-	assert(r.key_size + r.val_size + 30 <= buf_size);
+	assert(r.key_size + r.val_size + (noreply ? 38 : 30) <= buf_size);
 
 	char *p = buf;
 	memcpy(p, "set ", 4);
 	p += 4;
-	fill_key(p, r.key_seed, r.key_size);
+	memcpy(p, r.key, r.key_size);
 	p += r.key_size;
 	memcpy(p, " 0 0 ", 5);
 	p += 5;
-	sprintf(p, "%d\r\n", r.val_size);
-	p += r.vss_size + 2;
+	sprintf(p, "%d", r.val_size);
+	p += r.vss_size;
+	if (noreply) {
+		memcpy(p, " noreply", 8);
+		p += 8;
+	}
+	memcpy(p, "\r\n", 2);
+	p += 2;
 	fill_val(p, r.key_seed, r.val_size);
 	p += r.val_size;
 	memcpy(p, "\r\n", 2);
@@ -95,7 +104,7 @@ static int fill_get(const request &r, char *buf, int buf_size) {
 	char *p = buf;
 	memcpy(p, "get ", 4);
 	p += 4;
-	fill_key(p, r.key_seed, r.key_size);
+	memcpy(p, r.key, r.key_size);
 	p += r.key_size;
 	memcpy(p, "\r\n", 2);
 	p += 2;
@@ -106,7 +115,7 @@ static int fill_get(const request &r, char *buf, int buf_size) {
 int fill_send_buf(const request &r, char *buf, int buf_size) {
 	switch (r.cmd) {
 		case mcm_set:
-			return fill_set(r, buf, buf_size);
+			return fill_set(r, buf, buf_size, false);
 		case mcm_get:
 			return fill_get(r, buf, buf_size);
 		default:
@@ -116,29 +125,80 @@ int fill_send_buf(const request &r, char *buf, int buf_size) {
 	return -1;
 }
 
+int fill_noreply_set(const request &r, char *buf, int buf_size) {
+	return fill_set(r, buf, buf_size, true);
+}
+
+const char *find_line_end(const char *begin, const char *end) {
+	const char *p = begin;
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+	for (; p + 16 <= end; p += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) p);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; p != end; p++) {
+		if (*p == '\n') {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Parses "VALUE <key> <flags> <bytes>", "END" and "STORED" lines in one pass.
+// The key seed is decoded from the key by response_key_template while the line is scanned.
 void parse_response_head(response *resp, char *resp_head) {
-	char *p = resp_head;
-	char *tok_context;
-	const char *delim = " \r";
-
-	char *type = strtok_r(p, delim, &tok_context);
-
-	if (strcmp(type, "STORED") == 0) { // set ok
-		resp->err = mer_set_ok;
-	} else if (strcmp(type, "END") == 0) { // get not found
-		resp->err = mer_get_not_found;
-	} else if (strcmp(type, "VALUE") == 0) { // get found
-		resp->err = mer_get_found;
-		char *key = strtok_r(NULL, delim, &tok_context);
-		resp->key_size = strlen(key);
-		resp->key_seed = extract_key_seed(key, resp->key_size);
-		strtok_r(NULL, delim, &tok_context); // flags
-		char *value_size_str = strtok_r(NULL, delim, &tok_context); // bytes
-		resp->val_size = atoi(value_size_str);
-	} else {
-		fprintf(stderr, "parse_response_head: unknown type: %s\n", type);
-		exit(1);
+	const char *p = resp_head;
+
+	switch (p[0]) {
+	case 'S':
+		if (memcmp(p, "STORED", 6) == 0) { // set ok
+			resp->err = mer_set_ok;
+			return;
+		}
+		break;
+	case 'E':
+		if (memcmp(p, "END", 3) == 0) { // get not found
+			resp->err = mer_get_not_found;
+			return;
+		}
+		break;
+	case 'V':
+		if (memcmp(p, "VALUE ", 6) == 0) { // get found
+			const char *key = p + 6;
+			const char *key_end = key;
+			while (*key_end != ' ' && *key_end != '\0') key_end++;
+			if (*key_end == '\0') break;
+			int key_seed = response_key_template->decode(key, key_end - key);
+			if (key_seed < 0) {
+				fprintf(stderr, "parse_response_head: key doesn't match the key layout (--key-template): %s\n", resp_head);
+				exit(1);
+			}
+			p = key_end + 1;
+			while (*p != ' ' && *p != '\0') p++; // flags
+			if (*p == '\0') break;
+			p++;
+			int val_size = 0;
+			for (; *p >= '0' && *p <= '9'; p++) { // bytes
+				val_size = val_size * 10 + (*p - '0');
+			}
+			resp->err = mer_get_found;
+			resp->key_size = key_end - key;
+			resp->key_seed = key_seed;
+			resp->val_size = val_size;
+			return;
+		}
+		break;
+	default:
+		break;
 	}
+
+	fprintf(stderr, "parse_response_head: unknown type: %s\n", resp_head);
+	exit(1);
 }
 
 bool request_response_match(const request &r, const response &resp) {
@@ -21,14 +21,24 @@ enum memerr_t {
 	mer_get_found
 };
 
+// Kernel timestamps in ns (see timestamping.h), 0 if missing.
+class wire_stamp {
+public:
+	int64_t sw; // software, CLOCK_REALTIME
+	int64_t hw; // hardware, NIC clock
+};
+
 class request{
 public:
+	const char *key; // key_size bytes in the key arena of the db (see key_template.h)
 	int key_seed;
 	int key_size;
 	int val_size;
 	int vss_size; // size of value size string
 	memcmd_t cmd;
+	bool conn_first; // first request on its connection
 	double send_time; // in ns
+	uint32_t tx_key; // key of the TX timestamp of the request's last byte (udp: datagram)
 };
 
 class response {
@@ -38,15 +48,27 @@ public:
 	int val_size;
 	memerr_t err;
 	double recv_time; // in ns
+	wire_stamp wire_recv_time; // RX timestamp of the last read, with conf.timestamping
 };
 
 static const int max_key_size = 250;
 static const int max_val_size = 1 << 20;
+static const int min_val_size = 1 + 16 + 1 + 16 + 1 + sizeof(int) * 2 + 1; // stamp and one key seed (see fill_val)
 static const int max_request_size = max_key_size + max_val_size + 100;
 static const int max_response_size = max_key_size + max_val_size + 100;
 
+// Size of the buffer fill_send_buf needs for r.
+static inline int send_buf_size(const request &r) {
+	return r.key_size + (r.cmd == mcm_set ? r.val_size : 0) + 30;
+}
 int fill_send_buf(const request &r, char *buf, int buf_size);
+// A SET of r with "noreply", which needs 8 bytes more than send_buf_size.
+int fill_noreply_set(const request &r, char *buf, int buf_size);
+// Returns the first '\n' in [begin, end), or NULL if there is none.
+const char *find_line_end(const char *begin, const char *end);
 void parse_response_head(response *resp, char *resp_head);
+// Checks that a value body has the layout written by fill_send_buf for key_seed.
+bool check_val(const char *val, int key_seed, int val_size);
 bool request_response_match(const request &r, const response &resp);
 
 #endif
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <math.h>
+#include "randnum.h"
 
 memdb_sample::memdb_sample(const char *filename) {
 
@@ -56,7 +58,84 @@ memdb_sample::memdb_sample(const char *filename) {
 	printf("max_pop_tag: %d\n", max_pop_tag);
 }
 
-memdb::memdb(const memdb_sample *sample, int dbsize, int first_key_seed):
+// A point in (0, 1) hashed from the entry, one stream per law.
+static double entry_point(int stream, int entry) {
+	return ((derive_seed(stream, entry) >> 11) + 0.5) / 9007199254740992.0; // 2^53
+}
+
+static int clamp_size(double size, int lo, int hi) {
+	if (!(size >= lo)) { // NaN too
+		return lo;
+	}
+	if (size >= hi) {
+		return hi;
+	}
+	return (int) lround(size);
+}
+
+memdb_sample::memdb_sample(const size_dist &key_size, const size_dist &val_size, const popularity_dist &popularity,
+	int entry_cnt, int min_key_size) {
+
+	if (min_key_size > max_key_size) {
+		fprintf(stderr, "memdb_sample: keys of the key layout are longer than %d bytes\n", max_key_size);
+		exit(1);
+	}
+
+	max_pop_tag = -1; // not used, picks go through the alias table
+	entries.resize(entry_cnt);
+	double key_bytes = 0.0, val_bytes = 0.0;
+	int max_val = 0;
+	std::vector<double> probs(entry_cnt);
+	double weight_sum = 0.0;
+	for (int e = 0; e < entry_cnt; e++) {
+		sample_entry &en = entries[e];
+		en.pop_tag = e; // not used either
+		en.key_size = clamp_size(key_size.quantile(entry_point(1, e)), min_key_size, max_key_size);
+		en.val_size = clamp_size(val_size.quantile(entry_point(2, e)), min_val_size, max_val_size);
+		char vss[16];
+		en.vss_size = sprintf(vss, "%d", en.val_size);
+		key_bytes += en.key_size;
+		val_bytes += en.val_size;
+		max_val = en.val_size > max_val ? en.val_size : max_val;
+		probs[e] = popularity.weight(e);
+		weight_sum += probs[e];
+	}
+
+	// Vose's construction: columns below the mean weight are topped up from the ones above it.
+	alias_cut.resize(entry_cnt);
+	alias.resize(entry_cnt);
+	std::vector<int32_t> small, large;
+	for (int e = 0; e < entry_cnt; e++) {
+		probs[e] *= entry_cnt / weight_sum;
+		(probs[e] < 1.0 ? small : large).push_back(e);
+	}
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		alias_cut[s] = probs[s] > 0.0 ? (uint32_t) (probs[s] * 4294967296.0) : 0;
+		alias[s] = l;
+		probs[l] -= 1.0 - probs[s];
+		if (probs[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// left over columns are full, up to rounding
+	for (int e : large) {
+		alias_cut[e] = UINT32_MAX;
+		alias[e] = e;
+	}
+	for (int e : small) {
+		alias_cut[e] = UINT32_MAX;
+		alias[e] = e;
+	}
+
+	printf("generated sample: %d entries, key size %s (mean %.1f), value size %s (mean %.1f, max %d), popularity %s\n",
+		entry_cnt, key_size.describe().c_str(), key_bytes / entry_cnt, val_size.describe().c_str(),
+		val_bytes / entry_cnt, max_val, popularity.describe().c_str());
+}
+
+memdb::memdb(const memdb_sample *sample, int dbsize, int first_key_seed, const key_template *kt, const char *ns):
 sample(sample), dbsize(dbsize), first_key_seed(first_key_seed) {
 
 	if (dbsize % sample->entries.size() != 0) {
@@ -67,10 +146,41 @@ sample(sample), dbsize(dbsize), first_key_seed(first_key_seed) {
 	col_cnt = sample->entries.size();
 	row_cnt = dbsize / col_cnt;
 
+	const int min_key_size = kt->min_key_size(ns);
+	row_key_bytes = 0;
+	for (const sample_entry &se : sample->entries) {
+		if (se.key_size < min_key_size) {
+			fprintf(stderr, "memdb: key_size < min_key_size of the key layout: %d, %d\n", se.key_size, min_key_size);
+			exit(1);
+		}
+		key_offsets.push_back(row_key_bytes);
+		row_key_bytes += se.key_size;
+	}
+	keys.resize(row_key_bytes * row_cnt);
+	char *p = keys.data();
+	for (int e = 0; e < dbsize; e++) {
+		int key_size = sample->entries[e % col_cnt].key_size;
+		kt->render(p, key_size, first_key_seed + e, ns);
+		p += key_size;
+	}
 }
 
 int memdb::rand_pick_entry(rand_engine_t *rg) const {
 
+	if (!sample->alias.empty()) {
+		int row_id = 0;
+		if (row_cnt > 1) {
+			rand_uniform_int_t row_dist(0, row_cnt - 1);
+			row_id = row_dist(*rg);
+		}
+		uint64_t x = (*rg)();
+		int col_id = ((x >> 32) * col_cnt) >> 32;
+		if ((uint32_t) x >= sample->alias_cut[col_id]) {
+			col_id = sample->alias[col_id];
+		}
+		return row_id * col_cnt + col_id;
+	}
+
 	rand_uniform_int_t row_dist(0, row_cnt - 1);
 	rand_uniform_int_t point_dist(0, sample->max_pop_tag);
 
@@ -110,6 +220,7 @@ int memdb::key_seed_to_entry(int key_seed) const {
 
 void memdb::fill_request(request *r, int entry_index) const {
 	const sample_entry &se = sample->entries[entry_index % col_cnt];
+	r->key = keys.data() + entry_index / col_cnt * row_key_bytes + key_offsets[entry_index % col_cnt];
 	r->key_seed = first_key_seed + entry_index;
 	r->key_size = se.key_size;
 	r->val_size = se.val_size;
@@ -119,3 +230,7 @@ void memdb::fill_request(request *r, int entry_index) const {
 int memdb::get_dbsize() const {
 	return dbsize;
 }
+
+long memdb::key_arena_size() const {
+	return keys.size();
+}
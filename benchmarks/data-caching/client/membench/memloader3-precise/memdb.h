@@ -5,6 +5,8 @@
 #include <vector>
 #include "randnum.h"
 #include "memcached_cmd.h"
+#include "key_template.h"
+#include "workload_dist.h"
 
 class sample_entry {
 public:
@@ -18,9 +20,19 @@ class memdb_sample {
 public:
 	std::vector<sample_entry> entries;
 	int32_t max_pop_tag;
+	// Walker alias table of generated samples, empty for sample files (which are searched by
+	// pop_tag): column c is kept if the low 32 bits of a draw are below alias_cut[c], else
+	// alias[c] is picked instead.
+	std::vector<uint32_t> alias_cut;
+	std::vector<int32_t> alias;
 
 public:
 	memdb_sample(const char *sample_file);
+	// A sample of entry_cnt entries drawn from the laws, one per key of a database of that
+	// size. Key sizes are kept within [min_key_size, max_key_size], value sizes within
+	// [min_val_size, max_val_size].
+	memdb_sample(const size_dist &key_size, const size_dist &val_size, const popularity_dist &popularity,
+		int entry_cnt, int min_key_size);
 };
 
 class memdb {
@@ -30,13 +42,20 @@ private:
 	int first_key_seed;
 	int col_cnt;
 	int row_cnt;
+	// Key arena: every key rendered once, row after row. A row holds the keys of the sample
+	// entries in order, so a key is found from its entry index without a per-key offset.
+	std::vector<char> keys;
+	std::vector<long> key_offsets; // of each sample entry in a row
+	long row_key_bytes;
 
 public:
-	memdb(const memdb_sample *sample, int dbsize, int first_key_seed);
+	// ns is the tenant name, for {ns} in the key template.
+	memdb(const memdb_sample *sample, int dbsize, int first_key_seed, const key_template *kt, const char *ns);
 	int rand_pick_entry(rand_engine_t *rg) const;
 	int key_seed_to_entry(int key_seed) const;
 	void fill_request(request *r, int entry_index) const;
 	int get_dbsize() const;
+	long key_arena_size() const;
 };
 
 #endif
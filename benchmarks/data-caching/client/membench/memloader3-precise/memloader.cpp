@@ -8,12 +8,17 @@
 #include <limits.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <time.h>
 #include <list>
 #include <algorithm>
 #include <thread>
 #include <assert.h>
 #include <limits>
+#include <string>
+#include <vector>
+#include <new>
 #include "thread_utils.h"
+#include "numa_utils.h"
 #include "conn_work.h"
 #include "tcp_conn_worker.h"
 #include "udp_conn_worker.h"
@@ -21,15 +26,45 @@
 #include "memdb.h"
 #include "config.h"
 #include "clock.h"
+#include "tls_transport.h"
+#include "stage_profiler.h"
+#include "request_log.h"
+#include "histogram_file.h"
+#include "steady_state.h"
+#include "bulk_loader.h"
+#include "server_stats.h"
+#include "send_balancer.h"
 
 config conf;
 controller control;
 static int conn_cnt;
 static conn_work **conn_works;
 
+// A subset of connections whose counters are also reported on their own.
+class report_group {
+public:
+	std::string name;
+	std::vector<conn_work*> works;
+	double inits[cwc_end];
+	double olds[cwc_end];
+	std::vector<double> bin_inits; // latency bins, if conf.lat_bins
+	std::vector<double> bin_olds;
+};
+
+static std::vector<report_group> groups; // numa nodes and tenants
+static std::vector<report_group> server_groups; // servers and their addresses, for --per-server and --stream
+static std::vector<replay_stream> replay_streams;
+static double work_start_tv;
+
 static void init_conf() {
 	conf.db_sample_file = "-";
 	conf.db_size = 5000;
+	conf.generate = false;
+	conf.gen_key_size = size_dist::etc_key_size();
+	conf.gen_val_size = size_dist::etc_value_size();
+	conf.gen_popularity.law = ppl_uniform;
+	conf.gen_popularity.exponent = 0.0;
+	conf.key_template = NULL;
 
 	conf.mirror = false;
 
@@ -46,6 +81,14 @@ static void init_conf() {
 	conf.set_miss = false;
 
 	conf.preload = false;
+	conf.bulk_preload_conns = 0;
+	conf.bulk_verify_cnt = 0;
+
+	conf.seed = 0;
+	conf.random_seed = true;
+	conf.record_file = NULL;
+	conf.replay_file = NULL;
+	conf.replay_speed = 1.0;
 
 	conf.base_port = 0;
 
@@ -53,20 +96,66 @@ static void init_conf() {
 
 	conf.per_connection_work = 0;
 
+	conf.profile = false;
+	conf.profile_warn = 0.1;
+
+	conf.size_classes = false;
+	conf.per_server = false;
+
+	conf.near_cache_cap = 0;
+	conf.near_cache_policy = ncp_lru;
+	conf.near_cache_ttl = 0.0;
+
 	conf.histogram_head = 0;
 	conf.histogram_body = 0;
+	conf.histogram_file = "histograms.bin";
+
+	conf.steady_window = 0;
+	conf.steady_tolerance = 0.05;
+	conf.steady_p99_ci = 0.05;
+
+	conf.stream_file = NULL;
+	conf.stream_format = sfm_json;
 
 	conf.send_traffic_shape.shape = traffic_shape::UNIFORM;
 	conf.send_traffic_shape.param = 0.1;
 
 	conf.busy_loop_receive = false;
 	conf.receive_burst = 10;
+	conf.epoll_receive = false;
+	conf.busy_poll = 0;
+	conf.prefer_busy_poll = false;
+	conf.busy_poll_budget = 0;
+
+	conf.rebalance_lag = 0.0;
 
 	conf.connect_speed = 50.0; // new connection per second
 	conf.connection_init_load = 10.0;
 	conf.connection_ramp_up_speed = 100.0; // per connection load increament per second
 
+	conf.churn = false;
+	conf.churn_requests = 0;
+	conf.churn_time = 0.0;
+	conf.churn_connect_rate = 0.0;
+
+	conf.tls = false;
+	conf.tls_ciphers = NULL;
+	conf.tls_ciphersuites = NULL;
+	conf.tls_resume = true;
+	conf.tls_ktls = false;
+
+	conf.timestamping = tst_off;
+
+	conf.txtime_lead = 0.0;
+	conf.txtime_clock = CLOCK_MONOTONIC;
+
 	conf.mtu = 1500;
+	conf.recv_buf_max = 256 * 1024;
+	conf.validate_values = false;
+	conf.server_stats = false;
+
+	conf.numa = false;
+	conf.numa_nic = NULL;
 }
 
 // c = a - b
@@ -98,6 +187,36 @@ static void sum_counters(double *sums) {
 	}
 }
 
+static void sum_group_counters(const report_group &g, double *sums) {
+	for (int i = 0; i < cwc_end; i++) {
+		sums[i] = 0;
+	}
+	for (auto work : g.works) {
+		counters_plus(sums, work->all_counters, sums);
+	}
+}
+
+static void sum_group_lat_bins(const report_group &g, std::vector<double> *sums) {
+	sums->assign(lat_bin_cnt, 0.0);
+	for (auto work : g.works) {
+		for (int b = 0; b < lat_bin_cnt; b++) {
+			(*sums)[b] += work->all_lat_bins[b];
+		}
+	}
+}
+
+// Takes the inits (or olds) of every group.
+static void snapshot_groups(bool inits) {
+	for (auto *gs : {&groups, &server_groups}) {
+		for (auto &g : *gs) {
+			sum_group_counters(g, inits ? g.inits : g.olds);
+			if (conf.lat_bins) {
+				sum_group_lat_bins(g, inits ? &g.bin_inits : &g.bin_olds);
+			}
+		}
+	}
+}
+
 static void print_stats_summary(double *d, double t) {
 	printf("qos %.3f load %.0f send_rate %.0f reply_rate %.0f avg_lat %.3fms avg_sdelay %.1fus avg_sdura %.1fus hit_ratio %.3f get_ratio %.3f set_ratio %.3f udp_timeout %.0f",
 		d[cwc_good_qos_query] / d[cwc_retired_query] * 100.0,
@@ -113,6 +232,55 @@ static void print_stats_summary(double *d, double t) {
 		d[cwc_udp_timeout]);
 }
 
+static void print_churn_summary(double *d, double t) {
+	printf("connect_rate %.0f avg_connect %.3fms avg_first_lat %.3fms lost %.0f",
+		d[cwc_connect] / t,
+		d[cwc_connect_time_sum] / d[cwc_connect],
+		d[cwc_first_latency_sum] / d[cwc_replied_first_query],
+		d[cwc_lost_query]);
+}
+
+static void print_tls_summary(double *d, double t) {
+	printf("tls_handshakes %.0f avg_handshake %.3fms resumed %.0f tls_send %.1fus tls_recv %.1fus",
+		d[cwc_tls_handshake],
+		d[cwc_tls_handshake_time_sum] / d[cwc_tls_handshake],
+		d[cwc_tls_resumed],
+		d[cwc_tls_send_time_sum] / d[cwc_sent_query],
+		d[cwc_tls_recv_time_sum] / d[cwc_replied_query]);
+}
+
+static void print_wire_summary(double *d) {
+	printf("wire_lat %.3fms stack_lat %.3fms wire_cover %.3f hw_ratio %.3f",
+		d[cwc_wire_latency_sum] / d[cwc_wire_query],
+		d[cwc_stack_latency_sum] / d[cwc_wire_query],
+		d[cwc_wire_query] / d[cwc_replied_query],
+		d[cwc_wire_hw_query] / d[cwc_wire_query]);
+}
+
+static void print_txtime_summary(double *d) {
+	printf("avg_txlag %.1fus txtime_early %.3f txtime_cover %.3f",
+		d[cwc_txtime_lag_sum] / d[cwc_txtime_query],
+		d[cwc_txtime_early] / d[cwc_txtime_query],
+		d[cwc_txtime_query] / d[cwc_replied_query]);
+}
+
+// GETs answered by the near cache never reach the servers, so the application issues
+// send_rate + near hits requests per second.
+static void print_near_cache_summary(double *d, double t) {
+	double app_queries = d[cwc_sent_query] + d[cwc_near_hit];
+	printf("near_offload %.3f near_hit_ratio %.3f near_hit_lat %.2fus near_stale %.3f app_rate %.0f server_rate %.0f",
+		d[cwc_near_hit] / app_queries,
+		d[cwc_near_hit] / d[cwc_near_lookup],
+		d[cwc_near_latency_sum] / d[cwc_near_hit],
+		d[cwc_near_stale] / d[cwc_near_hit],
+		app_queries / t,
+		d[cwc_sent_query] / t);
+}
+
+static void print_rebalance_summary(double *d) {
+	printf("migrations %.0f", d[cwc_migration]);
+}
+
 static void print_qlen_summary() {
 
 	double cq_max = 0.0;
@@ -152,9 +320,193 @@ static void report(double *deltas, double nsec_duration) {
 	print_stats_summary(deltas, duration);
 	printf(" ");
 	print_qlen_summary();
+	if (conf.churn) {
+		printf(" ");
+		print_churn_summary(deltas, duration);
+	}
+	if (conf.tls) {
+		printf(" ");
+		print_tls_summary(deltas, duration);
+	}
+	if (conf.timestamping != tst_off) {
+		printf(" ");
+		print_wire_summary(deltas);
+	}
+	if (conf.txtime_lead > 0.0) {
+		printf(" ");
+		print_txtime_summary(deltas);
+	}
+	if (conf.near_cache_cap > 0) {
+		printf(" ");
+		print_near_cache_summary(deltas, duration);
+	}
+	if (conf.rebalance_lag > 0.0) {
+		printf(" ");
+		print_rebalance_summary(deltas);
+	}
 	printf("\n");
 }
 
+// Latency percentiles are printed if the group keeps latency bins (bin_news is not empty).
+static void report_group_summary(const char *prefix, const report_group &g, double *d, const std::vector<double> &bin_news,
+	const std::vector<double> &bin_bases, double nsec_duration) {
+	double t = nsec_duration / 1.0e9;
+	printf("%s%s: conns %lu qos %.3f send_rate %.0f reply_rate %.0f avg_lat %.3fms hit_ratio %.3f os_sum %.0f",
+		prefix, g.name.c_str(), g.works.size(),
+		d[cwc_good_qos_query] / d[cwc_retired_query] * 100.0,
+		d[cwc_sent_query] / t,
+		d[cwc_replied_query] / t,
+		d[cwc_latency_sum] / d[cwc_replied_query],
+		d[cwc_hit_get_query] / d[cwc_replied_get_query],
+		d[cwc_outstanding_query]);
+	if (!bin_news.empty() && d[cwc_replied_query] > 0.0) {
+		double bins[lat_bin_cnt];
+		for (int b = 0; b < lat_bin_cnt; b++) {
+			bins[b] = bin_news[b] - bin_bases[b];
+		}
+		printf(" p50 %.3fms p99 %.3fms p999 %.3fms",
+			latency_bins_quantile(bins, 0.5),
+			latency_bins_quantile(bins, 0.99),
+			latency_bins_quantile(bins, 0.999));
+	}
+	printf("\n");
+}
+
+static void report_groups(std::vector<report_group> &groups, bool discrete, bool accumulate, double old_tv, double init_tv, double new_tv) {
+	double news[cwc_end], deltas[cwc_end];
+	std::vector<double> bin_news;
+	for (auto &g : groups) {
+		sum_group_counters(g, news);
+		if (conf.lat_bins) {
+			sum_group_lat_bins(g, &bin_news);
+		}
+		if (discrete) {
+			counters_subtract(news, g.olds, deltas);
+			deltas[cwc_outstanding_query] = news[cwc_outstanding_query];
+			report_group_summary("D-", g, deltas, bin_news, g.bin_olds, new_tv - old_tv);
+		}
+		if (accumulate) {
+			counters_subtract(news, g.inits, deltas);
+			deltas[cwc_outstanding_query] = news[cwc_outstanding_query];
+			report_group_summary("A-", g, deltas, bin_news, g.bin_inits, new_tv - init_tv);
+		}
+	}
+}
+
+static void sum_class_counters(double *sums) {
+	for (int i = 0; i < latency_class_counter_cnt; i++) {
+		sums[i] = 0;
+	}
+	for (int i = 0; i < conn_cnt; i++) {
+		const double *cc = conn_works[i]->all_class_counters;
+		for (int j = 0; j < latency_class_counter_cnt; j++) {
+			sums[j] += cc[j];
+		}
+	}
+}
+
+static void size_class_name(int val_class, char *buf) {
+	int size = 1 << val_class;
+	if (size < 1024) {
+		sprintf(buf, "%dB", size);
+	} else if (size < 1024 * 1024) {
+		sprintf(buf, "%dKB", size / 1024);
+	} else {
+		sprintf(buf, "%dMB", size / 1024 / 1024);
+	}
+}
+
+// One line per op and value size class that saw traffic, e.g. "D-get-512B: ...".
+static void report_latency_classes(const char *prefix, const double *news, const double *bases, double nsec_duration) {
+	double t = nsec_duration / 1.0e9;
+	const char *cmd_names[memcmd_cnt] = {"set", "get"};
+	for (int cmd = 0; cmd < memcmd_cnt; cmd++) {
+		for (int cls = 0; cls < val_class_cnt; cls++) {
+			int base = latency_class_index((memcmd_t) cmd, cls, 0);
+			double d[lcc_end];
+			for (int i = 0; i < lcc_end; i++) {
+				d[i] = news[base + i] - bases[base + i];
+			}
+			if (d[lcc_sent] == 0.0 && d[lcc_replied] == 0.0) {
+				continue;
+			}
+			char size_name[16];
+			size_class_name(cls, size_name);
+			printf("%s%s-%s: send_rate %.0f reply_rate %.0f avg_lat %.3fms p50 %.3fms p99 %.3fms p999 %.3fms",
+				prefix, cmd_names[cmd], size_name,
+				d[lcc_sent] / t,
+				d[lcc_replied] / t,
+				d[lcc_latency_sum] / d[lcc_replied],
+				latency_bins_quantile(d + lcc_bins, 0.5),
+				latency_bins_quantile(d + lcc_bins, 0.99),
+				latency_bins_quantile(d + lcc_bins, 0.999));
+			if (cmd == mcm_get) {
+				printf(" hit_ratio %.3f", d[lcc_hit] / d[lcc_replied]);
+			}
+			printf("\n");
+		}
+	}
+}
+
+static void sum_lat_bins(double *sums) {
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		sums[b] = 0;
+	}
+	for (int i = 0; i < conn_cnt; i++) {
+		const double *bins = conn_works[i]->all_lat_bins;
+		for (int b = 0; b < lat_bin_cnt; b++) {
+			sums[b] += bins[b];
+		}
+	}
+}
+
+// Adds an interval to the detector and prints an "S:" line about it, returns true if the
+// interval ends warm-up.
+static bool steady_state_interval(steady_state_detector *steady, const double *news, const double *olds, const double *bin_news, const double *bin_olds, double nsec_duration) {
+	double t = nsec_duration / 1.0e9;
+	double replied = news[cwc_replied_query] - olds[cwc_replied_query];
+	double replied_get = news[cwc_replied_get_query] - olds[cwc_replied_get_query];
+	double hit_ratio = replied_get > 0.0 ? (news[cwc_hit_get_query] - olds[cwc_hit_get_query]) / replied_get : NAN;
+	double avg_latency = replied > 0.0 ? (news[cwc_latency_sum] - olds[cwc_latency_sum]) / replied : 0.0;
+	double bins[lat_bin_cnt];
+	for (int b = 0; b < lat_bin_cnt; b++) {
+		bins[b] = bin_news[b] - bin_olds[b];
+	}
+	double p99 = latency_bins_quantile_interp(bins, 0.99);
+
+	bool warmup_end = steady->add_interval(replied / t, hit_ratio, avg_latency, p99);
+	if (replied == 0.0) {
+		printf("S: no replies, %s\n", steady->steady() ? "interval left out" : "warm-up window starts over");
+	} else if (!steady->steady()) {
+		double spread = steady->spread();
+		if (spread < 0.0) {
+			printf("S: warm-up p99 %.3fms\n", p99);
+		} else {
+			printf("S: warm-up p99 %.3fms spread %.2f\n", p99, spread);
+		}
+	} else if (!warmup_end) {
+		double mean, half_width;
+		steady->p99_estimate(&mean, &half_width);
+		printf("S: steady p99 %.3fms mean_p99 %.3fms", p99, mean);
+		if (steady->batch_cnt() > 1) {
+			printf(" ci95 %.3fms", half_width);
+		}
+		printf(" intervals %d\n", steady->batch_cnt());
+	}
+	return warmup_end;
+}
+
+static void print_steady_state_result(const steady_state_detector &steady) {
+	if (!steady.steady()) {
+		printf("===steady state not reached===\n");
+		return;
+	}
+	double mean, half_width;
+	steady.p99_estimate(&mean, &half_width);
+	printf("===steady state p99 %.3fms +- %.3fms (95%% confidence, %d intervals after %d of warm-up)===\n",
+		mean, half_width, steady.batch_cnt(), steady.warmup_intervals());
+}
+
 static bool preload_done() {
 	for (int i = 0; i < conn_cnt; i++) {
 		conn_work *work = conn_works[i];
@@ -166,6 +518,22 @@ static bool preload_done() {
 	return true;
 }
 
+// Done when every recorded request has been sent, and either retired or given up on (an
+// interval without replies; lost udp requests only time out when new ones are sent).
+static bool replay_done(bool idle) {
+	for (int i = 0; i < conn_cnt; i++) {
+		conn_work *work = conn_works[i];
+		double recorded = work->replay->records.size();
+		if (work->all_counters[cwc_sent_query] < recorded) {
+			return false;
+		}
+		if (work->all_counters[cwc_retired_query] < recorded && !idle) {
+			return false;
+		}
+	}
+	return true;
+}
+
 static bool per_connection_work_done() {
 	for (int i = 0; i < conn_cnt; i++) {
 		conn_work *work = conn_works[i];
@@ -177,26 +545,126 @@ static bool per_connection_work_done() {
 	return true;
 }
 
-static void do_work_round(const work_round &rd) {
+// Queues the --stream records of a D: (since the olds) or A: (since the inits) report, for all
+// connections and then every group.
+static void stream_interval(int rid, int iter, char kind, const double *news, const double *bases,
+	const std::vector<double> &bin_news, const std::vector<double> &bin_bases, double base_tv, double new_tv) {
+	std::vector<const report_group*> scope_groups;
+	for (const auto &g : groups) {
+		scope_groups.push_back(&g);
+	}
+	for (const auto &g : server_groups) {
+		scope_groups.push_back(&g);
+	}
+	int scope_cnt = 1 + scope_groups.size();
+	std::vector<double> counters(scope_cnt * cwc_end);
+	std::vector<double> bins(scope_cnt * lat_bin_cnt);
+	std::vector<stream_scope> scopes(scope_cnt);
+	double g_news[cwc_end];
+	std::vector<double> g_bin_news;
+	for (int s = 0; s < scope_cnt; s++) {
+		const double *s_news = news, *s_bases = bases;
+		const double *s_bin_news = bin_news.data(), *s_bin_bases = bin_bases.data();
+		stream_scope &sc = scopes[s];
+		sc.name = "all";
+		sc.conn_cnt = conn_cnt;
+		if (s > 0) {
+			const report_group &g = *scope_groups[s - 1];
+			sum_group_counters(g, g_news);
+			sum_group_lat_bins(g, &g_bin_news);
+			s_news = g_news;
+			s_bases = kind == 'D' ? g.olds : g.inits;
+			s_bin_news = g_bin_news.data();
+			s_bin_bases = kind == 'D' ? g.bin_olds.data() : g.bin_inits.data();
+			sc.name = g.name.c_str();
+			sc.conn_cnt = g.works.size();
+		}
+		double *c = &counters[s * cwc_end];
+		double *b = &bins[s * lat_bin_cnt];
+		for (int i = 0; i < cwc_end; i++) {
+			c[i] = s_news[i] - s_bases[i];
+		}
+		c[cwc_outstanding_query] = s_news[cwc_outstanding_query];
+		for (int i = 0; i < lat_bin_cnt; i++) {
+			b[i] = s_bin_news[i] - s_bin_bases[i];
+		}
+		sc.counters = c;
+		sc.lat_bins = b;
+	}
+	stream_report(rid, iter, kind, (new_tv - work_start_tv) / 1.0e9, (new_tv - base_tv) / 1.0e9, scopes);
+}
+
+static void do_work_round(int rid, const work_round &rd) {
 	double inits[cwc_end], olds[cwc_end], news[cwc_end], deltas[cwc_end];
 	double init_tv, old_tv, new_tv;
+	std::vector<double> class_inits, class_olds, class_news;
+	profile_snapshot prof_init, prof_old, prof_new;
+	if (conf.size_classes) {
+		class_inits.resize(latency_class_counter_cnt);
+		class_olds.resize(latency_class_counter_cnt);
+		class_news.resize(latency_class_counter_cnt);
+	}
+	steady_state_detector steady(conf.steady_window, conf.steady_tolerance, conf.steady_p99_ci);
+	std::vector<double> bin_inits, bin_olds, bin_news;
+	if (conf.lat_bins) {
+		bin_inits.resize(lat_bin_cnt);
+		bin_olds.resize(lat_bin_cnt);
+		bin_news.resize(lat_bin_cnt);
+	}
+
+	// every round has its own warm-up, histograms pause until it is over
+	control.warmed_up = conf.steady_window == 0;
 
 	update_counters();
 	sum_counters(inits);
+	snapshot_groups(true);
+	if (conf.lat_bins) {
+		sum_lat_bins(bin_inits.data());
+	}
+	if (conf.size_classes) {
+		sum_class_counters(class_inits.data());
+	}
+	if (conf.profile) {
+		prof_snapshot(&prof_init);
+	}
 	init_tv = clock_mono_nsec();
+	if (conf.server_stats) {
+		server_stats_tick(false, (init_tv - work_start_tv) / 1.0e9, rd.interval / 2.0);
+	}
 
 	for (int i = 0; i < rd.iter_cnt || rd.iter_cnt == 0; i++) {
 
 		update_counters();
 		sum_counters(olds);
+		snapshot_groups(false);
+		if (conf.size_classes) {
+			sum_class_counters(class_olds.data());
+		}
+		if (conf.lat_bins) {
+			sum_lat_bins(bin_olds.data());
+		}
+		if (conf.profile) {
+			prof_snapshot(&prof_old);
+		}
 		old_tv = clock_mono_nsec();
 
 		sleep(rd.interval);
 
 		update_counters();
 		sum_counters(news);
+		if (conf.lat_bins) {
+			sum_lat_bins(bin_news.data());
+		}
+		if (conf.profile) {
+			prof_snapshot(&prof_new);
+		}
 		new_tv = clock_mono_nsec();
 
+		// the report comes out in one piece, the "SS:" lines of its interval follow it
+		flockfile(stdout);
+		if (conf.server_stats) {
+			server_stats_tick(true, (new_tv - work_start_tv) / 1.0e9, rd.interval / 2.0);
+		}
 		if (rd.discrete) {
 			counters_subtract(news, olds, deltas);
 			printf("D: ");
@@ -207,31 +675,118 @@ static void do_work_round(const work_round &rd) {
 			printf("A: ");
 			report(deltas, new_tv - init_tv);
 		}
+		report_groups(groups, rd.discrete, rd.accumulate, old_tv, init_tv, new_tv);
+		if (conf.per_server) {
+			report_groups(server_groups, rd.discrete, rd.accumulate, old_tv, init_tv, new_tv);
+		}
+		if (conf.stream_file != NULL) {
+			if (rd.discrete) {
+				stream_interval(rid, i, 'D', news, olds, bin_news, bin_olds, old_tv, new_tv);
+			}
+			if (rd.accumulate) {
+				stream_interval(rid, i, 'A', news, inits, bin_news, bin_inits, init_tv, new_tv);
+			}
+		}
+		if (conf.size_classes) {
+			sum_class_counters(class_news.data());
+			if (rd.discrete) {
+				report_latency_classes("D-", class_news.data(), class_olds.data(), new_tv - old_tv);
+			}
+			if (rd.accumulate) {
+				report_latency_classes("A-", class_news.data(), class_inits.data(), new_tv - init_tv);
+			}
+		}
+		if (conf.profile) {
+			// the breakdown covers the last interval, or the whole round so far if intervals are not reported
+			const profile_snapshot &prof_base = rd.discrete ? prof_old : prof_init;
+			double *bases = rd.discrete ? olds : inits;
+			double replied = news[cwc_replied_query] - bases[cwc_replied_query];
+			double avg_latency = (news[cwc_latency_sum] - bases[cwc_latency_sum]) / replied;
+			prof_report(prof_base, prof_new, new_tv - (rd.discrete ? old_tv : init_tv), replied, avg_latency);
+		}
+		if (conf.steady_window > 0) {
+			if (steady_state_interval(&steady, news, olds, bin_news.data(), bin_olds.data(), new_tv - old_tv)) {
+				// warm-up is over, accumulated results (and histograms) start again from here
+				printf("===steady state reached after %d intervals, warm-up excluded===\n", steady.warmup_intervals());
+				memcpy(inits, news, sizeof(inits));
+				snapshot_groups(true);
+				bin_inits = bin_news;
+				if (conf.size_classes) {
+					class_inits = class_news;
+				}
+				if (conf.profile) {
+					prof_init = prof_new;
+				}
+				init_tv = new_tv;
+				control.warmed_up = true;
+			} else if (steady.confident()) {
+				print_steady_state_result(steady);
+				printf("===steady state measured, break round===\n");
+				fflush(stdout);
+				funlockfile(stdout);
+				return;
+			}
+		}
 		fflush(stdout);
+		funlockfile(stdout);
 
 		if (conf.preload && preload_done()) {
 			printf("===preload finished, break round===\n");
 			return;
 		}
 
+		if (conf.replay_file != NULL && replay_done(news[cwc_replied_query] == olds[cwc_replied_query])) {
+			printf("===replay finished, break round===\n");
+			return;
+		}
+
 		if (conf.per_connection_work > 0 && per_connection_work_done()) {
 			printf("===per_connection_work finished, break round===\n");
 			return;
 		}
 	}
+
+	if (conf.steady_window > 0) {
+		print_steady_state_result(steady);
+	}
 }
 
 static void do_work() {
 	printf("===work started===\n");
+	work_start_tv = clock_mono_nsec();
 	for (int rid = 0; rid < (int) conf.work_rounds.size(); rid++) {
 		work_round &rd = conf.work_rounds[rid];
 		printf("===round %d started[iteratrions=%d, interval=%d]===\n", rid, rd.iter_cnt, rd.interval);
-		do_work_round(rd);
+		do_work_round(rid, rd);
 		printf("===round %d finished===\n", rid);
 	}
 	printf("===work finished===\n");
 }
 
+static void dump_histograms() {
+	histogram_file_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, histogram_file_magic, sizeof(h.magic));
+	h.conn_cnt = conn_cnt;
+	h.slot_cnt = HISTOGRAM_SIZE + 1;
+	h.head = conf.histogram_head;
+	h.body = conf.histogram_body;
+	conn_works[0]->histogram_scales(h.scale);
+
+	// one dense section at a time, connections are kept packed
+	histogram_section all("all", h.slot_cnt);
+	histogram_section section("", h.slot_cnt);
+	std::vector<packed_histogram_section> sections;
+	sections.reserve(conn_cnt);
+	for (int i = 0; i < conn_cnt; i++) {
+		conn_works[i]->export_histogram(&section);
+		all.add(section);
+		sections.push_back(packed_histogram_section(section));
+	}
+	histogram_write(conf.histogram_file, h, all, sections, server_stats_log());
+	printf("histograms written to %s\n", conf.histogram_file);
+}
+
 static int parse_server_spec(int argc, char **argv) {
 
 	server_record sr;
@@ -294,6 +849,102 @@ static int parse_round_spec(int argc, char **argv) {
 	return i;
 }
 
+static int parse_tenant_spec(int argc, char **argv) {
+	if (argc < 7) {
+		fprintf(stderr, "parse_tenant_spec: --tenant needs <name> <sample file> <database size> <vclients> <load> <qos> <set ratio>\n");
+		exit(1);
+	}
+	tenant_workload t;
+	t.name = argv[0];
+	t.db_sample_file = strcmp(argv[1], "gen") == 0 ? NULL : argv[1];
+	t.db_size = atof(argv[2]);
+	t.vclients = atof(argv[3]);
+	t.load = atof(argv[4]);
+	t.qos = atof(argv[5]);
+	t.set_ratio = atof(argv[6]);
+	conf.tenants.push_back(t);
+	return 7;
+}
+
+static int parse_size_dist_spec(int argc, char **argv, const char *opt, const size_dist &etc, size_dist *d) {
+	if (argc < 1) {
+		fprintf(stderr, "parse_size_dist_spec: %s needs fixed <size> | gev <mu> <sigma> <xi> | gpareto <mu> <sigma> <xi> | lognormal <mu> <sigma> | etc\n", opt);
+		exit(1);
+	}
+	int param_cnt;
+	if (strcmp(argv[0], "etc") == 0) {
+		*d = etc;
+		return 1;
+	} else if (strcmp(argv[0], "fixed") == 0) {
+		d->law = szl_fixed;
+		param_cnt = 1;
+	} else if (strcmp(argv[0], "gev") == 0) {
+		d->law = szl_gev;
+		param_cnt = 3;
+	} else if (strcmp(argv[0], "gpareto") == 0) {
+		d->law = szl_gpareto;
+		param_cnt = 3;
+	} else if (strcmp(argv[0], "lognormal") == 0) {
+		d->law = szl_lognormal;
+		param_cnt = 2;
+	} else {
+		fprintf(stderr, "parse_size_dist_spec: unknown size law for %s: %s\n", opt, argv[0]);
+		exit(1);
+	}
+	if (argc < 1 + param_cnt) {
+		fprintf(stderr, "parse_size_dist_spec: %s %s needs %d parameters\n", opt, argv[0], param_cnt);
+		exit(1);
+	}
+	d->loc = atof(argv[1]);
+	d->scale = param_cnt > 1 ? atof(argv[2]) : 0.0;
+	d->shape = param_cnt > 2 ? atof(argv[3]) : 0.0;
+	if (d->law != szl_fixed && d->scale <= 0.0) {
+		fprintf(stderr, "parse_size_dist_spec: %s needs a positive sigma\n", opt);
+		exit(1);
+	}
+	return 1 + param_cnt;
+}
+
+static int parse_popularity_spec(int argc, char **argv) {
+	if (argc >= 1 && strcmp(argv[0], "uniform") == 0) {
+		conf.gen_popularity.law = ppl_uniform;
+		return 1;
+	}
+	if (argc >= 2 && strcmp(argv[0], "zipf") == 0) {
+		conf.gen_popularity.law = ppl_zipf;
+		conf.gen_popularity.exponent = atof(argv[1]);
+		if (conf.gen_popularity.exponent < 0.0) {
+			fprintf(stderr, "parse_popularity_spec: zipf exponent < 0: %s\n", argv[1]);
+			exit(1);
+		}
+		return 2;
+	}
+	fprintf(stderr, "parse_popularity_spec: --popularity needs uniform | zipf <exponent>\n");
+	exit(1);
+}
+
+static int parse_near_cache_spec(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "parse_near_cache_spec: --near-cache needs <entries per vclient> <lru|tinylfu> <ttl seconds|inval>\n");
+		exit(1);
+	}
+	conf.near_cache_cap = atof(argv[0]);
+	if (strcmp(argv[1], "lru") == 0) {
+		conf.near_cache_policy = ncp_lru;
+	} else if (strcmp(argv[1], "tinylfu") == 0) {
+		conf.near_cache_policy = ncp_tinylfu;
+	} else {
+		fprintf(stderr, "parse_near_cache_spec: unknown policy: %s\n", argv[1]);
+		exit(1);
+	}
+	conf.near_cache_ttl = strcmp(argv[2], "inval") == 0 ? 0.0 : atof(argv[2]);
+	if (conf.near_cache_cap <= 0 || conf.near_cache_ttl < 0.0 || (conf.near_cache_ttl == 0.0 && strcmp(argv[2], "inval") != 0)) {
+		fprintf(stderr, "parse_near_cache_spec: bad near cache: %s %s %s\n", argv[0], argv[1], argv[2]);
+		exit(1);
+	}
+	return 3;
+}
+
 static int parse_send_traffic_shape(int argc, char **argv) {
 	int i = 0;
 	if (strcmp(argv[i], "uniform") == 0) {
@@ -334,6 +985,17 @@ static void parse_arguments(int argc, char **argv) {
 		if (strcmp(key, "--db") == 0) {
 			conf.db_sample_file = argv[i++];
 			conf.db_size = atof(argv[i++]);
+		} else if (strcmp(key, "--key-size") == 0) {
+			i += parse_size_dist_spec(argc - i, argv + i, key, size_dist::etc_key_size(), &conf.gen_key_size);
+			conf.generate = true;
+		} else if (strcmp(key, "--value-size") == 0) {
+			i += parse_size_dist_spec(argc - i, argv + i, key, size_dist::etc_value_size(), &conf.gen_val_size);
+			conf.generate = true;
+		} else if (strcmp(key, "--popularity") == 0) {
+			i += parse_popularity_spec(argc - i, argv + i);
+			conf.generate = true;
+		} else if (strcmp(key, "--key-template") == 0) {
+			conf.key_template = argv[i++];
 		} else if (strcmp(key, "--server") == 0) {
 			i += parse_server_spec(argc - i, argv + i);
 		} else if (strcmp(key, "--mirror") == 0) {
@@ -356,43 +1018,170 @@ static void parse_arguments(int argc, char **argv) {
 			i += parse_command_spec(argc - i, argv + i);
 		} else if (strcmp(key, "--preload") == 0) {
 			conf.preload = true;
+		} else if (strcmp(key, "--bulk-preload") == 0) {
+			conf.bulk_preload_conns = atof(argv[i++]);
+			conf.bulk_verify_cnt = atof(argv[i++]);
 		} else if (strcmp(key, "--base-port") == 0) {
 			conf.base_port = atof(argv[i++]);
 		} else if (strcmp(key, "--set-ratio") == 0) {
 			conf.set_ratio = atof(argv[i++]);
+		} else if (strcmp(key, "--tenant") == 0) {
+			i += parse_tenant_spec(argc - i, argv + i);
 		} else if (strcmp(key, "--per-connection-work") == 0) {
 			conf.per_connection_work = atof(argv[i++]);
 		} else if (strcmp(key, "--histogram") == 0) {
 			conf.histogram_head = atof(argv[i++]);
 			conf.histogram_body = atof(argv[i++]);
+		} else if (strcmp(key, "--histogram-file") == 0) {
+			conf.histogram_file = argv[i++];
+		} else if (strcmp(key, "--steady-state") == 0) {
+			conf.steady_window = atof(argv[i++]);
+			conf.steady_tolerance = atof(argv[i++]);
+			conf.steady_p99_ci = atof(argv[i++]);
+		} else if (strcmp(key, "--stream") == 0) {
+			conf.stream_file = argv[i++];
+			const char *format = argv[i++];
+			if (strcmp(format, "json") == 0) {
+				conf.stream_format = sfm_json;
+			} else if (strcmp(format, "csv") == 0) {
+				conf.stream_format = sfm_csv;
+			} else {
+				fprintf(stderr, "parse_arguments: unknown stream format: %s\n", format);
+				exit(1);
+			}
 		} else if (strcmp(key, "--send-traffic-shape") == 0) {
 			i += parse_send_traffic_shape(argc - i, argv + i);
 		} else if (strcmp(key, "--busy-loop-receive") == 0) {
 			conf.busy_loop_receive = true;
 		} else if (strcmp(key, "--receive-burst") == 0) {
 			conf.receive_burst = atof(argv[i++]);
+		} else if (strcmp(key, "--epoll-receive") == 0) {
+			conf.epoll_receive = true;
+		} else if (strcmp(key, "--busy-poll") == 0) {
+			conf.busy_poll = atof(argv[i++]);
+		} else if (strcmp(key, "--prefer-busy-poll") == 0) {
+			conf.prefer_busy_poll = true;
+			conf.busy_poll_budget = atof(argv[i++]);
 		} else if (strcmp(key, "--connect-speed") == 0) {
 			conf.connect_speed = atof(argv[i++]);
 		} else if (strcmp(key, "--connection-init-load") == 0) {
 			conf.connection_init_load = atof(argv[i++]);
 		} else if (strcmp(key, "--connection-ramp-up-speed") == 0) {
 			conf.connection_ramp_up_speed = atof(argv[i++]);
+		} else if (strcmp(key, "--churn") == 0) {
+			conf.churn = true;
+			conf.churn_requests = atof(argv[i++]);
+			conf.churn_time = atof(argv[i++]);
+		} else if (strcmp(key, "--churn-connect-rate") == 0) {
+			conf.churn_connect_rate = atof(argv[i++]);
+		} else if (strcmp(key, "--tls") == 0) {
+			conf.tls = true;
+		} else if (strcmp(key, "--tls-ciphers") == 0) {
+			conf.tls = true;
+			conf.tls_ciphers = argv[i++];
+		} else if (strcmp(key, "--tls-ciphersuites") == 0) {
+			conf.tls = true;
+			conf.tls_ciphersuites = argv[i++];
+		} else if (strcmp(key, "--tls-no-resume") == 0) {
+			conf.tls_resume = false;
+		} else if (strcmp(key, "--ktls") == 0) {
+			conf.tls = true;
+			conf.tls_ktls = true;
+		} else if (strcmp(key, "--seed") == 0) {
+			conf.seed = strtoull(argv[i++], NULL, 0);
+			conf.random_seed = false;
+		} else if (strcmp(key, "--record") == 0) {
+			conf.record_file = argv[i++];
+		} else if (strcmp(key, "--replay") == 0) {
+			conf.replay_file = argv[i++];
+			conf.replay_speed = atof(argv[i++]);
+		} else if (strcmp(key, "--profile") == 0) {
+			conf.profile = true;
+		} else if (strcmp(key, "--profile-warn") == 0) {
+			conf.profile = true;
+			conf.profile_warn = atof(argv[i++]);
+		} else if (strcmp(key, "--size-classes") == 0) {
+			conf.size_classes = true;
+		} else if (strcmp(key, "--per-server") == 0) {
+			conf.per_server = true;
+		} else if (strcmp(key, "--near-cache") == 0) {
+			i += parse_near_cache_spec(argc - i, argv + i);
+		} else if (strcmp(key, "--timestamping") == 0) {
+			const char *source = argv[i++];
+			if (strcmp(source, "sw") == 0) {
+				conf.timestamping = tst_software;
+			} else if (strcmp(source, "hw") == 0) {
+				conf.timestamping = tst_hardware;
+			} else {
+				fprintf(stderr, "parse_arguments: unknown timestamp source: %s\n", source);
+				exit(1);
+			}
+		} else if (strcmp(key, "--txtime") == 0) {
+			conf.txtime_lead = atof(argv[i++]);
+			const char *qdisc = argv[i++];
+			if (strcmp(qdisc, "fq") == 0) {
+				conf.txtime_clock = CLOCK_MONOTONIC;
+			} else if (strcmp(qdisc, "etf") == 0) {
+				conf.txtime_clock = CLOCK_TAI;
+			} else {
+				fprintf(stderr, "parse_arguments: unknown txtime qdisc: %s\n", qdisc);
+				exit(1);
+			}
 		} else if (strcmp(key, "--mtu") == 0) {
 			conf.mtu = atof(argv[i++]);
+		} else if (strcmp(key, "--recv-buf-max") == 0) {
+			conf.recv_buf_max = atof(argv[i++]);
+		} else if (strcmp(key, "--validate-values") == 0) {
+			conf.validate_values = true;
+		} else if (strcmp(key, "--rebalance") == 0) {
+			conf.rebalance_lag = atof(argv[i++]);
+		} else if (strcmp(key, "--server-stats") == 0) {
+			conf.server_stats = true;
+		} else if (strcmp(key, "--numa") == 0) {
+			conf.numa = true;
+		} else if (strcmp(key, "--numa-nic") == 0) {
+			conf.numa = true;
+			conf.numa_nic = argv[i++];
 		} else {
 			fprintf(stderr, "parse_arguments: unknown key: %s\n", key);
 			exit(1);
 		}
 	}
 
+	if (conf.tenants.empty()) {
+		tenant_workload t;
+		t.name = NULL;
+		t.db_sample_file = conf.generate || strcmp(conf.db_sample_file, "gen") == 0 ? NULL : conf.db_sample_file;
+		t.db_size = conf.db_size;
+		t.vclients = conf.vclients;
+		t.load = conf.load;
+		t.qos = conf.qos;
+		t.set_ratio = conf.set_ratio;
+		conf.tenants.push_back(t);
+	} else {
+		conf.load = 0.0;
+		bool generated = false;
+		for (auto &t : conf.tenants) {
+			conf.load += t.load;
+			generated = generated || t.db_sample_file == NULL;
+		}
+		if (conf.generate && !generated) {
+			fprintf(stderr, "--key-size, --value-size and --popularity only apply to tenants with the sample file gen\n");
+			exit(1);
+		}
+	}
+
 	if (conf.preload) {
 		conf.udp = false;
 		conf.default_cmd = mcm_set;
 		conf.enumerate_items = true;
-		if (conf.mirror) {
-			conf.vclients = conf.servers.size();
-		} else { // shard
-			conf.vclients = 1;
+		for (auto &t : conf.tenants) {
+			if (conf.mirror) {
+				t.vclients = conf.servers.size();
+			} else { // shard
+				t.vclients = 1;
+			}
+			t.set_ratio = 0.0;
 		}
 		conf.work_rounds.clear();
 		conf.per_connection_work = 0;
@@ -417,16 +1206,97 @@ static void parse_arguments(int argc, char **argv) {
 		conf.work_rounds.push_back(rd);
 	}
 
-	if (conf.mirror) {
-		if (conf.vclients % conf.servers.size() != 0) {
-			fprintf(stderr, "can't divide clients evenly to mirror-servers\n");
+	if (conf.churn) {
+		if (conf.udp) {
+			fprintf(stderr, "connection churn is only supported with tcp\n");
 			exit(1);
 		}
-	} else {
-		if (conf.db_size % conf.servers.size() != 0) {
-			fprintf(stderr, "can't divide db evenly to shard-servers\n");
+		if (conf.base_port != 0) {
+			fprintf(stderr, "connection churn can't reuse fixed client ports (--base-port)\n");
 			exit(1);
 		}
+		if (conf.churn_requests <= 0 && conf.churn_time <= 0.0) {
+			conf.churn = false;
+		}
+	}
+
+	if (conf.tls && conf.udp) {
+		fprintf(stderr, "tls is only supported with tcp\n");
+		exit(1);
+	}
+
+	if (conf.server_stats && conf.tls) {
+		fprintf(stderr, "--server-stats can't be combined with --tls\n");
+		exit(1);
+	}
+
+	if (conf.bulk_preload_conns > 0 && (conf.preload || conf.tls || conf.record_file != NULL || conf.replay_file != NULL)) {
+		fprintf(stderr, "--bulk-preload can't be combined with --preload, --tls, --record or --replay\n");
+		exit(1);
+	}
+
+	if (conf.rebalance_lag > 0.0 && conf.replay_file != NULL) {
+		// send threads stop once their connections are replayed, see send_balancer.h
+		fprintf(stderr, "--rebalance can't be combined with --replay\n");
+		exit(1);
+	}
+
+	if (conf.replay_file != NULL && conf.preload) {
+		fprintf(stderr, "can't replay a request log while preloading\n");
+		exit(1);
+	}
+
+	if (conf.tls && conf.timestamping != tst_off) {
+		// TX timestamps are keyed by the bytes on the wire, which tls changes
+		fprintf(stderr, "kernel timestamping can't be used with tls\n");
+		exit(1);
+	}
+
+	if (conf.steady_window > 0 && conf.preload) {
+		fprintf(stderr, "steady state detection can't be used while preloading\n");
+		exit(1);
+	}
+	if (conf.steady_window > 0 && conf.steady_tolerance <= 0.0) {
+		fprintf(stderr, "steady state tolerance must be positive\n");
+		exit(1);
+	}
+	conf.lat_bins = conf.steady_window > 0 || conf.stream_file != NULL || conf.per_server;
+
+	if (conf.txtime_lead > 0.0) {
+		if (!conf.udp) {
+			fprintf(stderr, "--txtime is only supported with udp\n");
+			exit(1);
+		}
+		if (conf.timestamping == tst_off) {
+			// TX timestamps tell when datagrams actually left
+			conf.timestamping = tst_software;
+		}
+	}
+
+	if (conf.recv_buf_max < conf.mtu * 2) {
+		conf.recv_buf_max = conf.mtu * 2;
+	}
+
+	int stdin_samples = 0;
+	for (const auto &t : conf.tenants) {
+		if (conf.mirror) {
+			if (t.vclients % conf.servers.size() != 0) {
+				fprintf(stderr, "can't divide clients evenly to mirror-servers\n");
+				exit(1);
+			}
+		} else {
+			if (t.db_size % conf.servers.size() != 0) {
+				fprintf(stderr, "can't divide db evenly to shard-servers\n");
+				exit(1);
+			}
+		}
+		if (t.db_sample_file != NULL && strcmp(t.db_sample_file, "-") == 0) {
+			stdin_samples++;
+		}
+	}
+	if (stdin_samples > 1) {
+		fprintf(stderr, "only one tenant can read its sample from standard input\n");
+		exit(1);
 	}
 }
 
@@ -444,55 +1314,199 @@ int main(int argc, char **argv) {
 
 	parse_arguments(argc - 1, argv + 1);
 
-	if (conf.mirror) {
-		conn_cnt = conf.vclients;
-	} else { // shard
-		conn_cnt = conf.vclients * conf.servers.size();
+	conn_cnt = 0;
+	for (const auto &t : conf.tenants) {
+		if (conf.mirror) {
+			conn_cnt += t.vclients;
+		} else { // shard
+			conn_cnt += t.vclients * conf.servers.size();
+		}
 	}
 
 	printf("number of connections: %d\n", conn_cnt);
 
-	memdb_sample *sample = new memdb_sample(conf.db_sample_file);
-	if (conf.mirror) {
-		memdb *db = new memdb(sample, conf.db_size, 0);
-		for (int i = 0; i < (int) conf.servers.size(); i++) {
-			conf.servers[i].db = db;
+	if (conf.random_seed) {
+		conf.seed = (uint64_t) time(NULL) * 1000003 + getpid();
+	}
+	printf("seed: %llu\n", (unsigned long long) conf.seed);
+	if (conf.record_file != NULL) {
+		record_open(conf.record_file, conf.seed, conn_cnt);
+	}
+	if (conf.stream_file != NULL) {
+		stream_open(conf.stream_file, conf.stream_format, argc - 1, argv + 1, conn_cnt);
+	}
+	if (conf.replay_file != NULL) {
+		replay_load(conf.replay_file, conn_cnt, &replay_streams);
+	}
+
+	if (conf.tls) {
+		tls_init();
+	}
+
+	// Tenants take consecutive ranges of key seeds, so their keys never collide.
+	key_template *kt = new key_template(conf.key_template);
+	response_key_template = kt;
+	int first_key_seed = 0;
+	long key_arena_size = 0;
+	for (auto &t : conf.tenants) {
+		const char *ns = t.name != NULL ? t.name : "default";
+		if (!key_template::valid_key_text(ns)) {
+			fprintf(stderr, "tenant name \"%s\" can't be part of a key\n", ns);
+			exit(1);
 		}
-	} else { // shard
-		int shard_size = conf.db_size / conf.servers.size();
-		for (int i = 0; i < (int) conf.servers.size(); i++) {
-			conf.servers[i].db = new memdb(sample, shard_size, shard_size * i);
+		memdb_sample *sample;
+		if (t.db_sample_file != NULL) {
+			sample = new memdb_sample(t.db_sample_file);
+		} else {
+			// one entry per key of the database of a server, so any size divides
+			int entry_cnt = conf.mirror ? t.db_size : t.db_size / conf.servers.size();
+			sample = new memdb_sample(conf.gen_key_size, conf.gen_val_size, conf.gen_popularity, entry_cnt, kt->min_key_size(ns));
 		}
+		if (conf.mirror) {
+			memdb *db = new memdb(sample, t.db_size, first_key_seed, kt, ns);
+			t.dbs.assign(conf.servers.size(), db);
+			key_arena_size += db->key_arena_size();
+		} else { // shard
+			int shard_size = t.db_size / conf.servers.size();
+			for (int i = 0; i < (int) conf.servers.size(); i++) {
+				t.dbs.push_back(new memdb(sample, shard_size, first_key_seed + shard_size * i, kt, ns));
+				key_arena_size += t.dbs.back()->key_arena_size();
+			}
+		}
+		first_key_seed += t.db_size;
+	}
+	if (conf.near_cache_cap > 0) {
+		near_cache_init(first_key_seed);
 	}
+	request example;
+	conf.tenants[0].dbs[0]->fill_request(&example, 0);
+	printf("key arena: %.1fMB, first key: %.*s\n", key_arena_size / 1.0e6, example.key_size, example.key);
 
-	conn_works = new conn_work*[conn_cnt];
-	double avg_load = conf.load / (double) conn_cnt;
-	if (conf.preload) {
-		conf.connection_init_load = avg_load;
+	if (conf.bulk_preload_conns > 0) {
+		return bulk_preload(conf.bulk_preload_conns, conf.bulk_verify_cnt) > 0 ? 1 : 0;
 	}
-	assert(avg_load >= conf.connection_init_load);
-	for (int cid = 0; cid < conn_cnt; cid++) {
-		int sid = cid % conf.servers.size();
-		server_record *sr = &conf.servers[sid];
-		conn_work *work = new conn_work(cid, sr->db, pick_saddr(sr), conf.connection_init_load, avg_load, conf.connection_ramp_up_speed);
-		conn_works[cid] = work;
+
+	int preferred_node = -1;
+	if (conf.numa_nic != NULL) {
+		preferred_node = nic_to_numa_node(conf.numa_nic);
+		if (preferred_node < 0) {
+			fprintf(stderr, "numa node of %s is unknown, no node is preferred\n", conf.numa_nic);
+		}
 	}
+	init_thread_hosts(conf.numa, preferred_node);
 
 	int thread_host_cnt = get_num_of_thread_hosts();
 
 	assert(thread_host_cnt % 2 == 0);
 	int work_list_cnt = std::min(conn_cnt, thread_host_cnt / 2);
+
+	if (conf.numa) {
+		printf("numa nodes: %d, preferred node: %d\n", get_num_of_numa_nodes(), preferred_node);
+		groups.resize(get_num_of_numa_nodes());
+		for (int node = 0; node < (int) groups.size(); node++) {
+			groups[node].name = "node" + std::to_string(node);
+		}
+	}
+
+	// Per-connection state is placed on the numa node of the worker threads that use it.
+	// Connections are numbered tenant by tenant.
+	conn_works = new conn_work*[conn_cnt];
+	std::vector<report_group> tenant_groups;
+	// Every server's group is followed by the groups of its addresses, if it has several.
+	std::vector<int> server_group_ids;
+	std::vector<server_addr> group_addrs; // of server_groups, hostname NULL for a server's own group
+	if (conf.per_server || conf.stream_file != NULL) {
+		for (int sid = 0; sid < (int) conf.servers.size(); sid++) {
+			std::string name = "server" + std::to_string(sid);
+			server_group_ids.push_back(server_groups.size());
+			server_groups.push_back(report_group());
+			server_groups.back().name = name;
+			group_addrs.push_back(server_addr{NULL, NULL});
+			const std::list<server_addr> &addrs = conf.servers[sid].addrs;
+			if (addrs.size() > 1) {
+				for (const auto &a : addrs) {
+					server_groups.push_back(report_group());
+					server_groups.back().name = name + "/" + a.hostname + ":" + a.port;
+					group_addrs.push_back(a);
+				}
+			}
+		}
+	}
+	int cid = 0;
+	for (const auto &t : conf.tenants) {
+		int tenant_conn_cnt = conf.mirror ? t.vclients : t.vclients * conf.servers.size();
+		double avg_load = t.load / (double) tenant_conn_cnt;
+		double init_load = conf.connection_init_load;
+		if (conf.preload || conf.replay_file != NULL) {
+			// no ramp up, replayed requests are paced by the log
+			init_load = avg_load;
+		}
+		if (avg_load < init_load) {
+			fprintf(stderr, "%s%sload per connection (%.1f) is below --connection-init-load (%.1f)\n",
+				t.name != NULL ? t.name : "", t.name != NULL ? ": " : "", avg_load, init_load);
+			exit(1);
+		}
+		report_group tg;
+		for (int i = 0; i < tenant_conn_cnt; i++, cid++) {
+			int sid = i % conf.servers.size();
+			server_record *sr = &conf.servers[sid];
+			int node = conf.numa ? thread_host_to_numa_node((cid % work_list_cnt) * 2) : -1;
+			void *mem = numa_alloc_on_node(sizeof(conn_work), node);
+			server_addr saddr = pick_saddr(sr);
+			conn_work *work = new (mem) conn_work(cid, t.dbs[sid], &t, saddr, init_load, avg_load, conf.connection_ramp_up_speed);
+			work->numa_node = node;
+			if (conf.replay_file != NULL) {
+				work->replay = &replay_streams[cid];
+			}
+			conn_works[cid] = work;
+			if (conf.numa) {
+				groups[node].works.push_back(work);
+			}
+			tg.works.push_back(work);
+			if (!server_group_ids.empty()) {
+				int gid = server_group_ids[sid];
+				server_groups[gid].works.push_back(work);
+				for (gid++; gid < (int) group_addrs.size() && group_addrs[gid].hostname != NULL; gid++) {
+					if (group_addrs[gid].hostname == saddr.hostname && group_addrs[gid].port == saddr.port) {
+						server_groups[gid].works.push_back(work);
+					}
+				}
+			}
+		}
+		if (t.name != NULL) {
+			tg.name = t.name;
+			tenant_groups.push_back(tg);
+		}
+	}
+
+	if (conf.numa) {
+		// drop nodes without workers
+		groups.erase(std::remove_if(groups.begin(), groups.end(), [](const report_group &g) {
+			return g.works.empty();
+		}), groups.end());
+	}
+	groups.insert(groups.end(), tenant_groups.begin(), tenant_groups.end());
+
 	std::list<conn_work*> *work_lists = new std::list<conn_work*>[work_list_cnt];
 	for (int cid = 0; cid < conn_cnt; cid++) {
 		int lid = cid % work_list_cnt;
 		work_lists[lid].push_back(conn_works[cid]);
 	}
 	double worker_connect_speed = conf.connect_speed / work_list_cnt;
+	double worker_churn_connect_rate = conf.churn_connect_rate / work_list_cnt;
+	send_balancer *balancer = NULL;
+	if (conf.rebalance_lag > 0.0) {
+		std::vector<int> thread_nodes(work_list_cnt, -1);
+		for (int lid = 0; conf.numa && lid < work_list_cnt; lid++) {
+			thread_nodes[lid] = thread_host_to_numa_node(lid * 2);
+		}
+		balancer = new send_balancer(thread_nodes, conf.rebalance_lag * 1.0e3);
+	}
 	for (int lid = 0; lid < work_list_cnt; lid++) {
 		int send_thost_id = lid * 2;
 		int recv_thost_id = lid * 2 + 1;
 		if (conf.udp) {
-			udp_conn_worker *worker = new udp_conn_worker(work_lists[lid], worker_connect_speed);
+			udp_conn_worker *worker = new udp_conn_worker(work_lists[lid], worker_connect_speed, balancer, lid);
 			std::thread send_thread(&udp_conn_worker::send_run, worker);
 			pin_thread(&send_thread, send_thost_id);
 			send_thread.detach();
@@ -500,7 +1514,7 @@ int main(int argc, char **argv) {
 			pin_thread(&recv_thread, recv_thost_id);
 			recv_thread.detach();
 		} else {
-			tcp_conn_worker *worker = new tcp_conn_worker(work_lists[lid], worker_connect_speed);
+			tcp_conn_worker *worker = new tcp_conn_worker(work_lists[lid], worker_connect_speed, worker_churn_connect_rate, balancer, lid);
 			std::thread send_thread(&tcp_conn_worker::send_run, worker);
 			pin_thread(&send_thread, send_thost_id);
 			send_thread.detach();
@@ -511,6 +1525,12 @@ int main(int argc, char **argv) {
 	}
 	delete[] work_lists;
 
+	if (conf.server_stats) {
+		server_stats_open();
+	}
+
+	control.replay_base = clock_mono_nsec() + 1.0e8; // 100ms for the threads to get going
+	control.warmed_up = conf.steady_window == 0;
 	control.started = true;
 	double ramp_start_time = clock_mono_nsec();
 	printf("===ramp up started===\n");
@@ -522,13 +1542,21 @@ int main(int argc, char **argv) {
 	fflush(stdout);
 
 	do_work();
+	if (conf.server_stats) {
+		server_stats_close();
+	}
 	fflush(stdout);
 
+	if (conf.stream_file != NULL) {
+		stream_close();
+	}
+
+	if (conf.record_file != NULL) {
+		record_close();
+	}
+
 	if (!conf.preload && conf.histogram_body > 0) {
-		for (int i = 0; i < conn_cnt; i++) {
-			conn_work *work = conn_works[i];
-			work->dump_histogram("histograms");
-		}
+		dump_histograms();
 	}
 
 	return 0;
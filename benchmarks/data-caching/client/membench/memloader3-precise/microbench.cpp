@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "memcached_cmd.h"
+#include "memdb.h"
+#include "key_template.h"
+#include "histogram.h"
+#include "tcp_request_queue.h"
+#include "randnum.h"
+#include "config.h"
+#include "util.h"
+#include "clock.h"
+
+// histogram.h reads its head/body from the global config.
+config conf;
+
+// Keeps the compiler from optimizing away benchmarked work.
+static volatile long sink;
+
+static const char *filter = NULL; // run only benchmarks whose name contains this
+static const char *csv_file = NULL;
+static const char *tag = "-";
+
+static bool selected(const char *name) {
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+// Prints the average cost of one op, and appends it to the csv file if there is one.
+static void report(const char *name, double ns, unsigned long long cycles, long ops) {
+	printf("%-36s ns/op %8.2f cycles/op %8.2f\n", name, ns / ops, (double) cycles / ops);
+	if (csv_file != NULL) {
+		FILE *fp = fopen(csv_file, "a");
+		if (fp == NULL) {
+			perror("microbench: can't open csv file");
+			exit(1);
+		}
+		if (ftell(fp) == 0) {
+			fprintf(fp, "tag,name,ns_per_op,cycles_per_op,ops\n");
+		}
+		fprintf(fp, "%s,%s,%.3f,%.3f,%ld\n", tag, name, ns / ops, (double) cycles / ops, ops);
+		fclose(fp);
+	}
+}
+
+// Runs fn(i) for i in [0, iters) and reports the average cost of one op,
+// where each call of fn does ops_per_call ops.
+template<typename F> static void run_bench(const char *name, long iters, int ops_per_call, F fn) {
+	if (!selected(name)) {
+		return;
+	}
+	// warm up caches and branch predictors
+	for (long i = 0; i < iters / 10; i++) {
+		fn(i);
+	}
+	double start_ns = clock_mono_nsec();
+	unsigned long long start_cycles = rdtsc();
+	for (long i = 0; i < iters; i++) {
+		fn(i);
+	}
+	unsigned long long cycles = rdtsc() - start_cycles;
+	double ns = clock_mono_nsec() - start_ns;
+	report(name, ns, cycles, iters * ops_per_call);
+}
+
+static const key_template legacy_keys(NULL);
+
+static request make_request(memcmd_t cmd, int key_size, int val_size) {
+	static char key[max_key_size];
+	request r;
+	memset(&r, 0, sizeof(r));
+	legacy_keys.render(key, key_size, 0, "");
+	r.key = key;
+	r.key_size = key_size;
+	r.val_size = val_size;
+	r.vss_size = std::to_string(val_size).size();
+	r.cmd = cmd;
+	return r;
+}
+
+static std::string make_value_head(const key_template &kt, int key_seed, int key_size, int val_size) {
+	char key[max_key_size];
+	kt.render(key, key_size, key_seed, "bench");
+	return "VALUE " + std::string(key, key_size) + " 0 " + std::to_string(val_size) + "\r\n";
+}
+
+// Parses with the keys of kt, "" for the 'K' padded hex keys.
+static void bench_parse_response(const char *kt_spec) {
+	key_template kt(kt_spec[0] != '\0' ? kt_spec : NULL);
+	response_key_template = &kt;
+	// A stream of response head lines in the mix a GET/SET workload sees.
+	const int line_cnt = 64;
+	std::string stream;
+	for (int i = 0; i < line_cnt; i++) {
+		switch (i % 4) {
+		case 0: stream += "END\r\n"; break;
+		case 1: stream += "STORED\r\n"; break;
+		default: stream += make_value_head(kt, i * 7919, 24 + i % 40, 100 + i * 13); break;
+		}
+	}
+	std::vector<char> buf(stream.begin(), stream.end());
+	const char *end = buf.data() + buf.size();
+
+	if (kt_spec[0] == '\0') {
+		run_bench("find_line_end", 200000, line_cnt, [&](long i) {
+			const char *p = buf.data();
+			long cnt = 0;
+			while (const char *nl = find_line_end(p, end)) {
+				p = nl + 1;
+				cnt++;
+			}
+			sink = cnt;
+		});
+	}
+
+	std::string name = std::string("find_line_end+parse_response_head") + (kt_spec[0] != '\0' ? "(template)" : "");
+	run_bench(name.c_str(), 200000, line_cnt, [&](long i) {
+		char *p = buf.data();
+		response resp;
+		long cnt = 0;
+		while (char *nl = (char*) find_line_end(p, end)) {
+			parse_response_head(&resp, p);
+			p = nl + 1;
+			cnt += resp.val_size;
+		}
+		sink = cnt;
+	});
+	response_key_template = &legacy_keys;
+}
+
+static void bench_fill_send_buf() {
+	static char buf[max_request_size];
+
+	for (int key_size : {16, 64, 250}) {
+		request r = make_request(mcm_get, key_size, 0);
+		char name[64];
+		sprintf(name, "fill_send_buf(get,key%d)", key_size);
+		run_bench(name, 2000000, 1, [&](long i) {
+			r.key_seed = i;
+			sink = fill_send_buf(r, buf, sizeof(buf));
+		});
+	}
+
+	for (int val_size : {64, 1024, 16384, 262144}) {
+		request r = make_request(mcm_set, 30, val_size);
+		char name[64];
+		sprintf(name, "fill_send_buf(set,val%d)", val_size);
+		// about the same number of bytes written for every size
+		run_bench(name, 200000000L / (val_size + 100), 1, [&](long i) {
+			r.key_seed = i;
+			sink = fill_send_buf(r, buf, sizeof(buf));
+		});
+	}
+}
+
+static void bench_rand_pick_entry() {
+	if (!selected("memdb::rand_pick_entry")) {
+		return;
+	}
+	// A sample like the ones in memdb/, with a skewed popularity over 1000 entries.
+	char filename[] = "/tmp/microbench-sample-XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd < 0) {
+		perror("microbench: can't create sample file");
+		exit(1);
+	}
+	FILE *fp = fdopen(fd, "w");
+	for (int i = 0; i < 1000; i++) {
+		fprintf(fp, "%d %d %d\n", 20 + i % 40, 100 + i * 7, 1000000 / (i + 1));
+	}
+	fclose(fp);
+	// memdb_sample prints a summary, keep it out of the results
+	fflush(stdout);
+	int saved_stdout = dup(1);
+	int devnull = open("/dev/null", O_WRONLY);
+	dup2(devnull, 1);
+	memdb_sample sample(filename);
+	fflush(stdout);
+	dup2(saved_stdout, 1);
+	close(devnull);
+	close(saved_stdout);
+	unlink(filename);
+
+	memdb db(&sample, 1000000, 0, &legacy_keys, "");
+	rand_engine_t rg(42);
+	run_bench("memdb::rand_pick_entry", 2000000, 1, [&](long i) {
+		sink = db.rand_pick_entry(&rg);
+	});
+}
+
+static void bench_rand_pick_generated() {
+	if (!selected("memdb::rand_pick_entry(zipf)")) {
+		return;
+	}
+	// A generated database of 1M keys (ETC sizes, zipf popularity), picked through the alias table.
+	popularity_dist zipf;
+	zipf.law = ppl_zipf;
+	zipf.exponent = 0.99;
+	fflush(stdout);
+	int saved_stdout = dup(1);
+	int devnull = open("/dev/null", O_WRONLY);
+	dup2(devnull, 1);
+	memdb_sample sample(size_dist::etc_key_size(), size_dist::etc_value_size(), zipf, 1000000, legacy_keys.min_key_size(""));
+	fflush(stdout);
+	dup2(saved_stdout, 1);
+	close(devnull);
+	close(saved_stdout);
+
+	memdb db(&sample, 1000000, 0, &legacy_keys, "");
+	rand_engine_t rg(42);
+	run_bench("memdb::rand_pick_entry(zipf)", 2000000, 1, [&](long i) {
+		sink = db.rand_pick_entry(&rg);
+	});
+}
+
+static void bench_histogram() {
+	conf.histogram_head = 0;
+	conf.histogram_body = 1 << 30;
+	histogram *hist = new histogram("bench");
+	rand_engine_t rg(42);
+	std::vector<double> vals(4096);
+	for (auto &v : vals) {
+		v = std::exponential_distribution<double>(1.0 / 300.0)(rg); // latencies in us around 300us
+	}
+	run_bench("histogram::add_sample", 10000000, 1, [&](long i) {
+		hist->add_sample(vals[i & 4095]);
+	});
+	delete hist;
+}
+
+static void bench_clock() {
+	run_bench("clock_mono_nsec", 10000000, 1, [&](long i) {
+		sink = (long) clock_mono_nsec();
+	});
+	run_bench("rdtsc", 10000000, 1, [&](long i) {
+		sink = rdtsc();
+	});
+}
+
+static void bench_request_queue() {
+	tcp_request_queue q;
+	request r;
+	memset(&r, 0, sizeof(r));
+
+	// one thread, the queue length stays at one: the cost of the locking and list nodes
+	run_bench("tcp_request_queue(push+pop)", 5000000, 1, [&](long i) {
+		r.key_seed = i;
+		q.push_back(r);
+		sink = q.front().key_seed;
+		q.pop_front();
+	});
+
+	// the send thread pushes, the recv thread pops, as on a real connection
+	const char *name = "tcp_request_queue(handoff)";
+	if (!selected(name)) {
+		return;
+	}
+	const long handoffs = 2000000;
+	std::atomic<bool> go(false);
+	std::thread consumer([&]() {
+		while (!go.load()) {
+		}
+		long got = 0;
+		while (got < handoffs) {
+			if (!q.empty()) {
+				sink = q.front().key_seed;
+				q.pop_front();
+				got++;
+			}
+		}
+	});
+	double start_ns = clock_mono_nsec();
+	unsigned long long start_cycles = rdtsc();
+	go.store(true);
+	for (long i = 0; i < handoffs; i++) {
+		r.key_seed = i;
+		q.push_back(r);
+	}
+	consumer.join();
+	report(name, clock_mono_nsec() - start_ns, rdtsc() - start_cycles, handoffs);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: microbench [--csv <file>] [--tag <label>] [name filter]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int i = 1;
+	while (i < argc) {
+		const char *key = argv[i++];
+		if (strcmp(key, "--csv") == 0 && i < argc) {
+			csv_file = argv[i++];
+		} else if (strcmp(key, "--tag") == 0 && i < argc) {
+			tag = argv[i++];
+		} else if (key[0] == '-') {
+			usage();
+		} else {
+			filter = key;
+		}
+	}
+
+	init_clock_mono_nsec();
+	bench_fill_send_buf();
+	bench_parse_response("");
+	bench_parse_response("app:{ns}:user:{id}");
+	bench_rand_pick_entry();
+	bench_rand_pick_generated();
+	bench_histogram();
+	bench_clock();
+	bench_request_queue();
+	return 0;
+}
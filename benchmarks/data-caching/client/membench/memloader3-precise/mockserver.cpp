@@ -0,0 +1,687 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "memcached_cmd.h"
+#include "randnum.h"
+
+// A memcached stand-in that does no real work, to measure how much load memloader itself can
+// generate and its latency floor (see "Mock server" in README). It speaks the ASCII protocol
+// over TCP and UDP, on the same port. Values are not stored: SETs only record the value size
+// of their key, and GET hits reply with that many canned bytes.
+
+enum latency_shape {LAT_NONE, LAT_FIXED, LAT_UNIFORM, LAT_EXPONENTIAL};
+
+class mock_config {
+public:
+	int port;
+	int threads;
+	double hit_ratio; // of GETs for keys with a known size
+	int value_size; // size of GET hits for keys never SET, 0 means they miss
+	latency_shape latency;
+	double latency_param[2]; // in us
+};
+
+static mock_config mconf;
+
+static const int udp_header_size = sizeof(udp_request_header);
+static const int udp_payload_max = 1400;
+static const int max_line_size = 2048;
+
+static std::string canned_value;
+
+class mock_stats {
+public:
+	std::atomic<uint64_t> curr_connections;
+	std::atomic<uint64_t> total_connections;
+	std::atomic<uint64_t> cmd_get;
+	std::atomic<uint64_t> cmd_set;
+	std::atomic<uint64_t> get_hits;
+	std::atomic<uint64_t> get_misses;
+};
+
+static mock_stats stats;
+
+// Value sizes by key, split into stripes so that threads rarely wait on each other.
+class size_store {
+private:
+	static const int stripe_cnt = 64;
+	std::mutex locks[stripe_cnt];
+	std::unordered_map<std::string, int> sizes[stripe_cnt];
+
+	int stripe(const std::string &key) const {
+		return std::hash<std::string>()(key) % stripe_cnt;
+	}
+
+public:
+	bool get(const std::string &key, int *size) {
+		int s = stripe(key);
+		std::lock_guard<std::mutex> guard(locks[s]);
+		auto it = sizes[s].find(key);
+		if (it == sizes[s].end()) {
+			return false;
+		}
+		*size = it->second;
+		return true;
+	}
+
+	void set(const std::string &key, int size) {
+		int s = stripe(key);
+		std::lock_guard<std::mutex> guard(locks[s]);
+		sizes[s][key] = size;
+	}
+};
+
+static size_store store;
+
+static double mono_nsec() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
+
+static void set_nonblocking(int fd) {
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+		perror("mockserver: can't set O_NONBLOCK");
+		exit(1);
+	}
+}
+
+// Every thread binds its own sockets to the port, the kernel spreads connections and datagrams.
+static int open_port_sock(int sock_type) {
+	int fd = socket(AF_INET, sock_type, 0);
+	if (fd < 0) {
+		perror("mockserver: can't create socket");
+		exit(1);
+	}
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("mockserver: can't set SO_REUSEPORT");
+		exit(1);
+	}
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(mconf.port);
+	if (bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+		perror("mockserver: can't bind");
+		exit(1);
+	}
+	if (sock_type == SOCK_STREAM && listen(fd, 1024) < 0) {
+		perror("mockserver: can't listen");
+		exit(1);
+	}
+	set_nonblocking(fd);
+	return fd;
+}
+
+class mock_connection {
+public:
+	uint64_t id;
+	int fd;
+	std::string in;
+	std::string out;
+	bool want_out; // EPOLLOUT is on
+	double last_due; // replies of a connection leave in order, whatever their delays
+};
+
+// A reply held back by the injected latency.
+class delayed_reply {
+public:
+	double due; // in ns
+	uint64_t seq;
+	uint64_t conn_id; // 0 for udp
+	sockaddr_storage addr;
+	socklen_t addr_len;
+	uint16_t udp_id;
+	std::string data;
+};
+
+// A udp request of several datagrams, answered once all of them arrived.
+class udp_partial {
+public:
+	int seen;
+	bool has_reply;
+	std::string reply;
+
+public:
+	udp_partial() : seen(0), has_reply(false) { }
+};
+
+class delayed_reply_later {
+public:
+	bool operator()(const delayed_reply *a, const delayed_reply *b) const {
+		return a->due > b->due || (a->due == b->due && a->seq > b->seq);
+	}
+};
+
+class mock_thread {
+private:
+	int epfd;
+	int listen_fd;
+	int udp_fd;
+	int timer_fd;
+	rand_engine_t rg;
+	rand_uniform_real_t unit;
+	uint64_t next_conn_id;
+	std::unordered_map<uint64_t, mock_connection*> conns;
+	std::priority_queue<delayed_reply*, std::vector<delayed_reply*>, delayed_reply_later> delayed;
+	uint64_t next_seq;
+	double armed_due;
+	std::vector<mock_connection*> closed; // freed after the current batch of events
+	std::vector<char> udp_buf;
+	std::unordered_map<std::string, udp_partial> udp_partials; // by source address and request id
+
+	void watch(int fd, uint32_t events, void *ptr, int op) {
+		epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = ptr;
+		if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+			perror("mockserver: epoll_ctl");
+			exit(1);
+		}
+	}
+
+	double latency() {
+		switch (mconf.latency) {
+		case LAT_FIXED:
+			return mconf.latency_param[0] * 1.0e3;
+		case LAT_UNIFORM:
+			return (mconf.latency_param[0] + unit(rg) * (mconf.latency_param[1] - mconf.latency_param[0])) * 1.0e3;
+		case LAT_EXPONENTIAL:
+			return std::exponential_distribution<double>(1.0 / mconf.latency_param[0])(rg) * 1.0e3;
+		default:
+			return 0.0;
+		}
+	}
+
+	void get_reply(const std::string &key, std::string *reply) {
+		stats.cmd_get++;
+		int size;
+		bool known = store.get(key, &size);
+		if (!known && mconf.value_size > 0) {
+			size = mconf.value_size;
+			known = true;
+		}
+		if (!known || (mconf.hit_ratio < 1.0 && unit(rg) >= mconf.hit_ratio)) {
+			stats.get_misses++;
+			return;
+		}
+		stats.get_hits++;
+		*reply += "VALUE ";
+		*reply += key;
+		*reply += " 0 ";
+		*reply += std::to_string(size);
+		*reply += "\r\n";
+		reply->append(canned_value, 0, size);
+		*reply += "\r\n";
+	}
+
+	void stats_reply(std::string *reply) {
+		char buf[640];
+		rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		sprintf(buf, "STAT pid %d\r\nSTAT rusage_user %ld.%06ld\r\nSTAT rusage_system %ld.%06ld\r\n"
+			"STAT threads %d\r\nSTAT curr_connections %lu\r\nSTAT total_connections %lu\r\n"
+			"STAT cmd_get %lu\r\nSTAT cmd_set %lu\r\nSTAT get_hits %lu\r\nSTAT get_misses %lu\r\nEND\r\n",
+			getpid(), (long) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec, (long) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec,
+			mconf.threads,
+			(unsigned long) stats.curr_connections, (unsigned long) stats.total_connections,
+			(unsigned long) stats.cmd_get, (unsigned long) stats.cmd_set,
+			(unsigned long) stats.get_hits, (unsigned long) stats.get_misses);
+		*reply += buf;
+	}
+
+	// Handles the command at the start of [begin, end) and appends its reply. Returns the number
+	// of bytes it took, 0 if the command is not complete yet, or -1 if the client should be
+	// dropped. With partial_ok (udp), a SET is answered even if its data is not all there.
+	int handle_command(const char *begin, const char *end, std::string *reply, bool partial_ok) {
+		const char *nl = find_line_end(begin, end);
+		if (nl == NULL) {
+			return end - begin > max_line_size ? -1 : 0;
+		}
+		int line_len = nl + 1 - begin;
+
+		const char *tokens[8];
+		int token_lens[8];
+		int token_cnt = 0;
+		const char *p = begin;
+		while (p < nl && token_cnt < 8) {
+			while (p < nl && (*p == ' ' || *p == '\r')) {
+				p++;
+			}
+			if (p == nl) {
+				break;
+			}
+			tokens[token_cnt] = p;
+			while (p < nl && *p != ' ' && *p != '\r') {
+				p++;
+			}
+			token_lens[token_cnt] = p - tokens[token_cnt];
+			token_cnt++;
+		}
+		if (token_cnt == 0) {
+			*reply += "ERROR\r\n";
+			return line_len;
+		}
+
+		std::string cmd(tokens[0], token_lens[0]);
+		if (cmd == "get" || cmd == "gets") {
+			for (int i = 1; i < token_cnt; i++) {
+				get_reply(std::string(tokens[i], token_lens[i]), reply);
+			}
+			*reply += "END\r\n";
+			return line_len;
+		} else if (cmd == "set" && token_cnt >= 5) {
+			int bytes = atoi(tokens[4]);
+			if (bytes < 0 || bytes > max_val_size) {
+				return -1;
+			}
+			int total = line_len + bytes + 2;
+			if (end - begin < total) {
+				if (!partial_ok) {
+					return 0;
+				}
+				total = end - begin;
+			}
+			stats.cmd_set++;
+			store.set(std::string(tokens[1], token_lens[1]), bytes);
+			if (!(token_cnt >= 6 && token_lens[5] == 7 && memcmp(tokens[5], "noreply", 7) == 0)) {
+				*reply += "STORED\r\n";
+			}
+			return total;
+		} else if (cmd == "stats") {
+			if (token_cnt == 1) {
+				stats_reply(reply);
+			} else { // no slabs or items to report
+				*reply += "END\r\n";
+			}
+			return line_len;
+		} else if (cmd == "version") {
+			*reply += "VERSION mockserver\r\n";
+			return line_len;
+		} else if (cmd == "quit") {
+			return -1;
+		}
+		*reply += "ERROR\r\n";
+		return line_len;
+	}
+
+	void close_connection(mock_connection *c) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+		conns.erase(c->id);
+		closed.push_back(c);
+		stats.curr_connections--;
+	}
+
+	// Returns false if the connection was closed.
+	bool flush(mock_connection *c) {
+		if (c->fd < 0) {
+			return false;
+		}
+		size_t sent = 0;
+		while (sent < c->out.size()) {
+			ssize_t res = send(c->fd, c->out.data() + sent, c->out.size() - sent, MSG_NOSIGNAL);
+			if (res < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					break;
+				}
+				close_connection(c);
+				return false;
+			}
+			sent += res;
+		}
+		c->out.erase(0, sent);
+		if (c->want_out == c->out.empty()) {
+			c->want_out = !c->out.empty();
+			watch(c->fd, c->want_out ? EPOLLIN | EPOLLOUT : EPOLLIN, c, EPOLL_CTL_MOD);
+		}
+		return true;
+	}
+
+	void arm_timer() {
+		if (delayed.empty() || delayed.top()->due == armed_due) {
+			return;
+		}
+		armed_due = delayed.top()->due;
+		itimerspec its;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = (time_t) (armed_due / 1.0e9);
+		its.it_value.tv_nsec = (long) (armed_due - its.it_value.tv_sec * 1.0e9);
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+			its.it_value.tv_nsec = 1; // zero would disarm
+		}
+		if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+			perror("mockserver: timerfd_settime");
+			exit(1);
+		}
+	}
+
+	void delay(delayed_reply *d) {
+		d->seq = next_seq++;
+		delayed.push(d);
+		arm_timer();
+	}
+
+	void send_udp(const sockaddr *addr, socklen_t addr_len, uint16_t udp_id, const std::string &data) {
+		char dgram[udp_header_size + udp_payload_max];
+		int dgram_cnt = (data.size() + udp_payload_max - 1) / udp_payload_max;
+		if (dgram_cnt == 0) {
+			dgram_cnt = 1;
+		}
+		for (int seq = 0; seq < dgram_cnt; seq++) {
+			udp_request_header *h = (udp_request_header*) dgram;
+			h->id = htons(udp_id);
+			h->seq_no = htons(seq);
+			h->dgram_cnt = htons(dgram_cnt);
+			h->reserved = 0;
+			int len = std::min((int) data.size() - seq * udp_payload_max, udp_payload_max);
+			memcpy(dgram + udp_header_size, data.data() + seq * udp_payload_max, len);
+			// a full socket buffer drops the reply, like a lost datagram
+			sendto(udp_fd, dgram, udp_header_size + len, MSG_DONTWAIT, addr, addr_len);
+		}
+	}
+
+	void on_accept() {
+		while (true) {
+			int fd = accept(listen_fd, NULL, NULL);
+			if (fd < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					perror("mockserver: accept");
+				}
+				return;
+			}
+			set_nonblocking(fd);
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			mock_connection *c = new mock_connection();
+			c->id = next_conn_id++;
+			c->fd = fd;
+			c->want_out = false;
+			c->last_due = 0.0;
+			conns[c->id] = c;
+			watch(fd, EPOLLIN, c, EPOLL_CTL_ADD);
+			stats.curr_connections++;
+			stats.total_connections++;
+		}
+	}
+
+	void on_readable(mock_connection *c) {
+		char buf[65536];
+		while (true) {
+			ssize_t res = recv(c->fd, buf, sizeof(buf), 0);
+			if (res == 0 || (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				close_connection(c);
+				return;
+			}
+			if (res < 0) {
+				break;
+			}
+			c->in.append(buf, res);
+		}
+
+		size_t pos = 0;
+		std::string reply;
+		while (pos < c->in.size()) {
+			int used = handle_command(c->in.data() + pos, c->in.data() + c->in.size(), &reply, false);
+			if (used < 0) {
+				close_connection(c);
+				return;
+			}
+			if (used == 0) {
+				break;
+			}
+			pos += used;
+			if (mconf.latency != LAT_NONE && !reply.empty()) {
+				delayed_reply *d = new delayed_reply();
+				d->due = std::max(mono_nsec() + latency(), c->last_due);
+				c->last_due = d->due;
+				d->conn_id = c->id;
+				d->data.swap(reply);
+				delay(d);
+			}
+		}
+		c->in.erase(0, pos);
+		if (!reply.empty()) {
+			c->out += reply;
+			flush(c);
+		}
+	}
+
+	void on_udp() {
+		while (true) {
+			sockaddr_storage addr;
+			socklen_t addr_len = sizeof(addr);
+			ssize_t res = recvfrom(udp_fd, udp_buf.data(), udp_buf.size(), 0, (sockaddr*) &addr, &addr_len);
+			if (res < 0) {
+				return;
+			}
+			if (res < udp_header_size) {
+				continue;
+			}
+			udp_request_header *h = (udp_request_header*) udp_buf.data();
+			int dgram_cnt = ntohs(h->dgram_cnt);
+			std::string reply;
+			if (ntohs(h->seq_no) == 0) {
+				const char *payload = udp_buf.data() + udp_header_size;
+				if (handle_command(payload, udp_buf.data() + res, &reply, true) <= 0) {
+					continue;
+				}
+			}
+			if (dgram_cnt > 1) {
+				// the client takes the send time of its last datagram, so reply after that one
+				std::string partial_key((char*) &addr, addr_len);
+				partial_key.append((char*) &h->id, sizeof(h->id));
+				if (udp_partials.size() > 100000) {
+					udp_partials.clear(); // requests that lost datagrams
+				}
+				udp_partial &part = udp_partials[partial_key];
+				part.seen++;
+				if (ntohs(h->seq_no) == 0) {
+					part.has_reply = true;
+					part.reply.swap(reply);
+				}
+				if (part.seen < dgram_cnt || !part.has_reply) {
+					continue;
+				}
+				reply.swap(part.reply);
+				udp_partials.erase(partial_key);
+			}
+			if (reply.empty()) {
+				continue;
+			}
+			if (mconf.latency != LAT_NONE) {
+				delayed_reply *d = new delayed_reply();
+				d->due = mono_nsec() + latency();
+				d->conn_id = 0;
+				d->addr = addr;
+				d->addr_len = addr_len;
+				d->udp_id = ntohs(h->id);
+				d->data.swap(reply);
+				delay(d);
+			} else {
+				send_udp((sockaddr*) &addr, addr_len, ntohs(h->id), reply);
+			}
+		}
+	}
+
+	void on_timer() {
+		uint64_t expirations;
+		if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+			perror("mockserver: timerfd read");
+			exit(1);
+		}
+		armed_due = -1.0;
+		double now = mono_nsec();
+		std::vector<mock_connection*> touched;
+		while (!delayed.empty() && delayed.top()->due <= now) {
+			delayed_reply *d = delayed.top();
+			delayed.pop();
+			if (d->conn_id == 0) {
+				send_udp((sockaddr*) &d->addr, d->addr_len, d->udp_id, d->data);
+			} else {
+				auto it = conns.find(d->conn_id);
+				if (it != conns.end()) { // else closed meanwhile
+					if (it->second->out.empty()) {
+						touched.push_back(it->second);
+					}
+					it->second->out += d->data;
+				}
+			}
+			delete d;
+		}
+		for (auto c : touched) {
+			flush(c);
+		}
+		arm_timer();
+	}
+
+public:
+	mock_thread(int id) : rg(derive_seed(42, id)), unit(0.0, 1.0), udp_buf(65536) {
+		epfd = epoll_create1(0);
+		timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (epfd < 0 || timer_fd < 0) {
+			perror("mockserver: can't create epoll/timer fd");
+			exit(1);
+		}
+		listen_fd = open_port_sock(SOCK_STREAM);
+		udp_fd = open_port_sock(SOCK_DGRAM);
+		watch(listen_fd, EPOLLIN, &listen_fd, EPOLL_CTL_ADD);
+		watch(udp_fd, EPOLLIN, &udp_fd, EPOLL_CTL_ADD);
+		watch(timer_fd, EPOLLIN, &timer_fd, EPOLL_CTL_ADD);
+		next_conn_id = 1;
+		next_seq = 0;
+		armed_due = -1.0;
+	}
+
+	void run() {
+		epoll_event events[256];
+		while (true) {
+			int cnt = epoll_wait(epfd, events, 256, -1);
+			if (cnt < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("mockserver: epoll_wait");
+				exit(1);
+			}
+			for (int i = 0; i < cnt; i++) {
+				void *ptr = events[i].data.ptr;
+				if (ptr == &listen_fd) {
+					on_accept();
+				} else if (ptr == &udp_fd) {
+					on_udp();
+				} else if (ptr == &timer_fd) {
+					on_timer();
+				} else {
+					mock_connection *c = (mock_connection*) ptr;
+					if (c->fd < 0 || ((events[i].events & EPOLLOUT) && !flush(c))) {
+						continue;
+					}
+					if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+						on_readable(c);
+					}
+				}
+			}
+			for (auto c : closed) {
+				delete c;
+			}
+			closed.clear();
+		}
+	}
+};
+
+static void usage() {
+	fprintf(stderr, "usage: mockserver [--port <port>] [--threads <n>] [--hit-ratio <ratio>] [--value-size <bytes>]\n"
+		"\t[--latency fixed <us> | uniform <min us> <max us> | exp <mean us>]\n");
+	exit(1);
+}
+
+static void parse_arguments(int argc, char **argv) {
+	int i = 1;
+	while (i < argc) {
+		const char *key = argv[i++];
+		if (strcmp(key, "--port") == 0 && i < argc) {
+			mconf.port = atoi(argv[i++]);
+		} else if (strcmp(key, "--threads") == 0 && i < argc) {
+			mconf.threads = atoi(argv[i++]);
+		} else if (strcmp(key, "--hit-ratio") == 0 && i < argc) {
+			mconf.hit_ratio = atof(argv[i++]);
+		} else if (strcmp(key, "--value-size") == 0 && i < argc) {
+			mconf.value_size = atoi(argv[i++]);
+		} else if (strcmp(key, "--latency") == 0 && i + 1 < argc) {
+			const char *shape = argv[i++];
+			mconf.latency_param[0] = atof(argv[i++]);
+			if (strcmp(shape, "fixed") == 0) {
+				mconf.latency = LAT_FIXED;
+			} else if (strcmp(shape, "uniform") == 0 && i < argc) {
+				mconf.latency = LAT_UNIFORM;
+				mconf.latency_param[1] = atof(argv[i++]);
+			} else if (strcmp(shape, "exp") == 0) {
+				mconf.latency = LAT_EXPONENTIAL;
+			} else {
+				usage();
+			}
+			if (mconf.latency_param[0] <= 0.0) {
+				mconf.latency = LAT_NONE;
+			}
+		} else {
+			usage();
+		}
+	}
+	if (mconf.threads < 1 || mconf.hit_ratio < 0.0 || mconf.hit_ratio > 1.0 || mconf.value_size < 0 || mconf.value_size > max_val_size) {
+		usage();
+	}
+}
+
+int main(int argc, char **argv) {
+	mconf.port = 11211;
+	mconf.threads = 4;
+	mconf.hit_ratio = 1.0;
+	mconf.value_size = 0;
+	mconf.latency = LAT_NONE;
+	mconf.latency_param[0] = 0.0;
+	mconf.latency_param[1] = 0.0;
+	parse_arguments(argc, argv);
+
+	canned_value.assign(max_val_size, 'V');
+
+	std::vector<mock_thread*> workers;
+	for (int i = 0; i < mconf.threads; i++) {
+		workers.push_back(new mock_thread(i));
+	}
+	printf("mockserver: port %d (tcp and udp), %d threads\n", mconf.port, mconf.threads);
+	fflush(stdout);
+
+	std::vector<std::thread> threads;
+	for (auto w : workers) {
+		threads.push_back(std::thread(&mock_thread::run, w));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	return 0;
+}
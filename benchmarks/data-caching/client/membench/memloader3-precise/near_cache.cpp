@@ -0,0 +1,191 @@
+#include "near_cache.h"
+
+#include <stddef.h>
+#include <atomic>
+
+static std::atomic<uint32_t> *key_versions = NULL;
+
+void near_cache_init(int key_seed_cnt) {
+	key_versions = new std::atomic<uint32_t>[key_seed_cnt];
+	for (int i = 0; i < key_seed_cnt; i++) {
+		key_versions[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void near_cache_invalidate(int key_seed) {
+	key_versions[key_seed].fetch_add(1, std::memory_order_relaxed);
+}
+
+static inline uint32_t key_version(int key_seed) {
+	return key_versions[key_seed].load(std::memory_order_relaxed);
+}
+
+static inline uint32_t pow2_at_least(uint32_t n) {
+	uint32_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+near_cache::near_cache(int capacity, near_policy_t policy, double ttl) :
+capacity(capacity), policy(policy), ttl(ttl) {
+	entries.resize(capacity);
+	for (int e = 0; e < capacity; e++) {
+		entries[e].next = e + 1 < capacity ? e + 1 : -1;
+	}
+	free_head = capacity > 0 ? 0 : -1;
+	head = tail = -1;
+	index.assign(pow2_at_least(capacity * 2), -1);
+	index_mask = index.size() - 1;
+
+	sketch_mask = 0;
+	sample_cnt = 0;
+	sample_period = 0;
+	if (policy == ncp_tinylfu) {
+		sketch.assign(4 * pow2_at_least(capacity), 0);
+		sketch_mask = sketch.size() / 4 - 1;
+		sample_period = 10 * capacity;
+	}
+}
+
+uint32_t near_cache::slot_of(int key_seed) const {
+	return ((uint32_t) key_seed * 0x9e3779b1) & index_mask;
+}
+
+int near_cache::find(int key_seed) const {
+	for (uint32_t s = slot_of(key_seed); index[s] >= 0; s = (s + 1) & index_mask) {
+		if (entries[index[s]].key_seed == key_seed) {
+			return index[s];
+		}
+	}
+	return -1;
+}
+
+void near_cache::unlink(int e) {
+	entry &en = entries[e];
+	if (en.prev >= 0) {
+		entries[en.prev].next = en.next;
+	} else {
+		head = en.next;
+	}
+	if (en.next >= 0) {
+		entries[en.next].prev = en.prev;
+	} else {
+		tail = en.prev;
+	}
+}
+
+void near_cache::push_front(int e) {
+	entries[e].prev = -1;
+	entries[e].next = head;
+	if (head >= 0) {
+		entries[head].prev = e;
+	} else {
+		tail = e;
+	}
+	head = e;
+}
+
+// Drops entry e, closing the gap in its probe sequence by moving later entries back.
+void near_cache::remove(int e) {
+	unlink(e);
+	uint32_t s = slot_of(entries[e].key_seed);
+	while (index[s] != e) {
+		s = (s + 1) & index_mask;
+	}
+	uint32_t gap = s;
+	for (s = (s + 1) & index_mask; index[s] >= 0; s = (s + 1) & index_mask) {
+		uint32_t home = slot_of(entries[index[s]].key_seed);
+		// entry at s may fill the gap if its home is not within (gap, s]
+		if (((s - home) & index_mask) >= ((s - gap) & index_mask)) {
+			index[gap] = index[s];
+			gap = s;
+		}
+	}
+	index[gap] = -1;
+	entries[e].next = free_head;
+	free_head = e;
+}
+
+void near_cache::sketch_add(int key_seed) {
+	uint64_t h = (uint64_t) (uint32_t) key_seed * 0x9e3779b97f4a7c15ULL;
+	uint32_t h1 = h >> 32, h2 = (uint32_t) h | 1;
+	for (uint32_t row = 0; row < 4; row++) {
+		uint8_t &c = sketch[row * (sketch_mask + 1) + ((h1 + row * h2) & sketch_mask)];
+		if (c < 15) {
+			c++;
+		}
+	}
+	if (++sample_cnt >= sample_period) {
+		for (uint8_t &c : sketch) {
+			c >>= 1;
+		}
+		sample_cnt = 0;
+	}
+}
+
+int near_cache::sketch_estimate(int key_seed) const {
+	uint64_t h = (uint64_t) (uint32_t) key_seed * 0x9e3779b97f4a7c15ULL;
+	uint32_t h1 = h >> 32, h2 = (uint32_t) h | 1;
+	int est = 15;
+	for (uint32_t row = 0; row < 4; row++) {
+		int c = sketch[row * (sketch_mask + 1) + ((h1 + row * h2) & sketch_mask)];
+		est = c < est ? c : est;
+	}
+	return est;
+}
+
+bool near_cache::lookup(int key_seed, double now, bool *stale) {
+	*stale = false;
+	if (policy == ncp_tinylfu) {
+		sketch_add(key_seed);
+	}
+	int e = find(key_seed);
+	if (e < 0) {
+		return false;
+	}
+	bool changed = entries[e].version != key_version(key_seed);
+	if (ttl > 0.0 ? now >= entries[e].expire_time : changed) {
+		remove(e);
+		return false;
+	}
+	*stale = changed;
+	unlink(e);
+	push_front(e);
+	return true;
+}
+
+void near_cache::fill(int key_seed, double now) {
+	if (capacity == 0) {
+		return;
+	}
+	int e = find(key_seed);
+	if (e >= 0) { // filled by an earlier GET of the same key
+		remove(e);
+	} else if (free_head < 0) {
+		if (policy == ncp_tinylfu && sketch_estimate(key_seed) <= sketch_estimate(entries[tail].key_seed)) {
+			return; // not more popular than the victim, not admitted
+		}
+		remove(tail);
+	}
+	e = free_head;
+	free_head = entries[e].next;
+	entry &en = entries[e];
+	en.key_seed = key_seed;
+	en.version = key_version(key_seed);
+	en.expire_time = now + ttl;
+	push_front(e);
+	uint32_t s = slot_of(key_seed);
+	while (index[s] >= 0) {
+		s = (s + 1) & index_mask;
+	}
+	index[s] = e;
+}
+
+void near_cache::erase(int key_seed) {
+	int e = find(key_seed);
+	if (e >= 0) {
+		remove(e);
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef NEAR_CACHE_H
+#define NEAR_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Emulation of an in-process cache in front of memcached (--near-cache). Only key seeds are
+// cached, not values: a GET that hits locally is answered without going to the wire, and the
+// GET hits of the server fill the cache. Every SET bumps a version per key seed shared by all
+// connections, which stands for the value:
+//  - with invalidation (ttl 0), an entry whose key was SET since it was cached is dropped on
+//    lookup, as if every client had been told about the SET;
+//  - with a ttl, entries live that long whatever happens to their keys, and hits on keys
+//    SET meanwhile are counted as stale reads.
+// Replacement is LRU; with TinyLFU, a count-min sketch of recent lookups also decides whether a
+// new key may replace the LRU victim, so that one-off keys don't flush popular ones.
+
+enum near_policy_t {ncp_lru, ncp_tinylfu};
+
+// Sets up the key versions, key seeds are in [0, key_seed_cnt).
+void near_cache_init(int key_seed_cnt);
+
+// A SET of key_seed, by any connection.
+void near_cache_invalidate(int key_seed);
+
+// A bounded cache of key seeds. Not thread safe.
+class near_cache {
+private:
+	class entry {
+	public:
+		int key_seed;
+		uint32_t version; // of the key when cached
+		double expire_time; // in ns, only with a ttl
+		int prev, next; // LRU list (head is the most recent), or free list through next
+	};
+
+	const int capacity;
+	const near_policy_t policy;
+	const double ttl; // in ns, 0.0 to invalidate on SETs instead
+	std::vector<entry> entries;
+	int head, tail, free_head;
+	std::vector<int> index; // open addressing by key seed, -1 for empty slots
+	uint32_t index_mask;
+
+	// TinyLFU frequency sketch: 4 rows of 4-bit saturating counters (one per byte), halved
+	// every sample_period lookups so that old popularity fades.
+	std::vector<uint8_t> sketch;
+	uint32_t sketch_mask;
+	int sample_cnt;
+	int sample_period;
+
+	uint32_t slot_of(int key_seed) const;
+	int find(int key_seed) const; // entry index, -1 if absent
+	void unlink(int e);
+	void push_front(int e);
+	void remove(int e);
+	void sketch_add(int key_seed);
+	int sketch_estimate(int key_seed) const;
+
+public:
+	near_cache(int capacity, near_policy_t policy, double ttl);
+
+	// GET lookup at time now (ns). Returns true on a hit, and sets *stale if the key was SET
+	// since it was cached (only possible with a ttl).
+	bool lookup(int key_seed, double now, bool *stale);
+	// A GET hit from the server at time now.
+	void fill(int key_seed, double now);
+	// A SET of key_seed from this connection, the local entry goes away too.
+	void erase(int key_seed);
+};
+
+#endif
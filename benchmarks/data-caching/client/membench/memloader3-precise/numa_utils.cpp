@@ -0,0 +1,125 @@
+#include "numa_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <vector>
+
+static const int max_numa_nodes = 1024;
+
+static std::vector<int> cpu_nodes; // cpu id -> numa node
+static int numa_node_cnt = 0;
+
+// Parses a sysfs id list such as "0-7,16-23" and calls back for every id.
+template<typename F> static void for_each_id_in_list(const char *list, F f) {
+	const char *p = list;
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		int first = strtol(p, &end, 10);
+		int last = first;
+		if (end == p) break;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			p = end;
+		}
+		for (int id = first; id <= last; id++) {
+			f(id);
+		}
+		if (*p == ',') p++;
+	}
+}
+
+static bool read_sysfs_line(const char *path, char *buf, int bufsz) {
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		return false;
+	}
+	bool ok = fgets(buf, bufsz, fp) != NULL;
+	fclose(fp);
+	return ok;
+}
+
+static void init_numa_topology() {
+
+	if (numa_node_cnt > 0) return;
+
+	char list[4096];
+	std::vector<int> nodes;
+	if (read_sysfs_line("/sys/devices/system/node/online", list, sizeof(list))) {
+		for_each_id_in_list(list, [&nodes](int node) { nodes.push_back(node); });
+	}
+
+	numa_node_cnt = 1;
+	for (int node : nodes) {
+		if (node >= max_numa_nodes) break;
+		char path[128];
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+		if (!read_sysfs_line(path, list, sizeof(list))) continue;
+		for_each_id_in_list(list, [node](int cpu) {
+			if (cpu >= (int) cpu_nodes.size()) {
+				cpu_nodes.resize(cpu + 1, 0);
+			}
+			cpu_nodes[cpu] = node;
+		});
+		if (node + 1 > numa_node_cnt) {
+			numa_node_cnt = node + 1;
+		}
+	}
+}
+
+int get_num_of_numa_nodes() {
+	init_numa_topology();
+	return numa_node_cnt;
+}
+
+int cpu_to_numa_node(int cpu_id) {
+	init_numa_topology();
+	if (cpu_id < 0 || cpu_id >= (int) cpu_nodes.size()) {
+		return 0;
+	}
+	return cpu_nodes[cpu_id];
+}
+
+int nic_to_numa_node(const char *ifname) {
+	char path[256];
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	int node = -1;
+	if (fscanf(fp, "%d", &node) != 1) {
+		node = -1;
+	}
+	fclose(fp);
+	return node;
+}
+
+void *numa_alloc_on_node(size_t size, int node) {
+
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("numa_alloc_on_node: mmap");
+		exit(1);
+	}
+
+	if (node >= 0 && node < max_numa_nodes) {
+		unsigned long mask[max_numa_nodes / (8 * sizeof(unsigned long))];
+		memset(mask, 0, sizeof(mask));
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		// Failure only means the memory is placed by the default policy, so ignore it.
+		syscall(SYS_mbind, mem, size, MPOL_PREFERRED, mask, max_numa_nodes + 1, 0);
+	}
+
+	return mem;
+}
+
+void numa_free(void *mem, size_t size) {
+	munmap(mem, size);
+}
@@ -0,0 +1,21 @@
+#ifndef NUMA_UTILS_H
+#define NUMA_UTILS_H
+
+#include <stddef.h>
+
+// Number of NUMA nodes exposed by the kernel (1 if there is no topology information).
+int get_num_of_numa_nodes();
+
+// NUMA node of a cpu, 0 if unknown.
+int cpu_to_numa_node(int cpu_id);
+
+// NUMA node a network interface is attached to, -1 if unknown (e.g., virtual interfaces).
+int nic_to_numa_node(const char *ifname);
+
+// Allocate page aligned memory with a preference for 'node'. If node < 0, no preference is given.
+// Memory is zero filled. Will exit program if allocation fails.
+void *numa_alloc_on_node(size_t size, int node);
+
+void numa_free(void *mem, size_t size);
+
+#endif
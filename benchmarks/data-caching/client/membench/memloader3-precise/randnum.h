@@ -5,7 +5,56 @@
 #include <stdint.h>
 
 typedef uint64_t rand_seed_t;
-typedef std::mt19937_64 rand_engine_t;
+
+// Seed of an independent stream (e.g., of one connection) derived from a base seed (splitmix64).
+static inline rand_seed_t derive_seed(rand_seed_t base, uint64_t stream) {
+	uint64_t z = base + (stream + 1) * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// xoshiro256** (Blackman and Vigna). Every connection has an engine, and this one keeps 32
+// bytes of state where mt19937_64 keeps 2.5KB.
+class xoshiro256ss {
+public:
+	typedef uint64_t result_type;
+
+private:
+	uint64_t s[4];
+
+	static uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+public:
+	explicit xoshiro256ss(rand_seed_t seed_value = 5489) {
+		seed(seed_value);
+	}
+
+	void seed(rand_seed_t seed_value) {
+		for (int i = 0; i < 4; i++) {
+			s[i] = derive_seed(seed_value, i);
+		}
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT64_MAX; }
+
+	result_type operator()() {
+		uint64_t res = rotl(s[1] * 5, 7) * 9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return res;
+	}
+};
+
+typedef xoshiro256ss rand_engine_t;
 typedef std::uniform_int_distribution<int64_t> rand_uniform_int_t;
 typedef std::uniform_real_distribution<double> rand_uniform_real_t;
 typedef std::normal_distribution<double> rand_normal_real_t;
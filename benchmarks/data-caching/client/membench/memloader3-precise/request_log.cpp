@@ -0,0 +1,137 @@
+#include "request_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <mutex>
+
+static const int record_buffer_cap = 4096;
+static const double record_flush_interval = 1.0e8; // 100ms in ns
+
+static std::mutex log_lock;
+static FILE *log_fp = NULL;
+static std::vector<record_buffer*> buffers; // under log_lock
+
+void record_open(const char *filename, uint64_t seed, int conn_cnt) {
+	log_fp = fopen(filename, "wb");
+	if (log_fp == NULL) {
+		perror("record_open: can't create log");
+		exit(1);
+	}
+	request_log_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, request_log_magic, sizeof(h.magic));
+	h.seed = seed;
+	h.conn_cnt = conn_cnt;
+	if (fwrite(&h, sizeof(h), 1, log_fp) != 1) {
+		perror("record_open: can't write log");
+		exit(1);
+	}
+}
+
+void record_close() {
+	log_lock.lock();
+	std::vector<record_buffer*> to_drain = buffers;
+	log_lock.unlock();
+	for (auto b : to_drain) {
+		b->flush();
+	}
+
+	log_lock.lock();
+	if (log_fp != NULL) {
+		fclose(log_fp);
+		log_fp = NULL;
+	}
+	log_lock.unlock();
+}
+
+record_buffer::record_buffer() {
+	records.reserve(record_buffer_cap);
+	last_flush_time = 0.0;
+	log_lock.lock();
+	buffers.push_back(this);
+	log_lock.unlock();
+}
+
+void record_buffer::add(double send_time, int conn_id, const request &r) {
+	request_record rec;
+	rec.time = (uint64_t) send_time;
+	rec.key_seed = r.key_seed;
+	rec.conn_op = ((uint32_t) conn_id << 1) | (uint32_t) r.cmd;
+	lock.lock();
+	records.push_back(rec);
+	if ((int) records.size() == record_buffer_cap || send_time - last_flush_time >= record_flush_interval) {
+		write_out();
+		last_flush_time = send_time;
+	}
+	lock.unlock();
+}
+
+void record_buffer::flush() {
+	lock.lock();
+	write_out();
+	lock.unlock();
+}
+
+// Called with lock held. Records are dropped once the log is closed.
+void record_buffer::write_out() {
+	log_lock.lock();
+	if (log_fp != NULL && fwrite(records.data(), sizeof(request_record), records.size(), log_fp) != records.size()) {
+		perror("record_buffer: can't write log");
+		exit(1);
+	}
+	log_lock.unlock();
+	records.clear();
+}
+
+void replay_load(const char *filename, int conn_cnt, std::vector<replay_stream> *streams) {
+
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		perror("replay_load: can't open log");
+		exit(1);
+	}
+
+	request_log_header h;
+	if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, request_log_magic, sizeof(h.magic)) != 0) {
+		fprintf(stderr, "replay_load: %s is not a request log\n", filename);
+		exit(1);
+	}
+	if ((int) h.conn_cnt != conn_cnt) {
+		fprintf(stderr, "replay_load: log has %u connections, but %d are configured\n", h.conn_cnt, conn_cnt);
+		exit(1);
+	}
+
+	streams->clear();
+	streams->resize(conn_cnt);
+	double first_time = std::numeric_limits<double>::infinity();
+	long long rec_cnt = 0;
+	request_record batch[4096];
+	while (true) {
+		size_t cnt = fread(batch, sizeof(request_record), 4096, fp);
+		for (size_t i = 0; i < cnt; i++) {
+			int conn_id = batch[i].conn_op >> 1;
+			if (conn_id >= conn_cnt) {
+				fprintf(stderr, "replay_load: bad connection id %d\n", conn_id);
+				exit(1);
+			}
+			(*streams)[conn_id].records.push_back(batch[i]);
+			if (batch[i].time < first_time) {
+				first_time = batch[i].time;
+			}
+		}
+		rec_cnt += cnt;
+		if (cnt < 4096) {
+			break;
+		}
+	}
+	fclose(fp);
+
+	for (auto &s : *streams) {
+		s.pos = 0;
+		s.first_time = first_time;
+	}
+
+	printf("replay log: %s, seed: %llu, records: %lld\n", filename, (unsigned long long) h.seed, rec_cnt);
+}
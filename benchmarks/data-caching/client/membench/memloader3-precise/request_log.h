@@ -0,0 +1,71 @@
+#ifndef REQUEST_LOG_H
+#define REQUEST_LOG_H
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include "memcached_cmd.h"
+
+// Binary log of issued requests (--record), which can be sent again (--replay).
+// A log is a request_log_header followed by request_records, 16 bytes each. Records of one
+// connection are in send order, records of different connections are interleaved.
+
+static const char request_log_magic[8] = {'M', 'L', 'R', 'E', 'C', 'O', 'R', 'D'};
+
+class request_log_header {
+public:
+	char magic[8];
+	uint64_t seed;
+	uint32_t conn_cnt;
+	uint32_t reserved;
+};
+
+class request_record {
+public:
+	uint64_t time; // send time in ns, only differences between records are meaningful
+	int32_t key_seed;
+	uint32_t conn_op; // conn id << 1 | memcmd_t
+};
+
+// Creates the log file. Will exit program if this is impossible.
+void record_open(const char *filename, uint64_t seed, int conn_cnt);
+
+// Drains every record_buffer into the log and stops recording. Requests sent after that are
+// not recorded, so every connection's log ends at about the same time.
+void record_close();
+
+// Collects the records of one send thread, and writes them to the log in batches. Buffers are
+// registered with the log for record_close, and must outlive it.
+class record_buffer {
+private:
+	std::mutex lock; // against record_close, only ever contended then
+	std::vector<request_record> records;
+	double last_flush_time;
+
+	void write_out();
+
+public:
+	record_buffer();
+	void add(double send_time, int conn_id, const request &r);
+	void flush();
+};
+
+// The recorded requests of one connection.
+class replay_stream {
+public:
+	std::vector<request_record> records;
+	int pos;
+	double first_time; // of the whole log, in ns
+
+public:
+	bool done() const { return pos == (int) records.size(); }
+	const request_record &next() const { return records[pos]; }
+	// Relative send time of the next record.
+	double next_time() const { return (double) records[pos].time - first_time; }
+};
+
+// Reads a log into one stream per connection. Will exit program if the log is unreadable or
+// was recorded with a different number of connections.
+void replay_load(const char *filename, int conn_cnt, std::vector<replay_stream> *streams);
+
+#endif
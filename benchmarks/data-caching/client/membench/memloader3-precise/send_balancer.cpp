@@ -0,0 +1,84 @@
+#include "send_balancer.h"
+
+#include <stddef.h>
+
+const double send_balancer::rebalance_interval = 1.0e7; // 10ms
+
+send_balancer::send_balancer(const std::vector<int> &thread_nodes, double threshold)
+: thread_cnt(thread_nodes.size()), threshold(threshold) {
+	slots = new slot[thread_cnt];
+	for (int t = 0; t < thread_cnt; t++) {
+		slot &s = slots[t];
+		s.node = thread_nodes[t];
+		s.lag.store(0.0, std::memory_order_relaxed);
+		s.ctx_cnt.store(0, std::memory_order_relaxed);
+		s.thief.store(-1, std::memory_order_relaxed);
+		s.handed_cnt.store(0, std::memory_order_relaxed);
+		s.asked = -1;
+		s.next_steal_point = 0.0;
+		s.next_give_point = 0.0;
+	}
+}
+
+bool send_balancer::giving(int t, int ctx_cnt, double now) {
+	slot &s = slots[t];
+	if (s.thief.load(std::memory_order_relaxed) < 0) {
+		return false;
+	}
+	if (ctx_cnt > 1 && now >= s.next_give_point) {
+		s.next_give_point = now + rebalance_interval;
+		return true;
+	}
+	s.thief.store(-1, std::memory_order_release); // turned down, the thief may ask again
+	return false;
+}
+
+void send_balancer::give(int t, void *cx) {
+	slot &s = slots[t];
+	slot &thief = slots[s.thief.load(std::memory_order_acquire)];
+	thief.handed_lock.lock();
+	thief.handed.push_back(cx);
+	thief.handed_cnt.fetch_add(1, std::memory_order_release);
+	thief.handed_lock.unlock();
+	s.thief.store(-1, std::memory_order_release);
+}
+
+void *send_balancer::take(int t, double lag, int ctx_cnt, double now) {
+	slot &s = slots[t];
+	s.lag.store(lag, std::memory_order_relaxed);
+	s.ctx_cnt.store(ctx_cnt, std::memory_order_relaxed);
+
+	if (s.asked >= 0 && slots[s.asked].thief.load(std::memory_order_acquire) != t) {
+		s.asked = -1; // answered, anything handed over is in s.handed by now
+	}
+	if (s.handed_cnt.load(std::memory_order_acquire) > 0) {
+		s.handed_lock.lock();
+		void *cx = s.handed.back();
+		s.handed.pop_back();
+		s.handed_cnt.fetch_sub(1, std::memory_order_relaxed);
+		s.handed_lock.unlock();
+		return cx;
+	}
+
+	if (s.asked >= 0 || lag > -threshold || now < s.next_steal_point) {
+		return NULL;
+	}
+	int victim = -1;
+	double victim_lag = threshold;
+	for (int v = 0; v < thread_cnt; v++) {
+		double v_lag = slots[v].lag.load(std::memory_order_relaxed);
+		if (v != t && slots[v].node == s.node && v_lag > victim_lag && slots[v].ctx_cnt.load(std::memory_order_relaxed) > 1) {
+			victim = v;
+			victim_lag = v_lag;
+		}
+	}
+	if (victim < 0) {
+		return NULL;
+	}
+	int no_thief = -1;
+	if (slots[victim].thief.compare_exchange_strong(no_thief, t, std::memory_order_relaxed)) {
+		s.asked = victim;
+		s.next_steal_point = now + rebalance_interval;
+	}
+	return NULL;
+}
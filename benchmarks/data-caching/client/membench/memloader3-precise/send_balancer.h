@@ -0,0 +1,73 @@
+#ifndef SEND_BALANCER_H
+#define SEND_BALANCER_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Work stealing between the send threads of a run (--rebalance). Connections are dealt to the
+// send threads round robin, so one thread can fall behind its schedule (its connections got the
+// heavy tenant, or it shares its core) while others spin, waiting for their next send time.
+//
+// Every send thread publishes, between two sends, how late the head of its queue is. A thread
+// that is ahead by more than the threshold asks the thread lagging the most (by more than the
+// threshold, and with more than one send context) for work. The victim hands over its most
+// overdue send context at its next safe point, between two sends, when no request of it is
+// half built or half sent, and the thief adds it to its own queue. A thread steals at most and
+// gives at most one context per rebalance_interval, so that a backlog has time to drain before
+// more contexts move.
+//
+// Only the sending side of a connection moves. Its socket stays with the recv thread it was
+// handed to when it was opened, and its outstanding requests stay in the queue (tcp) or
+// transaction table (udp) that send and recv sides already share under a lock, so no request
+// state changes hands: the mutex of the hand-over orders the victim's last send before the
+// thief's first one.
+//
+// With --numa, a thread only steals from threads of its own node: the connections and buffers
+// of a context live on the node of the thread it was dealt to.
+//
+// Send threads must not stop while others may still hand them contexts, so this can't be used
+// with --replay, whose threads stop once their connections are done. Contexts are opaque here,
+// the conn workers cast them back.
+
+class send_balancer {
+private:
+	static const double rebalance_interval; // ns
+
+	class slot {
+	public:
+		std::atomic<double> lag; // ns the queue head is late, negative when ahead
+		std::atomic<int> ctx_cnt;
+		std::atomic<int> thief; // thread that asked this one for a context, -1 for none
+		std::mutex handed_lock;
+		std::vector<void*> handed; // contexts handed to this thread, not yet taken
+		std::atomic<int> handed_cnt;
+		int node; // numa node of the thread, -1 if unknown
+		// owned by the thread of the slot
+		int asked; // thread this one is waiting on, -1 for none
+		double next_steal_point;
+		double next_give_point;
+		char pad[64]; // keeps the slots of two threads off one cache line
+	};
+
+	const int thread_cnt;
+	const double threshold; // ns
+	slot *slots;
+
+public:
+	// thread_nodes has the numa node of every send thread, or -1s without --numa.
+	send_balancer(const std::vector<int> &thread_nodes, double threshold);
+
+	// Called by send thread t between two sends, at time now. Returns true if a thread waits for
+	// a context of t and t can spare one (it has more than one), in which case t must pop one
+	// from its queue and pass it to give. Otherwise a waiting thread is turned down.
+	bool giving(int t, int ctx_cnt, double now);
+	void give(int t, void *cx);
+
+	// Called by send thread t between two sends, with the lag (now minus the target start point
+	// of its queue head) and the size of its queue. Returns a context handed to t, which t must
+	// adopt and queue, or NULL. Asks a lagging thread for one if t is ahead.
+	void *take(int t, double lag, int ctx_cnt, double now);
+};
+
+#endif
@@ -0,0 +1,372 @@
+#include "server_stats.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "config.h"
+#include "clock.h"
+#include "util.h"
+
+static const double poll_timeout = 1.0; // seconds to wait for the replies of all servers, at most
+static const char *stats_cmds = "stats\r\nstats slabs\r\nstats items\r\n";
+static const int stats_cmd_cnt = 3;
+// put in front of the names of each reply ("stats items" names already start with "items:")
+static const char *stats_prefixes[stats_cmd_cnt] = {"", "slabs:", ""};
+
+typedef std::map<std::string, double> stats_map;
+
+class server_stats_conn {
+public:
+	int sid;
+	server_addr saddr;
+	int sock; // -1 after a failure, connected again at the next poll
+	bool have_olds;
+	stats_map olds;
+	double old_tv;
+
+	// replies of the poll in progress
+	std::string pending;
+	int group; // reply groups complete, stats_cmd_cnt once all are in
+	stats_map news;
+	double new_tv;
+};
+
+static std::vector<server_stats_conn> conns; // of the poller thread
+
+static std::thread poller;
+static std::mutex poll_lock;
+static std::condition_variable poll_cond;
+// under poll_lock
+static bool poll_wanted = false;
+static bool poll_busy = false;
+static bool poll_closing = false;
+static bool wanted_report;
+static double wanted_run_time;
+static double wanted_budget;
+static std::string log_lines;
+
+static int connect_stats_sock(const server_addr &saddr) {
+	sockaddr sa;
+	get_sockaddr(&sa, saddr.hostname, saddr.port, SOCK_STREAM);
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	// the connect only holds up the poller thread, and not for longer than a poll may take
+	timeval tv;
+	tv.tv_sec = (int) poll_timeout;
+	tv.tv_usec = (int) ((poll_timeout - tv.tv_sec) * 1.0e6);
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (connect(sock, &sa, sizeof(sa)) < 0) {
+		close(sock);
+		return -1;
+	}
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+	return sock;
+}
+
+// Collects the numeric statistics of the complete reply lines received so far. An error
+// reply ends a group like END does, for servers without slab or item statistics.
+static void parse_replies(server_stats_conn *c) {
+	size_t nl;
+	while (c->group < stats_cmd_cnt && (nl = c->pending.find('\n')) != std::string::npos) {
+		std::string line = c->pending.substr(0, nl);
+		c->pending.erase(0, nl + 1);
+		if (!line.empty() && line[line.size() - 1] == '\r') {
+			line.erase(line.size() - 1);
+		}
+		if (line.compare(0, 5, "STAT ") != 0) {
+			c->group++;
+			continue;
+		}
+		size_t sp = line.find(' ', 5);
+		if (sp == std::string::npos) {
+			continue;
+		}
+		const char *val = line.c_str() + sp + 1;
+		char *val_end;
+		double v = strtod(val, &val_end);
+		if (val_end != val && *val_end == '\0') { // skips version strings and the like
+			c->news[stats_prefixes[c->group] + line.substr(5, sp - 5)] = v;
+		}
+	}
+}
+
+// Reads what has arrived. Returns false if the connection failed.
+static bool receive_replies(server_stats_conn *c) {
+	char buf[4096];
+	while (true) {
+		int res = recv(c->sock, buf, sizeof(buf), 0);
+		if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if (res <= 0) {
+			return false;
+		}
+		c->pending.append(buf, res);
+		parse_replies(c);
+		if (c->group == stats_cmd_cnt) {
+			c->new_tv = clock_mono_nsec();
+			return true;
+		}
+	}
+}
+
+// Sends the stats commands to every server at once, and waits for the replies until budget
+// seconds have passed. Servers that didn't answer in time are left with group < stats_cmd_cnt.
+static void poll_servers(double budget) {
+	double deadline = clock_mono_nsec() + budget * 1.0e9;
+	int len = strlen(stats_cmds);
+	std::vector<server_stats_conn*> waiting;
+	for (auto &c : conns) {
+		c.pending.clear();
+		c.news.clear();
+		c.group = 0;
+		if (c.sock < 0) {
+			c.sock = connect_stats_sock(c.saddr);
+		}
+		if (c.sock >= 0 && send(c.sock, stats_cmds, len, MSG_NOSIGNAL) == len) {
+			waiting.push_back(&c);
+		}
+	}
+	std::vector<pollfd> pfds;
+	while (!waiting.empty()) {
+		int wait_ms = (int) ((deadline - clock_mono_nsec()) / 1.0e6);
+		if (wait_ms <= 0) {
+			break;
+		}
+		pfds.resize(waiting.size());
+		for (int i = 0; i < (int) waiting.size(); i++) {
+			pfds[i].fd = waiting[i]->sock;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		if (poll(pfds.data(), pfds.size(), wait_ms) < 0 && errno != EINTR) {
+			perror("server_stats: can't poll");
+			exit(1);
+		}
+		for (int i = (int) waiting.size() - 1; i >= 0; i--) {
+			if (pfds[i].revents == 0) {
+				continue;
+			}
+			if (!receive_replies(waiting[i]) || waiting[i]->group == stats_cmd_cnt) {
+				waiting.erase(waiting.begin() + i);
+			}
+		}
+	}
+}
+
+static bool gauge(const stats_map &m, const std::string &name, double *v) {
+	auto it = m.find(name);
+	if (it == m.end()) {
+		return false;
+	}
+	*v = it->second;
+	return true;
+}
+
+static bool delta(const stats_map &news, const stats_map &olds, const std::string &name, double *d) {
+	double n, o;
+	if (!gauge(news, name, &n) || !gauge(olds, name, &o)) {
+		return false;
+	}
+	*d = n - o;
+	return true;
+}
+
+// Appends " <name> <value>", or " <name> -" if the server doesn't have the statistic.
+static void put_field(std::string *line, const char *name, bool have, const char *fmt, double v) {
+	char buf[64];
+	*line += ' ';
+	*line += name;
+	if (!have) {
+		*line += " -";
+		return;
+	}
+	*line += ' ';
+	snprintf(buf, sizeof(buf), fmt, v);
+	*line += buf;
+}
+
+// Evictions and out of memory errors summed over the slab classes of "stats items", and the
+// class with the most evictions. Returns false without item statistics.
+static bool slab_class_deltas(const stats_map &news, const stats_map &olds, double *oom, std::string *top_class) {
+	const std::string evicted = ":evicted";
+	bool have = false;
+	double top = 0.0;
+	*oom = 0.0;
+	*top_class = "-";
+	for (auto it = news.lower_bound("items:"); it != news.end() && it->first.compare(0, 6, "items:") == 0; it++) {
+		const std::string &name = it->first;
+		double d;
+		if (name.size() > evicted.size() && name.compare(name.size() - evicted.size(), evicted.size(), evicted) == 0
+			&& delta(news, olds, name, &d)) {
+			have = true;
+			if (d > top) {
+				top = d;
+				std::string cls = name.substr(6, name.size() - 6 - evicted.size());
+				double chunk_size;
+				char buf[64];
+				if (gauge(news, "slabs:" + cls + ":chunk_size", &chunk_size)) {
+					snprintf(buf, sizeof(buf), "%s/%.0fB:%.0f", cls.c_str(), chunk_size, d);
+				} else {
+					snprintf(buf, sizeof(buf), "%s:%.0f", cls.c_str(), d);
+				}
+				*top_class = buf;
+			}
+		} else if (name.size() > 12 && name.compare(name.size() - 12, 12, ":outofmemory") == 0 && delta(news, olds, name, &d)) {
+			*oom += d;
+		}
+	}
+	return have;
+}
+
+static std::string report_line(const server_stats_conn &c, const stats_map &news, double t, double run_time) {
+	const stats_map &olds = c.olds;
+	char head[64];
+	snprintf(head, sizeof(head), "SS: server %d time %.1f", c.sid, run_time);
+	std::string line = head;
+	double d = 0.0, d2 = 0.0, v = 0.0, v2 = 0.0;
+
+	bool have = delta(news, olds, "evictions", &d);
+	put_field(&line, "evictions", have, "%.0f", d);
+	put_field(&line, "evict_rate", have, "%.0f", d / t);
+	double oom;
+	std::string top_class;
+	have = slab_class_deltas(news, olds, &oom, &top_class);
+	line += " top_evict_class " + top_class;
+	put_field(&line, "oom", have, "%.0f", oom);
+
+	have = delta(news, olds, "get_hits", &d) && delta(news, olds, "get_misses", &d2) && d + d2 > 0.0;
+	put_field(&line, "hit_ratio", have, "%.3f", d / (d + d2));
+	have = delta(news, olds, "cmd_get", &d) && delta(news, olds, "cmd_set", &d2);
+	put_field(&line, "cmd_rate", have, "%.0f", (d + d2) / t);
+
+	have = gauge(news, "curr_connections", &v);
+	put_field(&line, "conns", have, "%.0f", v);
+	have = delta(news, olds, "total_connections", &d);
+	put_field(&line, "conn_rate", have, "%.1f", d / t);
+	have = delta(news, olds, "conn_yields", &d);
+	put_field(&line, "conn_yields", have, "%.0f", d);
+
+	have = delta(news, olds, "rusage_user", &d) && delta(news, olds, "rusage_system", &d2);
+	put_field(&line, "cpu", have, "%.2f", (d + d2) / t);
+	have = have && gauge(news, "threads", &v) && v > 0.0;
+	put_field(&line, "cpu_per_thread", have, "%.2f", (d + d2) / t / v);
+
+	have = gauge(news, "bytes", &v) && gauge(news, "limit_maxbytes", &v2) && v2 > 0.0;
+	put_field(&line, "mem_used", have, "%.3f", v / v2);
+	return line + "\n";
+}
+
+// Polls every server, and returns the "SS:" lines if report.
+static std::string poll_all(bool report, double run_time, double budget) {
+	poll_servers(budget);
+	std::string lines;
+	for (auto &c : conns) {
+		if (c.group != stats_cmd_cnt) {
+			if (report) {
+				char buf[64];
+				snprintf(buf, sizeof(buf), "SS: server %d time %.1f no reply\n", c.sid, run_time);
+				lines += buf;
+			}
+			if (c.sock >= 0) {
+				close(c.sock); // the rest of the replies may still come, start over
+				c.sock = -1;
+			}
+			c.have_olds = false;
+			continue;
+		}
+		if (report && c.have_olds) {
+			lines += report_line(c, c.news, (c.new_tv - c.old_tv) / 1.0e9, run_time);
+		}
+		c.olds.swap(c.news);
+		c.old_tv = c.new_tv;
+		c.have_olds = true;
+	}
+	return lines;
+}
+
+static void poller_run() {
+	std::unique_lock<std::mutex> lock(poll_lock);
+	while (true) {
+		poll_cond.wait(lock, [] { return poll_wanted || poll_closing; });
+		if (!poll_wanted) {
+			break;
+		}
+		poll_wanted = false;
+		poll_busy = true;
+		bool report = wanted_report;
+		double run_time = wanted_run_time;
+		double budget = wanted_budget;
+		lock.unlock();
+		std::string lines = poll_all(report, run_time, budget);
+		// waits for the report of the interval to be printed
+		flockfile(stdout);
+		fputs(lines.c_str(), stdout);
+		fflush(stdout);
+		funlockfile(stdout);
+		lock.lock();
+		log_lines += lines;
+		poll_busy = false;
+		poll_cond.notify_all();
+	}
+}
+
+void server_stats_open() {
+	for (int sid = 0; sid < (int) conf.servers.size(); sid++) {
+		server_stats_conn c;
+		c.sid = sid;
+		c.saddr = conf.servers[sid].addrs.front();
+		c.sock = connect_stats_sock(c.saddr);
+		if (c.sock < 0) {
+			fprintf(stderr, "server_stats: can't connect to %s:%s\n", c.saddr.hostname, c.saddr.port);
+			exit(1);
+		}
+		c.have_olds = false;
+		c.old_tv = 0.0;
+		conns.push_back(c);
+	}
+	poller = std::thread(poller_run);
+}
+
+void server_stats_tick(bool report, double run_time, double budget) {
+	std::lock_guard<std::mutex> lock(poll_lock);
+	if (poll_busy) {
+		return; // still on the previous tick, the next poll covers both intervals
+	}
+	poll_wanted = true;
+	wanted_report = report;
+	wanted_run_time = run_time;
+	wanted_budget = std::min(budget, poll_timeout);
+	poll_cond.notify_all();
+}
+
+void server_stats_close() {
+	std::unique_lock<std::mutex> lock(poll_lock);
+	poll_cond.wait(lock, [] { return !poll_wanted && !poll_busy; });
+	poll_closing = true;
+	poll_cond.notify_all();
+	lock.unlock();
+	poller.join();
+}
+
+const std::string &server_stats_log() {
+	return log_lines;
+}
@@ -0,0 +1,42 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <string>
+
+// Server side view of a run (--server-stats): one extra TCP connection per server, on its first
+// address, sends "stats", "stats slabs" and "stats items" at every round interval, right after
+// memloader's own counters are sampled. A poller thread of its own sends to all servers at once
+// and waits for the replies, so slow servers hold up neither the report intervals nor each
+// other. The differences between two polls give an "SS:" line per server, printed by the poller
+// once the poll is complete, after the report of the same interval (which holds the stdout lock
+// while it prints):
+//   evictions, evict_rate      evictions in the interval, and per second
+//   top_evict_class            slab class (chunk size) with the most evictions, "-" for none
+//   oom                        "outofmemory" errors of the slab classes
+//   hit_ratio, cmd_rate        GET hit ratio and GETs + SETs per second seen by the server
+//   conns, conn_rate           open connections, and connections accepted per second
+//   conn_yields                requests put back because a worker thread was busy
+//   cpu, cpu_per_thread        cores used by the server process, and per worker thread
+//   mem_used                   bytes / limit_maxbytes
+// Statistics a server doesn't report are printed as "-". The lines are also kept in a log
+// that dump_histograms stores in the histogram file (see histogram_file.h).
+
+// Connects to every server of conf.servers and starts the poller thread. Will exit program if
+// a server is unreachable.
+void server_stats_open();
+
+// Called at every report, right after memloader's counters are sampled: has every server polled,
+// giving up on replies after budget seconds (1s at most).
+// With report, the poll makes one "SS:" line per server covering the time since the previous
+// poll; otherwise it is only the baseline of the next one. run_time is the time since the start
+// of the run in seconds, written on the lines. A tick coming while the previous poll is still
+// running is skipped.
+void server_stats_tick(bool report, double run_time, double budget);
+
+// Waits for the poll in progress and stops the poller thread.
+void server_stats_close();
+
+// All "SS:" lines so far, once server_stats_close has returned.
+const std::string &server_stats_log();
+
+#endif
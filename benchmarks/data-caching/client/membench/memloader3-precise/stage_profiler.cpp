@@ -0,0 +1,119 @@
+#include "stage_profiler.h"
+
+#include <stdio.h>
+#include <mutex>
+#include <list>
+#include "config.h"
+
+__thread thread_profile *cur_thread_profile = NULL;
+
+static std::mutex profiles_lock;
+static std::list<thread_profile*> profiles; // never shrinks, so snapshot indexes stay stable
+
+static const char *stage_names[ps_end] = {
+	"make_request",
+	"fill_send_buf",
+	"pacing",
+	"send",
+	"recv",
+	"parse",
+	"match",
+	"count"
+};
+
+void prof_register_thread(const char *name) {
+	thread_profile *p = new thread_profile();
+	for (int s = 0; s < ps_end; s++) {
+		p->cycles[s] = 0;
+		p->calls[s] = 0;
+	}
+	profiles_lock.lock();
+	char buf[64];
+	sprintf(buf, "%s%lu", name, profiles.size());
+	p->name = buf;
+	profiles.push_back(p);
+	profiles_lock.unlock();
+	cur_thread_profile = p;
+}
+
+void prof_snapshot(profile_snapshot *snap) {
+	snap->names.clear();
+	snap->cycles.clear();
+	snap->calls.clear();
+	profiles_lock.lock();
+	for (auto p : profiles) {
+		snap->names.push_back(p->name);
+		for (int s = 0; s < ps_end; s++) {
+			snap->cycles.push_back(p->cycles[s].load(std::memory_order_relaxed));
+			snap->calls.push_back(p->calls[s].load(std::memory_order_relaxed));
+		}
+	}
+	profiles_lock.unlock();
+	snap->tsc = rdtsc();
+}
+
+// Threads may register between two snapshots, they count from 0 then.
+static uint64_t snap_delta(const std::vector<uint64_t> &olds, const std::vector<uint64_t> &news, int idx) {
+	return news[idx] - (idx < (int) olds.size() ? olds[idx] : 0);
+}
+
+void prof_report(const profile_snapshot &old_snap, const profile_snapshot &new_snap, double nsec_duration, double replied, double avg_latency) {
+
+	if (replied <= 0.0) {
+		printf("P: no replies, no breakdown\n");
+		return;
+	}
+	double t = nsec_duration / 1.0e9;
+	double interval_cycles = new_snap.tsc - old_snap.tsc;
+	double cycles_per_ns = interval_cycles / nsec_duration;
+	int thread_cnt = new_snap.names.size();
+
+	double stage_cycles[ps_end], stage_calls[ps_end];
+	double total_cycles = 0.0;
+	for (int s = 0; s < ps_end; s++) {
+		stage_cycles[s] = 0.0;
+		stage_calls[s] = 0.0;
+		for (int th = 0; th < thread_cnt; th++) {
+			stage_cycles[s] += snap_delta(old_snap.cycles, new_snap.cycles, th * ps_end + s);
+			stage_calls[s] += snap_delta(old_snap.calls, new_snap.calls, th * ps_end + s);
+		}
+		total_cycles += stage_cycles[s];
+	}
+
+	printf("P: %-14s %10s %12s %10s %7s\n", "stage", "calls/s", "cycles/call", "ns/reply", "share");
+	for (int s = 0; s < ps_end; s++) {
+		printf("P: %-14s %10.0f %12.1f %10.1f %6.1f%%\n",
+			stage_names[s],
+			stage_calls[s] / t,
+			stage_calls[s] > 0.0 ? stage_cycles[s] / stage_calls[s] : 0.0,
+			stage_cycles[s] / cycles_per_ns / replied,
+			stage_cycles[s] / total_cycles * 100.0);
+	}
+
+	// pacing is waiting on purpose, everything else is work the client does per request; the
+	// sum is over all threads, which work in parallel, hence per thread
+	double overhead = (total_cycles - stage_cycles[ps_pacing]) / cycles_per_ns / replied / thread_cnt / 1.0e6; // in ms
+	double overhead_ratio = overhead / avg_latency;
+
+	const char *busiest = "none";
+	double busiest_util = 0.0;
+	for (int th = 0; th < thread_cnt; th++) {
+		double busy = 0.0;
+		for (int s = 0; s < ps_end; s++) {
+			if (s != ps_pacing) {
+				busy += snap_delta(old_snap.cycles, new_snap.cycles, th * ps_end + s);
+			}
+		}
+		if (busy / interval_cycles > busiest_util) {
+			busiest_util = busy / interval_cycles;
+			busiest = new_snap.names[th].c_str();
+		}
+	}
+
+	printf("P: cpu %.3fus/reply/thread (%.1f%% of avg_lat %.3fms, %d threads) busiest %s %.1f%%\n",
+		overhead * 1.0e3, overhead_ratio * 100.0, avg_latency, thread_cnt, busiest, busiest_util * 100.0);
+	if (overhead_ratio > conf.profile_warn) {
+		printf("P: WARNING: client cpu time per reply and thread is %.1f%% of the measured latency (threshold %.1f%%), latencies may be inflated by memloader itself\n",
+			overhead_ratio * 100.0, conf.profile_warn * 100.0);
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "util.h"
+
+// Per-stage rdtsc cycle counts of the send/recv hot path, kept per worker thread when
+// conf.profile is set. A thread that has not called prof_register_thread pays one
+// thread-local load and a branch per stage.
+
+enum prof_stage {
+	ps_make_request,
+	ps_fill_send_buf,
+	ps_pacing, // spinning until the target send time, not client overhead
+	ps_send,
+	ps_recv,
+	ps_parse,
+	ps_match,
+	ps_count,
+	ps_end
+};
+
+class thread_profile {
+public:
+	std::string name;
+	// Only written by the owning thread, so plain load/store pairs are enough.
+	std::atomic<uint64_t> cycles[ps_end];
+	std::atomic<uint64_t> calls[ps_end];
+};
+
+extern __thread thread_profile *cur_thread_profile;
+
+// Starts profiling the calling thread, name is e.g. "send" or "recv".
+void prof_register_thread(const char *name);
+
+static inline uint64_t prof_begin() {
+	return cur_thread_profile != NULL ? rdtsc() : 0;
+}
+
+// Charges the cycles since begin to stage, returns the time to charge the next stage from.
+static inline uint64_t prof_next(prof_stage stage, uint64_t begin) {
+	thread_profile *p = cur_thread_profile;
+	if (p == NULL) {
+		return 0;
+	}
+	uint64_t now = rdtsc();
+	p->cycles[stage].store(p->cycles[stage].load(std::memory_order_relaxed) + (now - begin), std::memory_order_relaxed);
+	p->calls[stage].store(p->calls[stage].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return now;
+}
+
+class profile_snapshot {
+public:
+	uint64_t tsc;
+	std::vector<std::string> names;
+	std::vector<uint64_t> cycles; // [thread * ps_end + stage]
+	std::vector<uint64_t> calls;
+};
+
+void prof_snapshot(profile_snapshot *snap);
+
+// Prints a breakdown of the cycles between two snapshots ("P:" lines), and a warning if the
+// client cpu time per replied request and thread exceeds conf.profile_warn of the average
+// latency (in ms). Prints only a note if nothing was replied.
+void prof_report(const profile_snapshot &old_snap, const profile_snapshot &new_snap, double nsec_duration, double replied, double avg_latency);
+
+#endif
@@ -0,0 +1,109 @@
+#include "steady_state.h"
+
+#include <math.h>
+#include <algorithm>
+
+// Two-sided 95% quantiles of Student's t for 1..30 degrees of freedom.
+static const double t95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double t95_quantile(int df) {
+	if (df <= (int) (sizeof(t95) / sizeof(t95[0]))) {
+		return t95[df - 1];
+	}
+	return 1.96;
+}
+
+// (max - min) of the last n values, divided by their mean if relative.
+static double tail_spread(const std::vector<double> &vals, int n, bool relative) {
+	double lo = INFINITY, hi = -INFINITY, sum = 0.0;
+	int cnt = 0;
+	for (int i = (int) vals.size() - n; i < (int) vals.size(); i++) {
+		if (isnan(vals[i])) {
+			continue;
+		}
+		lo = std::min(lo, vals[i]);
+		hi = std::max(hi, vals[i]);
+		sum += vals[i];
+		cnt++;
+	}
+	if (cnt == 0) {
+		return 0.0;
+	}
+	if (!relative) {
+		return hi - lo;
+	}
+	double mean = sum / cnt;
+	return mean > 0.0 ? (hi - lo) / mean : 0.0;
+}
+
+steady_state_detector::steady_state_detector(int window, double tolerance, double p99_ci) :
+window(window), tolerance(tolerance), p99_ci(p99_ci) {
+	warmup_cnt = -1;
+	dropped_cnt = 0;
+}
+
+bool steady_state_detector::add_interval(double reply_rate, double hit_ratio, double avg_latency, double p99) {
+	if (reply_rate <= 0.0) {
+		if (!steady()) {
+			dropped_cnt += reply_rates.size() + 1;
+			reply_rates.clear();
+			hit_ratios.clear();
+			avg_latencies.clear();
+		}
+		return false;
+	}
+	if (steady()) {
+		batch_p99s.push_back(p99);
+		return false;
+	}
+	reply_rates.push_back(reply_rate);
+	hit_ratios.push_back(hit_ratio);
+	avg_latencies.push_back(avg_latency);
+	double s = spread();
+	if (s < 0.0 || s > 1.0) {
+		return false;
+	}
+	warmup_cnt = reply_rates.size() + dropped_cnt;
+	return true;
+}
+
+double steady_state_detector::spread() const {
+	if ((int) reply_rates.size() < window) {
+		return -1.0;
+	}
+	double s = tail_spread(reply_rates, window, true);
+	s = std::max(s, tail_spread(avg_latencies, window, true));
+	s = std::max(s, tail_spread(hit_ratios, window, false));
+	return s / tolerance;
+}
+
+void steady_state_detector::p99_estimate(double *mean, double *half_width) const {
+	int n = batch_p99s.size();
+	double sum = 0.0;
+	for (double p : batch_p99s) {
+		sum += p;
+	}
+	*mean = n > 0 ? sum / n : 0.0;
+	if (n < 2) {
+		*half_width = INFINITY;
+		return;
+	}
+	double sq = 0.0;
+	for (double p : batch_p99s) {
+		sq += (p - *mean) * (p - *mean);
+	}
+	*half_width = t95_quantile(n - 1) * sqrt(sq / (n - 1) / n);
+}
+
+bool steady_state_detector::confident() const {
+	if (batch_cnt() < std::max(window, 2)) {
+		return false;
+	}
+	double mean, half_width;
+	p99_estimate(&mean, &half_width);
+	return mean > 0.0 && half_width <= p99_ci * mean;
+}
@@ -0,0 +1,48 @@
+#ifndef STEADY_STATE_H
+#define STEADY_STATE_H
+
+#include <vector>
+
+// Online detection of the end of warm-up (--steady-state). Every reporting interval of a round
+// adds its reply rate, hit ratio, average latency and p99. Warm-up is over once the last
+// <window> intervals agree within <tolerance>: reply rate and average latency relative to their
+// mean, hit ratio as an absolute difference. From then on each interval is one batch of a
+// batch-means estimate of p99, and the round is done once the 95% confidence interval of that
+// estimate is within <p99_ci> of it.
+
+class steady_state_detector {
+private:
+	const int window;
+	const double tolerance;
+	const double p99_ci;
+
+	std::vector<double> reply_rates;
+	std::vector<double> hit_ratios;
+	std::vector<double> avg_latencies;
+	int warmup_cnt; // intervals of warm-up, -1 while still warming up
+	int dropped_cnt; // warm-up intervals no longer in the window, up to the last stall
+	std::vector<double> batch_p99s; // p99 of every interval since warm-up, in ms
+
+public:
+	steady_state_detector(int window, double tolerance, double p99_ci);
+
+	// Adds an interval, returns true if it is the one that ends warm-up. hit_ratio is NaN
+	// if there were no GETs. An interval without replies (a stalled or unreachable server) looks
+	// perfectly stable, so it starts the warm-up window over, and after warm-up it is no batch.
+	bool add_interval(double reply_rate, double hit_ratio, double avg_latency, double p99);
+
+	bool steady() const { return warmup_cnt >= 0; }
+	int warmup_intervals() const { return warmup_cnt; }
+	int batch_cnt() const { return batch_p99s.size(); }
+
+	// Largest spread of the metrics over the last window intervals, relative to the tolerance
+	// (stable when <= 1), or -1 if there are fewer intervals than the window.
+	double spread() const;
+	// Mean of the batch p99s and the half width of its 95% confidence interval, in ms.
+	void p99_estimate(double *mean, double *half_width) const;
+	// True once there are enough batches and the confidence interval is narrow enough (never
+	// for a p99 estimate of 0).
+	bool confident() const;
+};
+
+#endif
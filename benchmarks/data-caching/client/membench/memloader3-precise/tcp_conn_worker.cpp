@@ -19,6 +19,12 @@
 #include "tcp_response_receiver.h"
 #include "randnum.h"
 #include "clock.h"
+#include "epoll_recv_loop.h"
+#include "tls_transport.h"
+#include "timestamping.h"
+#include "stage_profiler.h"
+#include "request_log.h"
+#include "tcp_request_queue.h"
 
 static int open_stream_sock(int work_id, const server_addr &saddr) {
 
@@ -50,57 +56,208 @@ static int open_stream_sock(int work_id, const server_addr &saddr) {
 			exit(1);
 		}
 	}
+	if (conf.busy_poll > 0) {
+		set_busy_poll(sock, conf.busy_poll, conf.prefer_busy_poll, conf.busy_poll_budget);
+	}
+	if (conf.timestamping != tst_off) {
+		enable_timestamping(sock);
+	}
 	return sock;
 }
 
-class tcp_request_queue {
-private:
-	std::mutex lock;
-	std::list<request> queue;
+// One TCP connection of a vclient. The send context uses it until it shuts down the
+// sending side (see tcp_send_context::reconnect), the recv context frees it once the
+// server has closed its side too.
+class tcp_connection {
+public:
+	int sock;
+	tls_conn *tls; // NULL for plain tcp
+	tcp_request_queue outstandings;
+	std::atomic<bool> send_shut_down; // set by the send context once it no longer uses the connection
+};
 
+class tcp_recv_params {
 public:
-	bool empty() {
-		lock.lock();
-		bool res = queue.empty();
-		lock.unlock();
-		return res;
-	}
+	conn_work *work;
+	tcp_connection *conn;
+public:
+	tcp_recv_params() {}
+	tcp_recv_params(conn_work *work, tcp_connection *conn)
+	: work(work), conn(conn) {}
+};
 
-	request &front() {
-		lock.lock();
-		request &res = queue.front();
-		lock.unlock();
-		return res;
-	}
+// Spaces out the connection setups of one send thread. A rate of 0.0 means unlimited.
+class connect_limiter {
+private:
+	double interval;
+	double next_point;
 
-	void pop_front() {
-		lock.lock();
-		queue.pop_front();
-		lock.unlock();
+public:
+	connect_limiter(double rate) {
+		interval = rate > 0.0 ? 1.0e9 / rate : 0.0;
+		next_point = 0.0;
 	}
 
-	void push_back(request &r) {
-		lock.lock();
-		queue.push_back(r);
-		lock.unlock();
+	bool try_acquire(double now) {
+		if (now < next_point) {
+			return false;
+		}
+		next_point = now + interval;
+		return true;
 	}
 };
 
-class tcp_recv_params {
-public:
+enum recv_state_t {
+	rst_running,
+	rst_read_pause
+};
+
+static void tcp_recv_callback(evutil_socket_t sock, short what, void *arg);
+
+class tcp_recv_context {
+private:
 	conn_work *work;
-	int sock;
+	tcp_connection *conn;
+	tcp_response_receiver receiver;
 	tcp_request_queue *outstandings;
+	recv_state_t recv_state;
+	event *readable;
+
 public:
-	tcp_recv_params() {}
-	tcp_recv_params(conn_work *work, int sock, tcp_request_queue *outstandings)
-	: work(work), sock(sock), outstandings(outstandings) {}
+	bool backlogged; // for epoll_recv_loop
+
+public:
+	tcp_recv_context(const tcp_recv_params &params)
+	: receiver(params.work->numa_node) {
+		work = params.work;
+		conn = params.conn;
+		receiver.sock = conn->sock;
+		receiver.tls = conn->tls;
+		outstandings = &conn->outstandings;
+		recv_state = rst_running;
+		readable = NULL;
+		backlogged = false;
+	}
+
+	void watch(event_base *base) {
+		readable = event_new(base, receiver.sock, EV_READ|EV_PERSIST, tcp_recv_callback, this); assert(readable != NULL);
+		event_add(readable, NULL);
+	}
+
+	void watch(int epfd) {
+		epoll_watch(epfd, receiver.sock, this);
+	}
+
+	void drive_state_machine() {
+		switch(recv_state) {
+		case rst_running:
+		case rst_read_pause:
+			if (!try_receive()) {
+				recv_state = rst_read_pause;
+				break;
+			}
+			recv_state = rst_running;
+			break;
+		default:
+			assert(false);
+		}
+	}
+
+	void continue_receive() {
+		for (int i = 0; i < conf.receive_burst; i++) {
+			drive_state_machine();
+			if (receiver.peer_closed()) {
+				close();
+				return;
+			}
+			if (recv_state != rst_running) {
+				break;
+			}
+		}
+		if (receiver.has_pending()) {
+			// decrypted data is left in the tls layer, the socket may never become readable for it
+			event_active(readable, EV_READ, 0);
+		}
+	}
+
+	// Receives until the socket would block (returns true) or budget runs out (returns false).
+	// The context is gone once this returns true after the server closed the connection.
+	bool drain(int budget) {
+		for (int i = 0; i < budget; i++) {
+			try_receive();
+			if (receiver.peer_closed()) {
+				close();
+				return true;
+			}
+			if (receiver.would_block()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	// Called when the server has closed the connection. That is expected after the send context
+	// shut down its side, requests the server never answered are then counted as lost. Before
+	// that, the send context still uses the connection, and a server closing it (restart, idle
+	// timeout, connection limit) ends the run like any other socket error.
+	void close() {
+		if (!conn->send_shut_down.load(std::memory_order_acquire)) {
+			fprintf(stderr, "tcp_recv_context: connection %d closed by the server\n", work->id);
+			exit(1);
+		}
+		if (readable != NULL) {
+			event_free(readable); // closing the socket removes it from epoll
+		}
+		work->count_lost(outstandings->size());
+		if (conn->tls != NULL) {
+			tls_free(conn->tls);
+		}
+		::close(conn->sock);
+		delete conn;
+		delete this;
+	}
+
+	bool try_receive() {
+		const auto& resp_vec = receiver.try_receive();
+		if (conn->tls != NULL) {
+			work->count_tls_recv(receiver.take_crypto_time());
+		}
+		if (resp_vec.empty()) {
+			return false;
+		}
+		for (const auto& resp: resp_vec) {
+			while (outstandings->empty()) {
+				; // response arrives before request is enqueued
+			}
+			const request &r = outstandings->front();
+			uint64_t prof_point = prof_begin();
+			if (!request_response_match(r, resp)) {
+				exit(1);
+			}
+			prof_point = prof_next(ps_match, prof_point);
+			work->count_replied(r, resp);
+			wire_stamp tx_stamp;
+			if (conf.timestamping != tst_off && receiver.tx_stamp(r.tx_key, &tx_stamp)) {
+				work->count_wire(r, resp, tx_stamp);
+			}
+			prof_next(ps_count, prof_point);
+			outstandings->pop_front();
+		}
+		return true;
+	}
 };
 
+static void tcp_recv_callback(evutil_socket_t sock, short what, void *arg) {
+	tcp_recv_context *ct = (tcp_recv_context*) arg;
+	ct->continue_receive();
+}
+
 class tcp_send_context {
 private:
 	conn_work *const work;
 	const int signal_fd;
+	const int epoll_fd;
 	double min_send_rate;
 	double max_send_rate;
 	double cur_send_rate;
@@ -110,21 +267,80 @@ private:
 	double ramp_start_point;
 	bool connected;
 	tcp_request_sender sender;
-	tcp_request_queue outstandings;
+	tcp_connection *conn;
+	int conn_request_cnt; // requests sent on conn
+	double conn_open_point;
+	connect_limiter *limiter; // for reconnects, of the send thread
+	tls_client *tls; // NULL for plain tcp
+	rand_engine_t rg; // seeded per connection, so the request stream doesn't depend on threads
+	record_buffer *recorder; // of the send thread, NULL unless recording
 
 private:
+	// Send time of the next recorded request, 0.0 (now) if replaying as fast as possible.
+	double replay_target_point() const {
+		if (conf.replay_speed <= 0.0) {
+			return 0.0;
+		}
+		return control.replay_base + work->replay->next_time() / conf.replay_speed;
+	}
+
 	void connect() {
-		sender.sock = open_stream_sock(work->id, work->saddr);
+		conn = new tcp_connection();
+		conn->send_shut_down.store(false, std::memory_order_relaxed);
+		double start_point = clock_mono_nsec();
+		conn->sock = open_stream_sock(work->id, work->saddr);
+		conn_open_point = clock_mono_nsec();
+		conn_request_cnt = 0;
+		work->count_connect(start_point, conn_open_point);
+		conn->tls = NULL;
+		if (tls != NULL) {
+			bool resumed;
+			conn->tls = tls_connect(tls, conn->sock, &resumed);
+			double handshake_point = clock_mono_nsec();
+			work->count_tls_handshake(conn_open_point, handshake_point, resumed);
+			conn_open_point = handshake_point;
+		}
+		sender.sock = conn->sock;
+		sender.tls = conn->tls;
+		sender.sent_bytes = 0;
 		work->client_port = get_socket_port(sender.sock);
 		get_socket_ip(sender.sock, work->client_ip, IP_BUF_SZ);
-		tcp_recv_params recv_params(work, sender.sock, &outstandings);
+		tcp_recv_params recv_params(work, conn);
+		if (epoll_fd >= 0) {
+			(new tcp_recv_context(recv_params))->watch(epoll_fd);
+			return;
+		}
 		int recv_param_sz = sizeof(recv_params);
 		assert(write(signal_fd, &recv_params, recv_param_sz) == recv_param_sz);
 	}
 
 public:
-	tcp_send_context(conn_work* work, int signal_fd, double first_target_start_point)
-	: work(work), signal_fd(signal_fd) {
+	bool churn_due(double now) const {
+		if (conf.churn_requests > 0 && conn_request_cnt >= conf.churn_requests) {
+			return true;
+		}
+		return conf.churn_time > 0.0 && now - conn_open_point >= conf.churn_time * 1.0e9;
+	}
+
+	// Replaces the connection. Outstanding requests stay with the old connection, whose
+	// recv context finishes them and cleans up after the server closes its side.
+	void reconnect() {
+		// before anything reaches the server: its close may be seen by the recv context right away
+		conn->send_shut_down.store(true, std::memory_order_release);
+		if (conn->tls != NULL) {
+			tls_shutdown(conn->tls);
+		}
+		if (shutdown(conn->sock, SHUT_WR) < 0) {
+			perror("reconnect: can't shut down connection");
+			exit(1);
+		}
+		connect();
+	}
+
+public:
+	tcp_send_context(conn_work* work, int signal_fd, int epoll_fd, connect_limiter *limiter, record_buffer *recorder, double first_target_start_point)
+	: work(work), signal_fd(signal_fd), epoll_fd(epoll_fd), sender(work->numa_node), limiter(limiter),
+	rg(derive_seed(conf.seed, work->id)), recorder(recorder) {
 		min_send_rate = work->init_send_rate;
 		max_send_rate = work->send_rate;
 		cur_send_rate = min_send_rate;
@@ -133,9 +349,13 @@ public:
 		target_start_point = first_target_start_point;
 		ramp_start_point = first_target_start_point;
 		connected = false;
+		tls = conf.tls ? tls_client_new() : NULL;
+		if (work->replay != NULL) {
+			target_start_point = replay_target_point();
+		}
 	}
 
-	void send_next(rand_engine_t *rg) {
+	void send_next() {
 
 		if (!connected) {
 			connect();
@@ -144,19 +364,33 @@ public:
 				// no send rate ramp up, so signal now (the other ramp_up_cnt.fetch_add won't execute)
 				control.ramp_up_cnt.fetch_add(1);
 			}
+		} else if (conf.churn && churn_due(clock_mono_nsec()) && limiter->try_acquire(clock_mono_nsec())) {
+			reconnect();
 		}
 
+		uint64_t prof_point = prof_begin();
 		request pending_request;
-		work->make_request(&pending_request, rg);
+		work->make_request(&pending_request, &rg);
+		if (work->near_cache_serve(pending_request)) {
+			prof_next(ps_make_request, prof_point);
+			return;
+		}
+		pending_request.conn_first = conn_request_cnt == 0;
+		conn_request_cnt++;
+		prof_point = prof_next(ps_make_request, prof_point);
 		sender.setup(pending_request);
+		prof_point = prof_next(ps_fill_send_buf, prof_point);
 
 		double start_point = clock_mono_nsec();
 		while(target_start_point > start_point) {
 			start_point = clock_mono_nsec();
 		}
+		prof_point = prof_next(ps_pacing, prof_point);
 		while (!sender.try_send(&pending_request.send_time))
 			;
 		double finish_point = clock_mono_nsec();
+		prof_point = prof_next(ps_send, prof_point);
+		pending_request.tx_key = sender.sent_bytes - 1;
 
 		if (cur_send_rate < max_send_rate) {
 			cur_send_rate = min_send_rate + ramp_up_speed * (finish_point - ramp_start_point) / 1.0e9;
@@ -169,37 +403,50 @@ public:
 
 		work->count_send_timing(target_start_point, start_point, finish_point);
 		work->count_sent(pending_request);
-		outstandings.push_back(pending_request);
+		if (tls != NULL) {
+			work->count_tls_send(sender.crypto_time);
+		}
+		prof_next(ps_count, prof_point);
+		if (recorder != NULL) {
+			recorder->add(pending_request.send_time, work->id, pending_request);
+		}
+		conn->outstandings.push_back(pending_request);
 	}
 
-	void update_target_start_point(rand_engine_t *rg) {
+	void update_target_start_point() {
+		if (work->replay != NULL) {
+			if (!work->replay->done()) {
+				target_start_point = replay_target_point();
+			}
+			return;
+		}
 		switch (conf.send_traffic_shape.shape) {
 		case traffic_shape::UNIFORM:
 			{
 				double delta = conf.send_traffic_shape.param;
 				rand_uniform_real_t dist(1.0 - delta, 1.0 + delta);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::NORMAL:
 			{
 				double stddev = conf.send_traffic_shape.param;
 				rand_normal_real_t dist(1.0, stddev);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::PEAKS:
 			{
 				rand_uniform_int_t peaks_select(0,9);
 				double mean;
-				if (peaks_select(*rg) == 0) {
+				if (peaks_select(rg) == 0) {
 					mean = 9.0;
 				} else {
 					mean = 1.0 / 9.0;
 				}
 				double stddev = conf.send_traffic_shape.param;
 				rand_normal_real_t dist(mean, stddev);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::GAMMA:
@@ -207,7 +454,7 @@ public:
 				double alpha = conf.send_traffic_shape.param;
 				double beta = 1.0 / alpha;
 				std::gamma_distribution<double> dist(alpha, beta);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::EXPONENTIAL:
@@ -215,7 +462,7 @@ public:
 				double lambda = conf.send_traffic_shape.param;
 				std::exponential_distribution<double> dist(lambda);
 				double mean = 1.0 / lambda;
-				target_start_point += (send_interval / mean) * dist(*rg);
+				target_start_point += (send_interval / mean) * dist(rg);
 			}
 			break;
 		default:
@@ -226,83 +473,22 @@ public:
 	double get_target_start_point() const {
 		return target_start_point;
 	}
-};
-
-enum recv_state_t {
-	rst_running,
-	rst_read_pause
-};
-
-static void tcp_recv_callback(evutil_socket_t sock, short what, void *arg);
-
-class tcp_recv_context {
-private:
-	conn_work *work;
-	tcp_response_receiver receiver;
-	tcp_request_queue *outstandings;
-	recv_state_t recv_state;
-	event *readable;
-
-public:
-	tcp_recv_context(const tcp_recv_params &params, event_base *base) {
-		work = params.work;
-		receiver.sock = params.sock;
-		outstandings = params.outstandings;
-		recv_state = rst_running;
-		readable = event_new(base, params.sock, EV_READ|EV_PERSIST, tcp_recv_callback, this); assert(readable != NULL);
-		event_add(readable, NULL);
-	}
-
-	void drive_state_machine() {
-		switch(recv_state) {
-		case rst_running:
-		case rst_read_pause:
-			if (!try_receive()) {
-				recv_state = rst_read_pause;
-				break;
-			}
-			recv_state = rst_running;
-			break;
-		default:
-			assert(false);
-		}
-	}
 
-	void continue_receive() {
-		for (int i = 0; i < conf.receive_burst; i++) {
-			drive_state_machine();
-			if (recv_state != rst_running) {
-				break;
-			}
-		}
+	// Called by the send thread the context was handed to (see send_balancer.h). The
+	// connection and its recv context stay where they are.
+	void adopt(connect_limiter *limiter, record_buffer *recorder) {
+		this->limiter = limiter;
+		this->recorder = recorder;
+		sender.rebind_pool();
+		work->count_migration();
 	}
 
-private:
-	bool try_receive() {
-		const auto& resp_vec = receiver.try_receive();
-		if (resp_vec.empty()) {
-			return false;
-		}
-		for (const auto& resp: resp_vec) {
-			while (outstandings->empty()) {
-				; // response arrives before request is enqueued
-			}
-			const request &r = outstandings->front();
-			if (!request_response_match(r, resp)) {
-				exit(1);
-			}
-			work->count_replied(r, resp);
-			outstandings->pop_front();
-		}
-		return true;
+	// True once all recorded requests of the connection have been replayed.
+	bool finished() const {
+		return work->replay != NULL && work->replay->done();
 	}
 };
 
-static void tcp_recv_callback(evutil_socket_t sock, short what, void *arg) {
-	tcp_recv_context *ct = (tcp_recv_context*) arg;
-	ct->continue_receive();
-}
-
 class tcp_send_context_comp {
 public:
 	bool operator() (const tcp_send_context *c0, const tcp_send_context *c1) {
@@ -310,36 +496,72 @@ public:
 	}
 };
 
-tcp_conn_worker::tcp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed)
-: works(works), worker_connect_speed(worker_connect_speed) {
+tcp_conn_worker::tcp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed, double worker_churn_connect_rate, send_balancer *balancer, int balancer_slot)
+: works(works), worker_connect_speed(worker_connect_speed), worker_churn_connect_rate(worker_churn_connect_rate),
+balancer(balancer), balancer_slot(balancer_slot) {
 	assert(pipe2(signal_pipe, O_NONBLOCK) == 0);
+	epoll_fd = -1;
+	if (conf.epoll_receive) {
+		epoll_fd = epoll_create1(0); assert(epoll_fd >= 0);
+	}
 }
 
 void tcp_conn_worker::send_run() {
 
+	if (conf.profile) {
+		prof_register_thread("send");
+	}
+
 	while (!control.started);
 
 	std::priority_queue<tcp_send_context*, std::vector<tcp_send_context*>, tcp_send_context_comp> queue;
 
 	double connect_interval = 1.0e9 / worker_connect_speed;
+	connect_limiter limiter(worker_churn_connect_rate);
+	record_buffer *recorder = conf.record_file != NULL ? new record_buffer() : NULL;
 	double first_target_start_point = 1.0e6 + clock_mono_nsec(); // 1ms
 
-	rand_seed_t seed = (uint64_t) clock_mono_nsec() + pthread_self();
-	rand_engine_t rg(seed);
+	// spacing of connection setups, seeded from the first connection, like the per connection streams
+	rand_engine_t rg(derive_seed(conf.seed, (1ULL << 32) + works.front()->id));
 	rand_uniform_real_t dist(1.0 - 0.5, 1.0 + 0.5);
 
 	for (auto it = works.begin(); it != works.end(); it++) {
-		queue.push(new tcp_send_context(*it, signal_pipe[1], first_target_start_point));
+		if ((*it)->replay != NULL && (*it)->replay->done()) {
+			// nothing recorded for this connection, it never connects
+			control.ramp_up_cnt.fetch_add(1);
+			continue;
+		}
+		queue.push(new tcp_send_context(*it, signal_pipe[1], epoll_fd, &limiter, recorder, first_target_start_point));
 		first_target_start_point += connect_interval * dist(rg);
 	}
 
-	while (true) {
+	while (!queue.empty()) {
+		if (balancer != NULL) {
+			double now = clock_mono_nsec();
+			if (balancer->giving(balancer_slot, queue.size(), now)) {
+				balancer->give(balancer_slot, queue.top());
+				queue.pop();
+			}
+			auto stolen = (tcp_send_context*) balancer->take(balancer_slot, now - queue.top()->get_target_start_point(), queue.size(), now);
+			if (stolen != NULL) {
+				stolen->adopt(&limiter, recorder);
+				queue.push(stolen);
+			}
+		}
 		auto cx = queue.top();
-		cx->send_next(&rg);
+		cx->send_next();
 		queue.pop();
-		cx->update_target_start_point(&rg);
+		if (cx->finished()) {
+			continue;
+		}
+		cx->update_target_start_point();
 		queue.push(cx);
 	}
+
+	// only reached when a replay is done
+	if (recorder != NULL) {
+		recorder->flush();
+	}
 }
 
 static void tcp_recv_new_conn_callback(evutil_socket_t fd, short what, void *arg) {
@@ -347,13 +569,22 @@ static void tcp_recv_new_conn_callback(evutil_socket_t fd, short what, void *arg
 	event_base *base = (event_base*) arg;
 	tcp_recv_params params;
 	assert(read(fd, &params, sizeof(params)) == sizeof(params));
-	new tcp_recv_context(params, base);
+	(new tcp_recv_context(params))->watch(base);
 }
 
 void tcp_conn_worker::recv_run() {
 
+	if (conf.profile) {
+		prof_register_thread("recv");
+	}
+
 	while (!control.started);
 
+	if (epoll_fd >= 0) {
+		epoll_recv_loop<tcp_recv_context>(epoll_fd);
+		return;
+	}
+
 	event_config *cfg;
 	event_base *base;
 	int ret;
@@ -0,0 +1,50 @@
+#ifndef TCP_REQUEST_QUEUE_H
+#define TCP_REQUEST_QUEUE_H
+
+#include <list>
+#include <mutex>
+#include "memcached_cmd.h"
+
+// Requests sent on a TCP connection and not yet replied, in send order. The send thread
+// pushes, the recv thread reads the front and pops.
+class tcp_request_queue {
+private:
+	std::mutex lock;
+	std::list<request> queue;
+
+public:
+	bool empty() {
+		lock.lock();
+		bool res = queue.empty();
+		lock.unlock();
+		return res;
+	}
+
+	request &front() {
+		lock.lock();
+		request &res = queue.front();
+		lock.unlock();
+		return res;
+	}
+
+	void pop_front() {
+		lock.lock();
+		queue.pop_front();
+		lock.unlock();
+	}
+
+	void push_back(request &r) {
+		lock.lock();
+		queue.push_back(r);
+		lock.unlock();
+	}
+
+	int size() {
+		lock.lock();
+		int res = queue.size();
+		lock.unlock();
+		return res;
+	}
+};
+
+#endif
@@ -4,26 +4,52 @@
 #include <stdio.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <assert.h>
 #include "clock.h"
 
-tcp_request_sender::tcp_request_sender() {
-	send_buf_sz = max_request_size;
-	send_buf = new char[send_buf_sz];
+tcp_request_sender::tcp_request_sender(int numa_node) : numa_node(numa_node) {
+	pool = NULL;
+	send_buf = NULL;
+	send_buf_sz = 0;
+	progress = 0;
+	target = 0;
+	tls = NULL;
+	sent_bytes = 0;
 }
 
 tcp_request_sender::~tcp_request_sender() {
-	delete[] send_buf;
+	if (send_buf != NULL) {
+		pool->put(send_buf, send_buf_sz);
+	}
 }
 
 void tcp_request_sender::setup(const request &r) {
+	if (pool == NULL) {
+		pool = buffer_pool::of_thread(numa_node);
+	}
+	if (send_buf != NULL) {
+		pool->put(send_buf, send_buf_sz);
+	}
+	send_buf = pool->get(send_buf_size(r), &send_buf_sz);
 	progress = 0;
 	target = fill_send_buf(r, send_buf, send_buf_sz);
+	crypto_time = 0.0;
+}
+
+void tcp_request_sender::rebind_pool() {
+	assert(send_buf == NULL);
+	pool = NULL;
 }
 
 bool tcp_request_sender::try_send(double *send_time) {
 	while (progress != target) {
 		*send_time = clock_mono_nsec();
-		int res = send(sock, send_buf + progress, target - progress, MSG_DONTWAIT);
+		int res;
+		if (tls == NULL) {
+			res = send(sock, send_buf + progress, target - progress, MSG_DONTWAIT);
+		} else {
+			res = tls_send(tls, send_buf + progress, target - progress, &crypto_time);
+		}
 		if (res < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {
 				return false;
@@ -33,6 +59,9 @@ bool tcp_request_sender::try_send(double *send_time) {
 			}
 		}
 		progress += res;
+		sent_bytes += res;
 	}
+	pool->put(send_buf, send_buf_sz);
+	send_buf = NULL;
 	return true;
 }
@@ -3,23 +3,33 @@
 
 #include <sys/socket.h>
 #include "memcached_cmd.h"
+#include "tls_transport.h"
+#include "buffer_pool.h"
 
 // A sender object can only be used by one thread.
 class tcp_request_sender {
 public:
 	int sock;
+	tls_conn *tls; // NULL for plain tcp
+	double crypto_time; // ns spent in tls_send for the current request
+	uint32_t sent_bytes; // bytes sent on sock, keys TX timestamps (reset when sock changes)
 
 private:
-	char *send_buf;
+	const int numa_node;
+	buffer_pool *pool;
+	char *send_buf; // from pool while a request is being sent, NULL otherwise
 	int send_buf_sz;
 	int progress;
 	int target;
 
 public:
-	tcp_request_sender();
+	tcp_request_sender(int numa_node = -1);
 	~tcp_request_sender();
 	void setup(const request &r);
 	bool try_send(double *send_time);
+	// Called by the thread the sender moved to, between two requests: buffers then come from
+	// the pool of that thread.
+	void rebind_pool();
 };
 
 #endif
@@ -6,28 +6,53 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <assert.h>
+#include <algorithm>
 #include "clock.h"
 #include "config.h"
+#include "stage_profiler.h"
 
-tcp_response_receiver::tcp_response_receiver() {
-	recv_buf_sz = conf.mtu * 2;
-	recv_buf = new char[recv_buf_sz];
-	buf_head = recv_buf;
-	buf_tail = recv_buf;
+tcp_response_receiver::tcp_response_receiver(int numa_node) : numa_node(numa_node), tx_stamps(true) {
+	pool = NULL;
+	recv_buf = NULL;
+	recv_buf_sz = 0;
+	recv_buf_want = conf.mtu * 2;
+	buf_head = NULL;
+	buf_tail = NULL;
 	state = trs_head;
 	skip_target = 0;
+	discard = !conf.validate_values;
+	blocked = false;
+	closed = false;
+	tls = NULL;
+	crypto_time = 0.0;
+	memset(&cur_resp.wire_recv_time, 0, sizeof(cur_resp.wire_recv_time));
 }
 
 tcp_response_receiver::~tcp_response_receiver() {
-	delete[] recv_buf;
+	if (recv_buf != NULL) {
+		pool->put(recv_buf, recv_buf_sz);
+	}
 }
 
 void tcp_response_receiver::reset_recv_buf() {
+	if (recv_buf == NULL) {
+		if (pool == NULL) {
+			pool = buffer_pool::of_thread(numa_node);
+		}
+		recv_buf = pool->get(recv_buf_want, &recv_buf_sz);
+		buf_head = recv_buf;
+		buf_tail = recv_buf;
+		return;
+	}
 	if (buf_head == buf_tail) {
 		buf_head = recv_buf;
 		buf_tail = recv_buf;
 		return;
 	}
+	// Only move the leftover head when less than half of the buffer is free for reading.
+	if (recv_buf + recv_buf_sz - buf_tail >= recv_buf_sz / 2) {
+		return;
+	}
 	int char_cnt = buf_tail - buf_head;
 	assert(char_cnt < recv_buf_sz);
 	memmove(recv_buf, buf_head, char_cnt);
@@ -35,34 +60,120 @@ void tcp_response_receiver::reset_recv_buf() {
 	buf_tail = buf_head + char_cnt;
 }
 
+void tcp_response_receiver::grow_recv_buf(int new_sz) {
+	recv_buf_want = std::max(recv_buf_want, new_sz);
+	if (new_sz <= recv_buf_sz) {
+		int char_cnt = buf_tail - buf_head;
+		memmove(recv_buf, buf_head, char_cnt);
+		buf_head = recv_buf;
+		buf_tail = buf_head + char_cnt;
+		return;
+	}
+	int new_buf_sz;
+	char *new_buf = pool->get(new_sz, &new_buf_sz);
+	int char_cnt = buf_tail - buf_head;
+	memcpy(new_buf, buf_head, char_cnt);
+	pool->put(recv_buf, recv_buf_sz);
+	recv_buf = new_buf;
+	recv_buf_sz = new_buf_sz;
+	buf_head = recv_buf;
+	buf_tail = buf_head + char_cnt;
+}
+
+// Gives the buffer back to the pool once everything read has been parsed, so that idle
+// connections hold no buffer.
+void tcp_response_receiver::release_recv_buf() {
+	if (recv_buf != NULL && buf_head == buf_tail) {
+		pool->put(recv_buf, recv_buf_sz);
+		recv_buf = NULL;
+		buf_head = NULL;
+		buf_tail = NULL;
+	}
+}
+
 int tcp_response_receiver::recv_some() {
 	reset_recv_buf();
 	// Read as much as buffer can hold.
-	int res = recvfrom(sock, buf_tail, recv_buf + recv_buf_sz - buf_tail, MSG_DONTWAIT, NULL, NULL);
+	int space = recv_buf + recv_buf_sz - buf_tail;
+	int res;
+	if (conf.timestamping != tst_off) {
+		res = recv_stamped(sock, buf_tail, space, MSG_DONTWAIT, &cur_resp.wire_recv_time);
+	} else if (tls == NULL) {
+		res = recvfrom(sock, buf_tail, space, MSG_DONTWAIT, NULL, NULL);
+	} else {
+		res = tls_recv(tls, buf_tail, space, &crypto_time);
+	}
+	blocked = res <= 0;
 	if (res < 0) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (conf.timestamping != tst_off) {
+				// a non-empty error queue keeps the socket readable
+				tx_stamps.collect(sock);
+			}
 			return 0;
 		} else {
 			perror("tcp receive: can't receive");
 			exit(1);
 		}
 	}
+	if (res == 0) {
+		closed = true;
+	}
 	buf_tail += res;
 	cur_resp.recv_time = clock_mono_nsec();
+	// A full read means more data is probably queued, so read more per call next time.
+	if (res == space && recv_buf_sz < conf.recv_buf_max) {
+		grow_recv_buf(std::min(recv_buf_sz * 2, conf.recv_buf_max));
+	}
 	return res;
 }
 
-char *tcp_response_receiver::get_line() {
-	char *line = NULL;
-	for (char *p = buf_head; p != buf_tail; p++) {
-		if (*p == '\n') {
-			*p = '\0';
-			line = buf_head;
-			buf_head = p + 1;
-			return line;
+// Drops up to skip_target bytes of a value body from the socket without copying them to user space.
+// Returns true if the whole body has been dropped.
+bool tcp_response_receiver::discard_some() {
+	while (skip_target > 0) {
+		int res;
+		if (conf.timestamping != tst_off) {
+			res = recv_stamped(sock, NULL, skip_target, MSG_DONTWAIT | MSG_TRUNC, &cur_resp.wire_recv_time);
+		} else {
+			res = recv(sock, NULL, skip_target, MSG_DONTWAIT | MSG_TRUNC);
 		}
+		blocked = res <= 0;
+		if (res < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (conf.timestamping != tst_off) {
+					tx_stamps.collect(sock);
+				}
+				return false;
+			} else if (errno == EFAULT || errno == EINVAL) {
+				// kernel can't discard on this socket, fall back to reading bodies
+				discard = false;
+				blocked = false;
+				return false;
+			} else {
+				perror("tcp receive: can't discard");
+				exit(1);
+			}
+		}
+		if (res == 0) {
+			closed = true;
+			return false;
+		}
+		skip_target -= res;
+		cur_resp.recv_time = clock_mono_nsec();
+	}
+	return true;
+}
+
+char *tcp_response_receiver::get_line() {
+	char *p = (char*) find_line_end(buf_head, buf_tail);
+	if (p == NULL) {
+		return NULL;
 	}
-	return NULL;
+	*p = '\0';
+	char *line = buf_head;
+	buf_head = p + 1;
+	return line;
 }
 
 bool tcp_response_receiver::skip() {
@@ -77,6 +188,20 @@ bool tcp_response_receiver::skip() {
 	return false;
 }
 
+// Checks a complete value body (and its trailer) sitting in the buffer, and consumes it.
+bool tcp_response_receiver::check_body() {
+	if (buf_tail - buf_head < skip_target) {
+		return false;
+	}
+	if (!check_val(buf_head, cur_resp.key_seed, cur_resp.val_size) || memcmp(buf_head + cur_resp.val_size, "\r\nEND\r\n", 7) != 0) {
+		fprintf(stderr, "Oooops, corrupted value for key seed %x, size %d\n", cur_resp.key_seed, cur_resp.val_size);
+		exit(1);
+	}
+	buf_head += skip_target;
+	skip_target = 0;
+	return true;
+}
+
 tcp_recv_state tcp_response_receiver::handle_head() {
 	char *line = get_line();
 	if (line == NULL) {
@@ -85,6 +210,10 @@ tcp_recv_state tcp_response_receiver::handle_head() {
 	parse_response_head(&cur_resp, line);
 	if (cur_resp.err == mer_get_found) {
 		skip_target = cur_resp.val_size + 7; // 7 is for the trailing "\r\nEND\r\n"
+		if (conf.validate_values && recv_buf + recv_buf_sz - buf_head < skip_target) {
+			// the whole body has to fit in the buffer to be checked
+			grow_recv_buf(std::max(recv_buf_sz, skip_target + max_key_size + 100));
+		}
 		return trs_body;
 	} else {
 		return trs_done;
@@ -92,11 +221,16 @@ tcp_recv_state tcp_response_receiver::handle_head() {
 }
 
 tcp_recv_state tcp_response_receiver::handle_body() {
+	if (conf.validate_values) {
+		return check_body() ? trs_done : trs_body;
+	}
 	if (skip()) {
 		return trs_done;
-	} else {
-		return trs_body;
 	}
+	if (can_discard() && discard_some()) {
+		return trs_done;
+	}
+	return trs_body;
 }
 
 void tcp_response_receiver::run_state_machine() {
@@ -125,8 +259,22 @@ void tcp_response_receiver::run_state_machine() {
 
 const std::vector<response>& tcp_response_receiver::try_receive() {
 	resp_vec.clear();
-	if (recv_some() > 0) {
+	uint64_t prof_point = prof_begin();
+	if (state == trs_body && can_discard()) {
+		// The rest of the value body is dropped by the kernel, don't read it in first.
+		run_state_machine();
+		prof_point = prof_next(ps_recv, prof_point);
+		if (state == trs_body) {
+			release_recv_buf();
+			return resp_vec;
+		}
+	}
+	int res = recv_some();
+	prof_point = prof_next(ps_recv, prof_point);
+	if (res > 0) {
 		run_state_machine();
+		prof_next(ps_parse, prof_point);
 	}
+	release_recv_buf();
 	return resp_vec;
 }
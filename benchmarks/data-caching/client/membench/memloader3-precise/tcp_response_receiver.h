@@ -1,8 +1,12 @@
 #ifndef TCP_RESPONSE_RECEIVER_H
 #define TCP_RESPONSE_RECEIVER_H
 
+#include <stddef.h>
 #include <vector>
 #include "memcached_cmd.h"
+#include "tls_transport.h"
+#include "timestamping.h"
+#include "buffer_pool.h"
 
 enum tcp_recv_state {
 	trs_head,
@@ -14,19 +18,28 @@ enum tcp_recv_state {
 class tcp_response_receiver {
 public:
 	int sock;
+	tls_conn *tls; // NULL for plain tcp
 
 private:
-	char *recv_buf;
+	const int numa_node;
+	buffer_pool *pool;
+	char *recv_buf; // from pool while it holds unparsed data, NULL otherwise
 	int recv_buf_sz;
+	int recv_buf_want; // size to get from the pool next time
 	char *buf_head;
 	char *buf_tail;
 	tcp_recv_state state;
 	int skip_target;
+	bool discard; // discard value bodies in the kernel instead of reading them
+	bool blocked; // the last socket read found no data
+	bool closed; // the server closed the connection
+	double crypto_time; // ns spent in tls_recv since the last take_crypto_time
 	response cur_resp;
+	tx_stamp_queue tx_stamps;
 	std::vector<response> resp_vec;
 
 public:
-	tcp_response_receiver();
+	tcp_response_receiver(int numa_node = -1);
 	~tcp_response_receiver();
 
 	// Read (nonblockin) gand process at most one buffer of data.
@@ -34,11 +47,35 @@ public:
 	// The returned vector will be overriden on the next call.
 	const std::vector<response>& try_receive();
 
+	// True if the last try_receive stopped because the socket had no more data.
+	bool would_block() const { return blocked; }
+
+	// True once the server has closed the connection.
+	bool peer_closed() const { return closed; }
+
+	// TX timestamp of a request sent on sock, with conf.timestamping.
+	bool tx_stamp(uint32_t tx_key, wire_stamp *stamp) { return tx_stamps.lookup(sock, tx_key, stamp); }
+
+	// True if there is received data the socket won't signal readability for (tls only).
+	bool has_pending() const { return tls != NULL && tls_pending(tls); }
+
+	double take_crypto_time() {
+		double t = crypto_time;
+		crypto_time = 0.0;
+		return t;
+	}
+
 private:
 	void reset_recv_buf();
+	void grow_recv_buf(int new_sz);
+	void release_recv_buf();
+	// Value bodies can only be discarded in the kernel when they are not encrypted.
+	bool can_discard() const { return discard && tls == NULL; }
 	int recv_some();
+	bool discard_some();
 	char *get_line();
 	bool skip();
+	bool check_body();
 	tcp_recv_state handle_head();
 	tcp_recv_state handle_body();
 	void run_state_machine();
@@ -1,48 +1,88 @@
 #include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
 #include "thread_utils.h"
+#include "numa_utils.h"
 
-static int thread_host_id_to_cpu_id(unsigned int thread_host_id) {
+static std::vector<int> thread_host_cpus; // thread host id -> cpu id
+
+void init_thread_hosts(bool numa_aware, int preferred_node) {
 
 	int err;
 	cpu_set_t av_cpu_mask;
 
 	err = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &av_cpu_mask);
 	if (err != 0) {
-		fprintf(stderr, "thread_host_id_to_cpu_id: can't get affinity mask.\n");
-		exit(1);
-	}
-
-	int av_cpu_cnt = CPU_COUNT(&av_cpu_mask);
-
-	if ((int) thread_host_id >= av_cpu_cnt) {
-		fprintf(stderr, "thread_host_id_to_cpu_id: thread_host_id >= av_cpu_cnt: %u, %d.\n", thread_host_id, av_cpu_cnt);
+		fprintf(stderr, "init_thread_hosts: can't get affinity mask.\n");
 		exit(1);
 	}
 
-	unsigned int id_i = 0;
+	thread_host_cpus.clear();
 	for (int bit_i = 0; bit_i < CPU_SETSIZE; bit_i++) {
 		if (CPU_ISSET(bit_i, &av_cpu_mask)) {
-			if (id_i == thread_host_id) return bit_i;
-			id_i++;
+			thread_host_cpus.push_back(bit_i);
 		}
 	}
 
-	return -1;
+	if (!numa_aware) return;
+
+	auto node_rank = [preferred_node](int cpu) {
+		int node = cpu_to_numa_node(cpu);
+		return node == preferred_node ? -1 : node;
+	};
+	std::stable_sort(thread_host_cpus.begin(), thread_host_cpus.end(), [&node_rank](int c0, int c1) {
+		return node_rank(c0) < node_rank(c1);
+	});
+
+	// drop the last cpu of nodes with an odd number of cpus
+	std::vector<int> even_cpus;
+	for (int i = 0; i < (int) thread_host_cpus.size(); ) {
+		int node = cpu_to_numa_node(thread_host_cpus[i]);
+		int j = i;
+		while (j < (int) thread_host_cpus.size() && cpu_to_numa_node(thread_host_cpus[j]) == node) {
+			j++;
+		}
+		int cnt = (j - i) & ~1;
+		even_cpus.insert(even_cpus.end(), thread_host_cpus.begin() + i, thread_host_cpus.begin() + i + cnt);
+		i = j;
+	}
+	if (even_cpus.empty()) {
+		// get_num_of_thread_hosts would quietly start over without numa
+		fprintf(stderr, "init_thread_hosts: --numa needs a node with at least two cpus in the affinity mask.\n");
+		exit(1);
+	}
+	thread_host_cpus.swap(even_cpus);
 }
 
-int get_num_of_thread_hosts() {
+static int thread_host_id_to_cpu_id(unsigned int thread_host_id) {
 
-	int err;
-	cpu_set_t av_cpu_mask;
+	if (thread_host_cpus.empty()) {
+		init_thread_hosts(false, -1);
+	}
 
-	err = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &av_cpu_mask);
-	if (err != 0) {
-		fprintf(stderr, "ptu_get_num_of_thread_hosts: can't get affinity mask.\n");
+	int av_cpu_cnt = thread_host_cpus.size();
+
+	if ((int) thread_host_id >= av_cpu_cnt) {
+		fprintf(stderr, "thread_host_id_to_cpu_id: thread_host_id >= av_cpu_cnt: %u, %d.\n", thread_host_id, av_cpu_cnt);
 		exit(1);
 	}
 
-	return CPU_COUNT(&av_cpu_mask);
+	return thread_host_cpus[thread_host_id];
+}
+
+int get_num_of_thread_hosts() {
+
+	if (thread_host_cpus.empty()) {
+		init_thread_hosts(false, -1);
+	}
+
+	return thread_host_cpus.size();
+}
 
+int thread_host_to_numa_node(unsigned int thread_host_id) {
+	return cpu_to_numa_node(thread_host_id_to_cpu_id(thread_host_id));
 }
 
 void pin_thread(std::thread *thread, unsigned int thread_host_id) {
@@ -3,8 +3,18 @@
 
 #include <thread>
 
+// Builds the thread host (cpu) list from the affinity mask of the calling thread.
+// If numa_aware is true, thread hosts are grouped by numa node, each node keeps an
+// even number of thread hosts (so a send/recv thread pair never spans two nodes),
+// and the hosts of preferred_node (if >= 0) come first. Will exit program if no node keeps
+// any thread host.
+// Calling it is optional; without it, hosts follow the affinity mask order.
+void init_thread_hosts(bool numa_aware, int preferred_node);
+
 int get_num_of_thread_hosts();
 
+int thread_host_to_numa_node(unsigned int thread_host_id);
+
 void pin_thread(std::thread *thread, unsigned int thread_host_id);
 
 #endif
@@ -0,0 +1,145 @@
+#include "timestamping.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include "config.h"
+
+// Timestamps of requests that are never answered are dropped once this many are queued.
+static const int max_pending_stamps = 4096;
+
+static const int stamp_cmsg_sz = 256;
+
+void enable_timestamping(int sock) {
+	int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE
+		| SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	if (conf.timestamping == tst_hardware) {
+		// The NIC has to be set up to stamp packets too (SIOCSHWTSTAMP, e.g. with hwstamp_ctl).
+		flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE;
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+		perror("enable_timestamping: can't set SO_TIMESTAMPING");
+		exit(1);
+	}
+}
+
+static int64_t timespec_nsec(const timespec &ts) {
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool get_stamp(msghdr *msg, wire_stamp *stamp) {
+	for (cmsghdr *cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+			scm_timestamping *tss = (scm_timestamping*) CMSG_DATA(cm);
+			stamp->sw = timespec_nsec(tss->ts[0]);
+			stamp->hw = timespec_nsec(tss->ts[2]);
+			return true;
+		}
+	}
+	return false;
+}
+
+int recv_stamped(int sock, void *buf, int len, int flags, wire_stamp *stamp) {
+	char control[stamp_cmsg_sz];
+	iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	int res = recvmsg(sock, &msg, flags);
+	if (res > 0) {
+		get_stamp(&msg, stamp);
+	}
+	return res;
+}
+
+bool wire_latency(const wire_stamp &tx, const wire_stamp &rx, double *latency, bool *hw) {
+	if (tx.hw != 0 && rx.hw != 0) {
+		*latency = rx.hw - tx.hw;
+		*hw = true;
+		return true;
+	}
+	if (tx.sw != 0 && rx.sw != 0) {
+		*latency = rx.sw - tx.sw;
+		*hw = false;
+		return true;
+	}
+	return false;
+}
+
+// Compares keys, which wrap around.
+static bool key_before(uint32_t k0, uint32_t k1) {
+	return (int32_t) (k0 - k1) < 0;
+}
+
+void tx_stamp_queue::collect(int sock) {
+	char control[stamp_cmsg_sz];
+	while (true) {
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		int res = recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			perror("tx_stamp_queue: can't read error queue");
+			exit(1);
+		}
+		wire_stamp stamp;
+		if (!get_stamp(&msg, &stamp)) {
+			continue;
+		}
+		for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+				|| (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+				sock_extended_err *err = (sock_extended_err*) CMSG_DATA(cm);
+				if (err->ee_errno == ENOMSG && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+					stamps.push_back(std::make_pair(err->ee_data, stamp));
+				}
+			}
+		}
+	}
+	while ((int) stamps.size() > max_pending_stamps) {
+		stamps.pop_front();
+	}
+}
+
+bool tx_stamp_queue::find(uint32_t key, wire_stamp *stamp) {
+	if (in_order) {
+		while (!stamps.empty() && key_before(stamps.front().first, key)) {
+			stamps.pop_front();
+		}
+		if (stamps.empty()) {
+			return false;
+		}
+		*stamp = stamps.front().second;
+		return true;
+	}
+	for (auto it = stamps.begin(); it != stamps.end(); it++) {
+		if (it->first == key) {
+			*stamp = it->second;
+			stamps.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool tx_stamp_queue::lookup(int sock, uint32_t key, wire_stamp *stamp) {
+	if (find(key, stamp)) {
+		return true;
+	}
+	collect(sock);
+	return find(key, stamp);
+}
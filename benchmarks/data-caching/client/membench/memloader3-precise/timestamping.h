@@ -0,0 +1,49 @@
+#ifndef TIMESTAMPING_H
+#define TIMESTAMPING_H
+
+#include <stdint.h>
+#include <deque>
+#include <utility>
+#include "memcached_cmd.h"
+
+// Kernel (SO_TIMESTAMPING) timestamps of requests leaving and responses arriving at the NIC.
+// TX timestamps are keyed (SOF_TIMESTAMPING_OPT_ID) by the byte offset of the last byte of a
+// send for TCP, and by the datagram count for UDP; see request::tx_key.
+
+// Turns on timestamping for a socket, as configured by conf.timestamping.
+// TCP sockets must be connected and must not have sent anything yet.
+// Will exit program if the kernel refuses.
+void enable_timestamping(int sock);
+
+// recv with the RX timestamp of the received data stored to *stamp (left alone if the kernel
+// gives none). Same return value as recv.
+int recv_stamped(int sock, void *buf, int len, int flags, wire_stamp *stamp);
+
+// Wire-to-wire latency (in ns) between a TX and an RX timestamp taken by the same clock.
+// Hardware timestamps are used if both have one. Returns false if there is no common clock.
+bool wire_latency(const wire_stamp &tx, const wire_stamp &rx, double *latency, bool *hw);
+
+// TX timestamps waiting to be matched with their requests. Only used by the recv thread.
+class tx_stamp_queue {
+private:
+	// TCP timestamps arrive in order, and a timestamp covers all bytes before its key (the
+	// kernel only keeps the key of the last send coalesced into a segment). UDP datagrams are
+	// answered in any order and each has its own timestamp.
+	bool in_order;
+	std::deque<std::pair<uint32_t, wire_stamp> > stamps;
+
+public:
+	tx_stamp_queue(bool in_order) : in_order(in_order) {}
+
+	// Moves timestamps from the error queue of sock to this queue. Needs to be done whenever the
+	// socket signals readability, since a non-empty error queue keeps it signalled.
+	void collect(int sock);
+
+	// Finds the TX timestamp of key, returns false if there is none.
+	bool lookup(int sock, uint32_t key, wire_stamp *stamp);
+
+private:
+	bool find(uint32_t key, wire_stamp *stamp);
+};
+
+#endif
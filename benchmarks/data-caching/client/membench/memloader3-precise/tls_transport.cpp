@@ -0,0 +1,234 @@
+#include "tls_transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "clock.h"
+
+#ifdef MEMLOADER_TLS
+
+#include <mutex>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+class tls_client {
+public:
+	std::mutex lock;
+	SSL_SESSION *session;
+};
+
+class tls_conn {
+public:
+	SSL *ssl;
+	int sock;
+	tls_client *client;
+	// An SSL object can't be used by two threads at the same time. With kTLS on the send side,
+	// the send thread writes to the socket directly, so the lock is only taken by the recv
+	// thread (and by tls_shutdown).
+	std::mutex lock;
+	bool ktls_send;
+	bool ktls_recv;
+};
+
+static SSL_CTX *ctx;
+static int conn_ex_idx;
+
+static void tls_fail(const char *what) {
+	fprintf(stderr, "%s\n", what);
+	ERR_print_errors_fp(stderr);
+	exit(1);
+}
+
+// Called whenever the server issues a session. With TLS 1.3 this happens after the handshake,
+// from inside SSL_read on the recv thread.
+static int new_session_callback(SSL *ssl, SSL_SESSION *session) {
+	tls_conn *conn = (tls_conn*) SSL_get_ex_data(ssl, conn_ex_idx);
+	tls_client *client = conn->client;
+	client->lock.lock();
+	if (client->session != NULL) {
+		SSL_SESSION_free(client->session);
+	}
+	client->session = session;
+	client->lock.unlock();
+	return 1; // the reference is kept
+}
+
+void tls_init() {
+
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	ctx = SSL_CTX_new(TLS_client_method());
+	if (ctx == NULL) tls_fail("tls_init: can't create context");
+
+	// Benchmarking only, the server certificate is not verified.
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+	if (conf.tls_ciphers != NULL && SSL_CTX_set_cipher_list(ctx, conf.tls_ciphers) != 1) {
+		tls_fail("tls_init: bad cipher list");
+	}
+	if (conf.tls_ciphersuites != NULL && SSL_CTX_set_ciphersuites(ctx, conf.tls_ciphersuites) != 1) {
+		tls_fail("tls_init: bad cipher suites");
+	}
+
+	if (conf.tls_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		fprintf(stderr, "tls_init: OpenSSL has no kTLS support, using user space crypto\n");
+#endif
+	}
+
+	if (conf.tls_resume) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, new_session_callback);
+	}
+
+	conn_ex_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+tls_client *tls_client_new() {
+	tls_client *client = new tls_client();
+	client->session = NULL;
+	return client;
+}
+
+tls_conn *tls_connect(tls_client *client, int sock, bool *resumed) {
+
+	tls_conn *conn = new tls_conn();
+	conn->sock = sock;
+	conn->client = client;
+	conn->ssl = SSL_new(ctx);
+	if (conn->ssl == NULL) tls_fail("tls_connect: can't create connection");
+	SSL_set_fd(conn->ssl, sock);
+	SSL_set_ex_data(conn->ssl, conn_ex_idx, conn);
+
+	if (conf.tls_resume) {
+		client->lock.lock();
+		if (client->session != NULL) {
+			SSL_set_session(conn->ssl, client->session);
+		}
+		client->lock.unlock();
+	}
+
+	ERR_clear_error();
+	if (SSL_connect(conn->ssl) != 1) tls_fail("tls_connect: handshake failed");
+
+	*resumed = SSL_session_reused(conn->ssl) == 1;
+#ifdef SSL_OP_ENABLE_KTLS
+	conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+	conn->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(conn->ssl));
+#else
+	conn->ktls_send = false;
+	conn->ktls_recv = false;
+#endif
+
+	int flags = fcntl(sock, F_GETFL);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		perror("tls_connect: can't make socket nonblocking");
+		exit(1);
+	}
+
+	return conn;
+}
+
+// Maps SSL_read/SSL_write results to send/recv style results.
+static int ssl_result(SSL *ssl, int res) {
+	if (res > 0) {
+		return res;
+	}
+	switch (SSL_get_error(ssl, res)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		return -1;
+	case SSL_ERROR_ZERO_RETURN:
+		return 0;
+	case SSL_ERROR_SYSCALL:
+		if (errno == 0) return 0;
+		return -1;
+	default:
+		ERR_print_errors_fp(stderr);
+		errno = EPROTO;
+		return -1;
+	}
+}
+
+int tls_send(tls_conn *conn, const char *buf, int len, double *duration) {
+	double start_point = clock_mono_nsec();
+	int res;
+	if (conn->ktls_send) {
+		res = send(conn->sock, buf, len, MSG_DONTWAIT);
+	} else {
+		conn->lock.lock();
+		ERR_clear_error();
+		res = ssl_result(conn->ssl, SSL_write(conn->ssl, buf, len));
+		conn->lock.unlock();
+	}
+	*duration += clock_mono_nsec() - start_point;
+	return res;
+}
+
+int tls_recv(tls_conn *conn, char *buf, int len, double *duration) {
+	double start_point = clock_mono_nsec();
+	conn->lock.lock();
+	ERR_clear_error();
+	int res = ssl_result(conn->ssl, SSL_read(conn->ssl, buf, len));
+	conn->lock.unlock();
+	*duration += clock_mono_nsec() - start_point;
+	return res;
+}
+
+bool tls_pending(tls_conn *conn) {
+	conn->lock.lock();
+	bool res = SSL_pending(conn->ssl) > 0;
+	conn->lock.unlock();
+	return res;
+}
+
+bool tls_ktls_send(tls_conn *conn) {
+	return conn->ktls_send;
+}
+
+bool tls_ktls_recv(tls_conn *conn) {
+	return conn->ktls_recv;
+}
+
+void tls_shutdown(tls_conn *conn) {
+	conn->lock.lock();
+	ERR_clear_error();
+	SSL_shutdown(conn->ssl); // nonblocking, the server's close_notify is not waited for
+	conn->lock.unlock();
+}
+
+void tls_free(tls_conn *conn) {
+	SSL_free(conn->ssl);
+	delete conn;
+}
+
+#else
+
+static void no_tls() {
+	fprintf(stderr, "memloader is built without TLS support, rebuild with \"make clean; make TLS=1\"\n");
+	exit(1);
+}
+
+void tls_init() { no_tls(); }
+tls_client *tls_client_new() { no_tls(); return NULL; }
+tls_conn *tls_connect(tls_client *client, int sock, bool *resumed) { no_tls(); return NULL; }
+int tls_send(tls_conn *conn, const char *buf, int len, double *duration) { no_tls(); return -1; }
+int tls_recv(tls_conn *conn, char *buf, int len, double *duration) { no_tls(); return -1; }
+bool tls_pending(tls_conn *conn) { return false; }
+bool tls_ktls_send(tls_conn *conn) { return false; }
+bool tls_ktls_recv(tls_conn *conn) { return false; }
+void tls_shutdown(tls_conn *conn) { no_tls(); }
+void tls_free(tls_conn *conn) { no_tls(); }
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef TLS_TRANSPORT_H
+#define TLS_TRANSPORT_H
+
+// TLS for TCP connections, only available when built with "make TLS=1" (OpenSSL).
+// Without it, tls_init exits with an error, so none of the other functions is reached.
+
+// Per vclient state kept across connections (the session to resume).
+class tls_client;
+
+// TLS state of one connection. The send and recv threads may use it at the same time.
+class tls_conn;
+
+// Sets up the global TLS context from conf. Call once before any connection is opened.
+void tls_init();
+
+tls_client *tls_client_new();
+
+// Runs the handshake on a connected, blocking socket and makes the socket nonblocking.
+// Resumes the last session of client if there is one and conf.tls_resume is set.
+// Will exit program if the handshake fails.
+tls_conn *tls_connect(tls_client *client, int sock, bool *resumed);
+
+// Nonblocking; same return values as send/recv (-1 with errno EAGAIN if no progress can be made,
+// 0 from tls_recv if the server closed the connection).
+// The time spent in each call is added to *duration (in ns).
+int tls_send(tls_conn *conn, const char *buf, int len, double *duration);
+int tls_recv(tls_conn *conn, char *buf, int len, double *duration);
+
+// True if decrypted data is buffered that tls_recv has not returned yet, so waiting for
+// the socket to become readable may wait forever. Recv side only.
+bool tls_pending(tls_conn *conn);
+
+// True if records are encrypted (send) or decrypted (recv) by the kernel (kTLS).
+bool tls_ktls_send(tls_conn *conn);
+bool tls_ktls_recv(tls_conn *conn);
+
+// Sends close_notify, for when the sending side is about to be shut down.
+void tls_shutdown(tls_conn *conn);
+
+void tls_free(tls_conn *conn);
+
+#endif
@@ -13,6 +13,9 @@
 #include <fcntl.h>
 #include <map>
 #include <set>
+#include <algorithm>
+#include <time.h>
+#include <linux/net_tstamp.h>
 #include "util.h"
 #include "config.h"
 #include "memcached_cmd.h"
@@ -20,6 +23,10 @@
 #include "udp_response_receiver.h"
 #include "randnum.h"
 #include "clock.h"
+#include "epoll_recv_loop.h"
+#include "timestamping.h"
+#include "stage_profiler.h"
+#include "request_log.h"
 
 static void open_udp_sock(int work_id, const server_addr &saddr, udp_request_sender *sender) {
 
@@ -36,7 +43,26 @@ static void open_udp_sock(int work_id, const server_addr &saddr, udp_request_sen
 		bind_port(sock, conf.base_port + work_id, SOCK_DGRAM);
 	}
 
+	if (conf.busy_poll > 0) {
+		set_busy_poll(sock, conf.busy_poll, conf.prefer_busy_poll, conf.busy_poll_budget);
+	}
+
+	if (conf.timestamping != tst_off) {
+		enable_timestamping(sock);
+	}
+
+	if (conf.txtime_lead > 0.0) {
+		sock_txtime txtime;
+		txtime.clockid = conf.txtime_clock;
+		txtime.flags = 0; // late packets are sent right away (fq), or dropped (etf) and time out
+		if (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+			perror("open_udp_sock: can't set SO_TXTIME");
+			exit(1);
+		}
+	}
+
 	sender->sock = sock;
+	sender->sent_dgrams = 0;
 	get_sockaddr(&sender->saddr, saddr.hostname, saddr.port, SOCK_DGRAM);
 }
 
@@ -51,18 +77,24 @@ public:
 	std::set<int> resp_missing_segments;
 };
 
+// UDP-based memcached protocol uses two bytes to store request ID
+static const int udp_id_mask = 0xffff;
+
 class udp_transaction_manager {
 private:
 	std::mutex lock;
 	std::list<udp_transaction> time_queue;
 	std::map<int, std::list<udp_transaction>::iterator> id_table;
-	std::list<int> free_ids;
+	int next_id; // ids are handed out round robin, to delay reuse as much as possible
 	conn_work *work;
 
 private:
 	int new_tc() {
-		int id = free_ids.front();
-		free_ids.pop_front();
+		while (id_table.count(next_id) != 0) {
+			next_id = (next_id + 1) & udp_id_mask;
+		}
+		int id = next_id;
+		next_id = (next_id + 1) & udp_id_mask;
 		time_queue.emplace_back();
 		auto it = time_queue.end(); it--;
 		id_table[id] = it;
@@ -75,8 +107,6 @@ private:
 		auto tq_it = id_table[id];
 		time_queue.erase(tq_it);
 		id_table.erase(id);
-		// push_back to delay id reuse as much as possible
-		free_ids.push_back(id);
 	}
 
 	bool try_create_transaction_helper(int *id) {
@@ -94,14 +124,14 @@ private:
 			work->count_udp_timeout();
 			delete_tc(oldest_tc.id);
 		}
-		if (free_ids.empty()) {
+		if ((int) id_table.size() > udp_id_mask) {
 			return false;
 		}
 		*id = new_tc();
 		return true;
 	}
 
-	bool try_process_response_segment_helper(const response_segment &seg) {
+	bool try_process_response_segment_helper(const response_segment &seg, udp_response_receiver *receiver) {
 		if (id_table.count(seg.udp_id) == 0) {
 			fprintf(stderr, "UDP timeout too small: missing transaction\n");
 			exit(1);
@@ -118,6 +148,10 @@ private:
 			}
 			tc.state = udp_transaction::resp_in_progress;
 			if (seg.resp.recv_time <= tc.req.send_time) {
+				if (conf.txtime_lead > 0.0) {
+					fprintf(stderr, "reply before the transmit time of its request: SO_TXTIME is not honored, is the fq (or etf) qdisc set up on the interface?\n");
+					exit(1);
+				}
 				fprintf(stderr, "UDP timeout too small: impossible latency (<= 0) occured\n");
 				exit(1);
 			}
@@ -125,12 +159,15 @@ private:
 		// tc.state == udp_transaction::resp_in_progress;
 		if (seg.cur_segment == 0) {
 			tc.resp = seg.resp;
+			uint64_t prof_point = prof_begin();
 			if (!request_response_match(tc.req, tc.resp)) {
 				fprintf(stderr, "UDP timeout too small: request response mismatch\n");
 				exit(1);
 			}
+			prof_next(ps_match, prof_point);
 		} else {
 			tc.resp.recv_time = seg.resp.recv_time;
+			tc.resp.wire_recv_time = seg.resp.wire_recv_time;
 		}
 		if (tc.resp_missing_segments.count(seg.cur_segment) == 0) {
 			fprintf(stderr, "UDP timeout too small: extra segments\n");
@@ -138,7 +175,16 @@ private:
 		}
 		tc.resp_missing_segments.erase(seg.cur_segment);
 		if (tc.resp_missing_segments.empty()) {
+			uint64_t prof_point = prof_begin();
 			work->count_replied(tc.req, tc.resp);
+			wire_stamp tx_stamp;
+			if (conf.timestamping != tst_off && receiver->tx_stamp(tc.req.tx_key, &tx_stamp)) {
+				work->count_wire(tc.req, tc.resp, tx_stamp);
+				if (conf.txtime_lead > 0.0) {
+					work->count_txtime(tc.req, tx_stamp);
+				}
+			}
+			prof_next(ps_count, prof_point);
 			delete_tc(tc.id);
 		}
 		return true;
@@ -146,10 +192,7 @@ private:
 
 public:
 	udp_transaction_manager(conn_work *work): work(work) {
-		// UDP-based memcached protocol uses two bytes to store request ID
-		for (int i = 0; i <= 0xffff; i++) {
-			free_ids.push_back(i);
-		}
+		next_id = 0;
 	}
 
 	// Returns false when running out of ids, true otherwise.
@@ -170,9 +213,9 @@ public:
 
 	// Returns false if request has not been registered (possible when reply
 	// comes before sending thread registers request), true otherwise.
-	bool try_process_response_segment(const response_segment &seg) {
+	bool try_process_response_segment(const response_segment &seg, udp_response_receiver *receiver) {
 		lock.lock();
-		bool res = try_process_response_segment_helper(seg);
+		bool res = try_process_response_segment_helper(seg, receiver);
 		lock.unlock();
 		return res;
 	}
@@ -189,10 +232,116 @@ public:
 	: work(work), sock(sock), outstandings(outstandings) {}
 };
 
+enum recv_state_t {
+	rst_running,
+	rst_read_pause
+};
+
+static void udp_recv_callback(evutil_socket_t sock, short what, void *arg);
+
+class udp_recv_context {
+private:
+	conn_work *work;
+	udp_response_receiver receiver;
+	udp_transaction_manager *outstandings;
+	recv_state_t recv_state;
+	event *readable;
+
+public:
+	bool backlogged; // for epoll_recv_loop
+
+public:
+	udp_recv_context(const udp_recv_params &params)
+	: receiver(params.work->numa_node) {
+		work = params.work;
+		receiver.sock = params.sock;
+		outstandings = params.outstandings;
+		recv_state = rst_running;
+		readable = NULL;
+		backlogged = false;
+	}
+
+	void watch(event_base *base) {
+		readable = event_new(base, receiver.sock, EV_READ|EV_PERSIST, udp_recv_callback, this); assert(readable != NULL);
+		event_add(readable, NULL);
+	}
+
+	void watch(int epfd) {
+		epoll_watch(epfd, receiver.sock, this);
+	}
+
+	void drive_state_machine() {
+		switch(recv_state) {
+		case rst_running:
+		case rst_read_pause:
+			if (!try_receive()) {
+				recv_state = rst_read_pause;
+				break;
+			}
+			recv_state = rst_running;
+			break;
+		default:
+			assert(false);
+		}
+	}
+
+	void continue_receive() {
+		for (int i = 0; i < conf.receive_burst; i++) {
+			drive_state_machine();
+			if (recv_state != rst_running) {
+				break;
+			}
+		}
+	}
+
+	// Receives until the socket would block (returns true) or budget runs out (returns false).
+	bool drain(int budget) {
+		for (int i = 0; i < budget; i++) {
+			if (!try_receive()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	bool try_receive() {
+		response_segment seg;
+		if (!receiver.try_receive(&seg)) {
+			return false;
+		}
+		while(!outstandings->try_process_response_segment(seg, &receiver))
+			;
+		return true;
+	}
+};
+
+static void udp_recv_callback(evutil_socket_t sock, short what, void *arg) {
+	udp_recv_context *ct = (udp_recv_context*) arg;
+	ct->continue_receive();
+}
+
+// Sleeps (rather than spins) until clock_mono_nsec() reaches point, returns the time woken up.
+// Waits shorter than the timer slack aren't worth a sleep.
+static double wait_until(double point) {
+	double now = clock_mono_nsec();
+	const double min_sleep = 50.0e3;
+	if (point - now > min_sleep) {
+		double ns = point - now;
+		timespec ts;
+		ts.tv_sec = (time_t) (ns / 1.0e9);
+		ts.tv_nsec = (long) (ns - ts.tv_sec * 1.0e9);
+		nanosleep(&ts, NULL);
+		now = clock_mono_nsec();
+	}
+	return now;
+}
+
 class udp_send_context {
 private:
 	conn_work *const work;
 	const int signal_fd;
+	const int epoll_fd;
 	double min_send_rate;
 	double max_send_rate;
 	double cur_send_rate;
@@ -203,20 +352,35 @@ private:
 	bool connected;
 	udp_request_sender sender;
 	udp_transaction_manager outstandings;
+	rand_engine_t rg; // seeded per connection, so the request stream doesn't depend on threads
+	record_buffer *recorder; // of the send thread, NULL unless recording
 
 private:
+	// Send time of the next recorded request, 0.0 (now) if replaying as fast as possible.
+	double replay_target_point() const {
+		if (conf.replay_speed <= 0.0) {
+			return 0.0;
+		}
+		return control.replay_base + work->replay->next_time() / conf.replay_speed;
+	}
+
 	void connect() {
 		open_udp_sock(work->id, work->saddr, &sender);
 		work->client_port = get_socket_port(sender.sock);
 		get_socket_ip(sender.sock, work->client_ip, IP_BUF_SZ);
 		udp_recv_params recv_params(work, sender.sock, &outstandings);
+		if (epoll_fd >= 0) {
+			(new udp_recv_context(recv_params))->watch(epoll_fd);
+			return;
+		}
 		int recv_param_sz = sizeof(recv_params);
 		assert(write(signal_fd, &recv_params, recv_param_sz) == recv_param_sz);
 	}
 
 public:
-	udp_send_context(conn_work* work, int signal_fd, double first_target_start_point)
-	: work(work), signal_fd(signal_fd), outstandings(work) {
+	udp_send_context(conn_work* work, int signal_fd, int epoll_fd, record_buffer *recorder, double first_target_start_point)
+	: work(work), signal_fd(signal_fd), epoll_fd(epoll_fd), sender(work->numa_node), outstandings(work),
+	rg(derive_seed(conf.seed, work->id)), recorder(recorder) {
 		min_send_rate = work->init_send_rate;
 		max_send_rate = work->send_rate;
 		cur_send_rate = min_send_rate;
@@ -225,9 +389,12 @@ public:
 		target_start_point = first_target_start_point;
 		ramp_start_point = first_target_start_point;
 		connected = false;
+		if (work->replay != NULL) {
+			target_start_point = replay_target_point();
+		}
 	}
 
-	void send_next(rand_engine_t *rg) {
+	void send_next() {
 
 		if (!connected) {
 			connect();
@@ -238,21 +405,45 @@ public:
 			}
 		}
 
+		uint64_t prof_point = prof_begin();
 		request pending_request;
-		work->make_request(&pending_request, rg);
+		work->make_request(&pending_request, &rg);
+		if (work->near_cache_serve(pending_request)) {
+			prof_next(ps_make_request, prof_point);
+			return;
+		}
 
 		int udp_id = 0;
 		while(!outstandings.try_create_transaction(&udp_id))
 			;
+		prof_point = prof_next(ps_make_request, prof_point);
 		sender.setup(udp_id, pending_request);
-
-		double start_point = clock_mono_nsec();
-		while(target_start_point > start_point) {
+		prof_point = prof_next(ps_fill_send_buf, prof_point);
+
+		double start_point;
+		if (conf.txtime_lead > 0.0) {
+			// the kernel holds the datagrams until target_start_point
+			start_point = wait_until(target_start_point - conf.txtime_lead * 1.0e3);
+			prof_point = prof_next(ps_pacing, prof_point);
+			sender.txtime = (int64_t) target_start_point + clock_offset_nsec(conf.txtime_clock);
+		} else {
 			start_point = clock_mono_nsec();
+			while(target_start_point > start_point) {
+				start_point = clock_mono_nsec();
+			}
+			prof_point = prof_next(ps_pacing, prof_point);
 		}
 		while (!sender.try_send(&pending_request.send_time))
 			;
 		double finish_point = clock_mono_nsec();
+		prof_point = prof_next(ps_send, prof_point);
+		pending_request.tx_key = sender.sent_dgrams - 1;
+		if (conf.txtime_lead > 0.0) {
+			// handed over ahead of time: it is sent at target_start_point, unless the hand-off was late
+			pending_request.send_time = std::max(pending_request.send_time, target_start_point);
+			start_point = std::max(start_point, target_start_point);
+			finish_point = std::max(finish_point, start_point);
+		}
 
 		if (cur_send_rate < max_send_rate) {
 			cur_send_rate = min_send_rate + ramp_up_speed * (finish_point - ramp_start_point) / 1.0e9;
@@ -265,37 +456,47 @@ public:
 
 		work->count_send_timing(target_start_point, start_point, finish_point);
 		work->count_sent(pending_request);
+		prof_next(ps_count, prof_point);
+		if (recorder != NULL) {
+			recorder->add(pending_request.send_time, work->id, pending_request);
+		}
 		outstandings.register_request(udp_id, pending_request);
 	}
 
-	void update_target_start_point(rand_engine_t *rg) {
+	void update_target_start_point() {
+		if (work->replay != NULL) {
+			if (!work->replay->done()) {
+				target_start_point = replay_target_point();
+			}
+			return;
+		}
 		switch (conf.send_traffic_shape.shape) {
 		case traffic_shape::UNIFORM:
 			{
 				double delta = conf.send_traffic_shape.param;
 				rand_uniform_real_t dist(1.0 - delta, 1.0 + delta);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::NORMAL:
 			{
 				double stddev = conf.send_traffic_shape.param;
 				rand_normal_real_t dist(1.0, stddev);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::PEAKS:
 			{
 				rand_uniform_int_t peaks_select(0,9);
 				double mean;
-				if (peaks_select(*rg) == 0) {
+				if (peaks_select(rg) == 0) {
 					mean = 9.0;
 				} else {
 					mean = 1.0 / 9.0;
 				}
 				double stddev = conf.send_traffic_shape.param;
 				rand_normal_real_t dist(mean, stddev);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::GAMMA:
@@ -303,7 +504,7 @@ public:
 				double alpha = conf.send_traffic_shape.param;
 				double beta = 1.0 / alpha;
 				std::gamma_distribution<double> dist(alpha, beta);
-				target_start_point += send_interval * dist(*rg);
+				target_start_point += send_interval * dist(rg);
 			}
 			break;
 		case traffic_shape::EXPONENTIAL:
@@ -311,7 +512,7 @@ public:
 				double lambda = conf.send_traffic_shape.param;
 				std::exponential_distribution<double> dist(lambda);
 				double mean = 1.0 / lambda;
-				target_start_point += (send_interval / mean) * dist(*rg);
+				target_start_point += (send_interval / mean) * dist(rg);
 			}
 			break;
 		default:
@@ -322,74 +523,21 @@ public:
 	double get_target_start_point() const {
 		return target_start_point;
 	}
-};
-
-enum recv_state_t {
-	rst_running,
-	rst_read_pause
-};
-
-static void udp_recv_callback(evutil_socket_t sock, short what, void *arg);
-
-class udp_recv_context {
-private:
-	conn_work *work;
-	udp_response_receiver receiver;
-	udp_transaction_manager *outstandings;
-	recv_state_t recv_state;
-	event *readable;
-
-public:
-	udp_recv_context(const udp_recv_params &params, event_base *base) {
-		work = params.work;
-		receiver.sock = params.sock;
-		outstandings = params.outstandings;
-		recv_state = rst_running;
-		readable = event_new(base, params.sock, EV_READ|EV_PERSIST, udp_recv_callback, this); assert(readable != NULL);
-		event_add(readable, NULL);
-	}
-
-	void drive_state_machine() {
-		switch(recv_state) {
-		case rst_running:
-		case rst_read_pause:
-			if (!try_receive()) {
-				recv_state = rst_read_pause;
-				break;
-			}
-			recv_state = rst_running;
-			break;
-		default:
-			assert(false);
-		}
-	}
 
-	void continue_receive() {
-		for (int i = 0; i < conf.receive_burst; i++) {
-			drive_state_machine();
-			if (recv_state != rst_running) {
-				break;
-			}
-		}
+	// Called by the send thread the context was handed to (see send_balancer.h). The socket
+	// and its recv context stay where they are.
+	void adopt(record_buffer *recorder) {
+		this->recorder = recorder;
+		sender.rebind_pool();
+		work->count_migration();
 	}
 
-private:
-	bool try_receive() {
-		response_segment seg;
-		if (!receiver.try_receive(&seg)) {
-			return false;
-		}
-		while(!outstandings->try_process_response_segment(seg))
-			;
-		return true;
+	// True once all recorded requests of the connection have been replayed.
+	bool finished() const {
+		return work->replay != NULL && work->replay->done();
 	}
 };
 
-static void udp_recv_callback(evutil_socket_t sock, short what, void *arg) {
-	udp_recv_context *ct = (udp_recv_context*) arg;
-	ct->continue_receive();
-}
-
 class udp_send_context_comp {
 public:
 	bool operator() (const udp_send_context *c0, const udp_send_context *c1) {
@@ -397,36 +545,70 @@ public:
 	}
 };
 
-udp_conn_worker::udp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed)
-: works(works), worker_connect_speed(worker_connect_speed) {
+udp_conn_worker::udp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed, send_balancer *balancer, int balancer_slot)
+: works(works), worker_connect_speed(worker_connect_speed), balancer(balancer), balancer_slot(balancer_slot) {
 	assert(pipe2(signal_pipe, O_NONBLOCK) == 0);
+	epoll_fd = -1;
+	if (conf.epoll_receive) {
+		epoll_fd = epoll_create1(0); assert(epoll_fd >= 0);
+	}
 }
 
 void udp_conn_worker::send_run() {
 
+	if (conf.profile) {
+		prof_register_thread("send");
+	}
+
 	while (!control.started);
 
 	std::priority_queue<udp_send_context*, std::vector<udp_send_context*>, udp_send_context_comp> queue;
 
 	double connect_interval = 1.0e9 / worker_connect_speed;
+	record_buffer *recorder = conf.record_file != NULL ? new record_buffer() : NULL;
 	double first_target_start_point = 1.0e6 + clock_mono_nsec(); // 1ms
 
-	rand_seed_t seed = (uint64_t) clock_mono_nsec() + pthread_self();
-	rand_engine_t rg(seed);
+	// spacing of connection setups, seeded from the first connection, like the per connection streams
+	rand_engine_t rg(derive_seed(conf.seed, (1ULL << 32) + works.front()->id));
 	rand_uniform_real_t dist(1.0 - 0.5, 1.0 + 0.5);
 
 	for (auto it = works.begin(); it != works.end(); it++) {
-		queue.push(new udp_send_context(*it, signal_pipe[1], first_target_start_point));
+		if ((*it)->replay != NULL && (*it)->replay->done()) {
+			// nothing recorded for this connection, it never connects
+			control.ramp_up_cnt.fetch_add(1);
+			continue;
+		}
+		queue.push(new udp_send_context(*it, signal_pipe[1], epoll_fd, recorder, first_target_start_point));
 		first_target_start_point += connect_interval * dist(rg);
 	}
 
-	while (true) {
+	while (!queue.empty()) {
+		if (balancer != NULL) {
+			double now = clock_mono_nsec();
+			if (balancer->giving(balancer_slot, queue.size(), now)) {
+				balancer->give(balancer_slot, queue.top());
+				queue.pop();
+			}
+			auto stolen = (udp_send_context*) balancer->take(balancer_slot, now - queue.top()->get_target_start_point(), queue.size(), now);
+			if (stolen != NULL) {
+				stolen->adopt(recorder);
+				queue.push(stolen);
+			}
+		}
 		auto cx = queue.top();
-		cx->send_next(&rg);
+		cx->send_next();
 		queue.pop();
-		cx->update_target_start_point(&rg);
+		if (cx->finished()) {
+			continue;
+		}
+		cx->update_target_start_point();
 		queue.push(cx);
 	}
+
+	// only reached when a replay is done
+	if (recorder != NULL) {
+		recorder->flush();
+	}
 }
 
 static void udp_recv_new_conn_callback(evutil_socket_t fd, short what, void *arg) {
@@ -434,13 +616,22 @@ static void udp_recv_new_conn_callback(evutil_socket_t fd, short what, void *arg
 	event_base *base = (event_base*) arg;
 	udp_recv_params params;
 	assert(read(fd, &params, sizeof(params)) == sizeof(params));
-	new udp_recv_context(params, base);
+	(new udp_recv_context(params))->watch(base);
 }
 
 void udp_conn_worker::recv_run() {
 
+	if (conf.profile) {
+		prof_register_thread("recv");
+	}
+
 	while (!control.started);
 
+	if (epoll_fd >= 0) {
+		epoll_recv_loop<udp_recv_context>(epoll_fd);
+		return;
+	}
+
 	event_config *cfg;
 	event_base *base;
 	int ret;
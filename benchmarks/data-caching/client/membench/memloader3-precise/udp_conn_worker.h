@@ -3,15 +3,19 @@
 
 #include <list>
 #include "conn_work.h"
+#include "send_balancer.h"
 
 class udp_conn_worker {
 private:
 	const std::list<conn_work*> works;
 	const double worker_connect_speed;
 	int signal_pipe[2];
+	int epoll_fd; // -1 unless conf.epoll_receive
+	send_balancer *const balancer; // NULL unless conf.rebalance_lag
+	const int balancer_slot;
 
 public:
-	udp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed);
+	udp_conn_worker(const std::list<conn_work*> &works, double worker_connect_speed, send_balancer *balancer, int balancer_slot);
 	void send_run();
 	void recv_run();
 };
@@ -5,21 +5,30 @@
 #include <sys/uio.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <assert.h>
+#include <string.h>
 #include <algorithm>
 #include "util.h"
 #include "clock.h"
 #include "config.h"
 
-udp_request_sender::udp_request_sender() {
-	send_buf_sz = sizeof(udp_request_header) + max_request_size;
-	send_buf = new char[send_buf_sz];
+udp_request_sender::udp_request_sender(int numa_node) : numa_node(numa_node) {
+	pool = NULL;
+	send_buf = NULL;
+	send_buf_sz = 0;
+	segment_cnt = 0;
+	cur_segment = 0;
 	const int max_ip_packet_sz = (1 << 16) - 1;
 	// 100 includes various headers (ip, udp, and memcached-udp)
 	segment_sz = std::min(conf.mtu, max_ip_packet_sz) - 100;
+	sent_dgrams = 0;
+	txtime = 0;
 }
 
 udp_request_sender::~udp_request_sender() {
-	delete[] send_buf;
+	if (send_buf != NULL) {
+		pool->put(send_buf, send_buf_sz);
+	}
 }
 
 void udp_request_sender::fill_header(udp_request_header* h) {
@@ -35,6 +44,13 @@ void udp_request_sender::fill_header(udp_request_header* h) {
 
 void udp_request_sender::setup(int udp_id, const request &r) {
 	int hsz = sizeof (udp_request_header);
+	if (pool == NULL) {
+		pool = buffer_pool::of_thread(numa_node);
+	}
+	if (send_buf != NULL) {
+		pool->put(send_buf, send_buf_sz);
+	}
+	send_buf = pool->get(hsz + send_buf_size(r), &send_buf_sz);
 	int request_sz = fill_send_buf(r, send_buf + hsz, send_buf_sz - hsz);
 	this->udp_id = udp_id;
 	segment_cnt = (request_sz + segment_sz - 1) / segment_sz; // round up
@@ -45,6 +61,35 @@ void udp_request_sender::setup(int udp_id, const request &r) {
 	}
 }
 
+int udp_request_sender::send_packet(char *packet, int packet_sz) {
+	if (txtime == 0) {
+		return sendto(sock, packet, packet_sz, MSG_DONTWAIT, &saddr, sizeof(saddr));
+	}
+	char control[CMSG_SPACE(sizeof(txtime))];
+	iovec iov;
+	iov.iov_base = packet;
+	iov.iov_len = packet_sz;
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &saddr;
+	msg.msg_namelen = sizeof(saddr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_TXTIME;
+	cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+	memcpy(CMSG_DATA(cm), &txtime, sizeof(txtime));
+	return sendmsg(sock, &msg, MSG_DONTWAIT);
+}
+
+void udp_request_sender::rebind_pool() {
+	assert(send_buf == NULL);
+	pool = NULL;
+}
+
 bool udp_request_sender::try_send(double *send_time) {
 	int hsz = sizeof (udp_request_header);
 	while (cur_segment < segment_cnt) {
@@ -55,7 +100,7 @@ bool udp_request_sender::try_send(double *send_time) {
 		int bsz = (cur_segment == segment_cnt - 1) ? last_segment_sz : segment_sz;
 		int packet_sz = hsz + bsz;
 		*send_time = clock_mono_nsec();
-		int res = sendto(sock, packet, packet_sz, MSG_DONTWAIT, &saddr, sizeof(saddr));
+		int res = send_packet(packet, packet_sz);
 		if (res < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {
 				return false;
@@ -68,6 +113,9 @@ bool udp_request_sender::try_send(double *send_time) {
 			exit(1);
 		}
 		cur_segment++;
+		sent_dgrams++;
 	}
+	pool->put(send_buf, send_buf_sz);
+	send_buf = NULL;
 	return true;
 }
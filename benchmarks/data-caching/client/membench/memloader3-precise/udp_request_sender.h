@@ -3,15 +3,20 @@
 
 #include <sys/socket.h>
 #include "memcached_cmd.h"
+#include "buffer_pool.h"
 
 // A sender object can only be used by one thread.
 class udp_request_sender {
 public:
 	int sock;
 	sockaddr saddr;
+	uint32_t sent_dgrams; // datagrams sent on sock, keys TX timestamps
+	int64_t txtime; // SO_TXTIME transmit time (ns on conf.txtime_clock) of the request, 0 for now
 
 private:
-	char *send_buf;
+	const int numa_node;
+	buffer_pool *pool;
+	char *send_buf; // from pool while a request is being sent, NULL otherwise
 	int send_buf_sz;
 	int segment_sz;
 	int udp_id;
@@ -20,13 +25,17 @@ private:
 	int last_segment_sz;
 
 public:
-	udp_request_sender();
+	udp_request_sender(int numa_node = -1);
 	~udp_request_sender();
 	void setup(int udp_id, const request &r);
 	bool try_send(double *send_time);
+	// Called by the thread the sender moved to, between two requests: buffers then come from
+	// the pool of that thread.
+	void rebind_pool();
 
 private:
 	void fill_header(udp_request_header* h);
+	int send_packet(char *packet, int packet_sz);
 };
 
 #endif
@@ -9,22 +9,44 @@
 #include "util.h"
 #include "clock.h"
 #include "config.h"
+#include "stage_profiler.h"
 
-udp_response_receiver::udp_response_receiver() {
-	recv_buf_sz = sizeof(udp_request_header) + max_response_size;
-	recv_buf = new char[recv_buf_sz];
+// A datagram can't be larger than this, so one buffer of the recv thread is enough for every
+// connection it serves: each datagram is parsed before the next one is read.
+static const int max_dgram_size = 1 << 16;
+
+udp_response_receiver::udp_response_receiver(int numa_node) : numa_node(numa_node), tx_stamps(false) {
+	pool = NULL;
 }
 
 udp_response_receiver::~udp_response_receiver() {
-	delete[] recv_buf;
 }
 
 bool udp_response_receiver::try_receive(response_segment *seg) {
 
-	int dg_size = recvfrom(sock, recv_buf, recv_buf_sz, MSG_DONTWAIT, NULL, NULL);
+	uint64_t prof_point = prof_begin();
+	wire_stamp wire_recv_time;
+	memset(&wire_recv_time, 0, sizeof(wire_recv_time));
+	if (pool == NULL) {
+		pool = buffer_pool::of_thread(numa_node);
+	}
+	int recv_buf_sz;
+	char *recv_buf = pool->get(max_dgram_size, &recv_buf_sz);
+	int dg_size;
+	if (conf.timestamping != tst_off) {
+		dg_size = recv_stamped(sock, recv_buf, recv_buf_sz, MSG_DONTWAIT, &wire_recv_time);
+	} else {
+		dg_size = recvfrom(sock, recv_buf, recv_buf_sz, MSG_DONTWAIT, NULL, NULL);
+	}
 	double recv_time = clock_mono_nsec();
+	prof_point = prof_next(ps_recv, prof_point);
 	if (dg_size <= 0) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			pool->put(recv_buf, recv_buf_sz);
+			if (conf.timestamping != tst_off) {
+				// a non-empty error queue keeps the socket readable
+				tx_stamps.collect(sock);
+			}
 			return false;
 		}
 		perror("udp receive: can't receive");
@@ -42,21 +64,19 @@ bool udp_response_receiver::try_receive(response_segment *seg) {
 	seg->segment_cnt = ntohs(resp_hdr->dgram_cnt);
 
 	if (seg->cur_segment == 0) {
-		int i = 0;
-		for (; i < body_sz; i++) {
-			if (p[i] == '\n') {
-				p[i] = '\0';
-				break;
-			}
-		}
-		if (i == body_sz) {
+		char *line_end = (char*) find_line_end(p, p + body_sz);
+		if (line_end == NULL) {
 			fprintf(stderr, "response header can't fit in first UDP packet\n");
 			exit(1);
 		}
+		*line_end = '\0';
 		parse_response_head(&seg->resp, p);
 	}
 
 	seg->resp.recv_time = recv_time;
+	seg->resp.wire_recv_time = wire_recv_time;
+	pool->put(recv_buf, recv_buf_sz);
+	prof_next(ps_parse, prof_point);
 
 	return true;
 }
@@ -2,6 +2,8 @@
 #define UDP_RESPONSE_RECEIVER_H
 
 #include "memcached_cmd.h"
+#include "timestamping.h"
+#include "buffer_pool.h"
 
 class response_segment {
 public:
@@ -17,14 +19,17 @@ public:
 	int sock;
 
 private:
-	char *recv_buf;
-	int recv_buf_sz;
+	const int numa_node;
+	buffer_pool *pool;
+	tx_stamp_queue tx_stamps;
 
 public:
-	udp_response_receiver();
+	udp_response_receiver(int numa_node = -1);
 	~udp_response_receiver();
 	// Nonblocking, returns false if no response segment is available yet, true otherwise.
 	bool try_receive(response_segment *seg);
+	// TX timestamp of a request sent on sock, with conf.timestamping.
+	bool tx_stamp(uint32_t tx_key, wire_stamp *stamp) { return tx_stamps.lookup(sock, tx_key, stamp); }
 };
 
 #endif
@@ -9,6 +9,8 @@
 #include <netdb.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <atomic>
 
 void simple_usleep(long long usec) {
 
@@ -109,6 +111,31 @@ void bind_port(int fd, int port, int sock_type) {
 	}
 }
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+// Warns once per option (warned), whichever worker thread fails first.
+static void try_setsockopt(int sock, int name, int val, const char *name_str, std::atomic<bool> *warned) {
+	if (setsockopt(sock, SOL_SOCKET, name, &val, sizeof(val)) < 0 && !warned->exchange(true)) {
+		fprintf(stderr, "can't set %s: %s\n", name_str, strerror(errno));
+	}
+}
+
+void set_busy_poll(int sock, int usec, bool prefer, int budget) {
+	static std::atomic<bool> busy_poll_warned(false), prefer_warned(false), budget_warned(false);
+	try_setsockopt(sock, SO_BUSY_POLL, usec, "SO_BUSY_POLL", &busy_poll_warned);
+	if (prefer) {
+		try_setsockopt(sock, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL", &prefer_warned);
+		if (budget > 0) {
+			try_setsockopt(sock, SO_BUSY_POLL_BUDGET, budget, "SO_BUSY_POLL_BUDGET", &budget_warned);
+		}
+	}
+}
+
 int get_socket_port(int sock) {
 	struct sockaddr_in sin;
 	socklen_t len = sizeof(sin);
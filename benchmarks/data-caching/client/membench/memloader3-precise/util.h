@@ -38,6 +38,11 @@ void bind_port(int fd, int port, int sock_type);
 
 int get_socket_port(int sock);
 
+// Enables busy polling (SO_BUSY_POLL) on a socket. If prefer is true, also asks the kernel to
+// prefer busy polling over interrupt driven processing (SO_PREFER_BUSY_POLL, SO_BUSY_POLL_BUDGET).
+// Options the kernel refuses are reported once and otherwise ignored.
+void set_busy_poll(int sock, int usec, bool prefer, int budget);
+
 void get_socket_ip(int sock, char *buf, int bufsz);
 
 #endif
@@ -0,0 +1,104 @@
+#include "workload_dist.h"
+
+#include <math.h>
+#include <stdio.h>
+
+size_dist size_dist::etc_key_size() {
+	size_dist d;
+	d.law = szl_gev;
+	d.loc = 30.7984;
+	d.scale = 8.20449;
+	d.shape = 0.078688;
+	return d;
+}
+
+size_dist size_dist::etc_value_size() {
+	size_dist d;
+	d.law = szl_gpareto;
+	d.loc = 0.0;
+	d.scale = 214.476;
+	d.shape = 0.348238;
+	return d;
+}
+
+// Quantile of the standard normal distribution (Acklam's rational approximation, relative
+// error below 1.2e-9).
+static double normal_quantile(double p) {
+	static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+		1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+	static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+		6.680131188771972e+01, -1.328068155288572e+01};
+	static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+		-2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+	static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+		3.754408661907416e+00};
+	const double p_low = 0.02425;
+
+	if (p < p_low) {
+		double q = sqrt(-2.0 * log(p));
+		return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+			((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+	}
+	if (p > 1.0 - p_low) {
+		return -normal_quantile(1.0 - p);
+	}
+	double q = p - 0.5;
+	double r = q * q;
+	return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+		(((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
+
+double size_dist::quantile(double p) const {
+	switch (law) {
+	case szl_fixed:
+		return loc;
+	case szl_gev:
+		if (shape == 0.0) {
+			return loc - scale * log(-log(p));
+		}
+		return loc + scale * (pow(-log(p), -shape) - 1.0) / shape;
+	case szl_gpareto:
+		if (shape == 0.0) {
+			return loc - scale * log(1.0 - p);
+		}
+		return loc + scale * (pow(1.0 - p, -shape) - 1.0) / shape;
+	case szl_lognormal:
+		return exp(loc + scale * normal_quantile(p));
+	}
+	return loc;
+}
+
+std::string size_dist::describe() const {
+	char buf[128];
+	switch (law) {
+	case szl_fixed:
+		snprintf(buf, sizeof(buf), "fixed %.0f", loc);
+		break;
+	case szl_gev:
+		snprintf(buf, sizeof(buf), "gev %g %g %g", loc, scale, shape);
+		break;
+	case szl_gpareto:
+		snprintf(buf, sizeof(buf), "gpareto %g %g %g", loc, scale, shape);
+		break;
+	case szl_lognormal:
+		snprintf(buf, sizeof(buf), "lognormal %g %g", loc, scale);
+		break;
+	}
+	return buf;
+}
+
+double popularity_dist::weight(int rank) const {
+	if (law == ppl_zipf) {
+		return pow(rank + 1.0, -exponent);
+	}
+	return 1.0;
+}
+
+std::string popularity_dist::describe() const {
+	if (law == ppl_zipf) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "zipf %g", exponent);
+		return buf;
+	}
+	return "uniform";
+}
@@ -0,0 +1,46 @@
+#ifndef WORKLOAD_DIST_H
+#define WORKLOAD_DIST_H
+
+#include <string>
+
+// Parametric laws for generated databases (--key-size, --value-size, --popularity), used
+// instead of a sample file. Sizes are evaluated once per key through the quantile function of
+// the law, at a point hashed from the key's index and not from the run's seed, so a preload
+// and later runs agree on the sizes. Popularity weights go into an alias table (see
+// memdb_sample).
+
+enum size_law_t {szl_fixed, szl_gev, szl_gpareto, szl_lognormal};
+
+class size_dist {
+public:
+	size_law_t law;
+	// fixed: loc is the size; gev and gpareto: location mu, scale sigma, shape xi;
+	// lognormal: mean loc and standard deviation scale of ln(size)
+	double loc;
+	double scale;
+	double shape;
+
+public:
+	// Fits of Facebook's ETC pool (Atikoglu et al., SIGMETRICS 2012).
+	static size_dist etc_key_size();
+	static size_dist etc_value_size();
+
+	// Size at probability p in (0, 1), before rounding and clamping.
+	double quantile(double p) const;
+	std::string describe() const;
+};
+
+enum popularity_law_t {ppl_uniform, ppl_zipf};
+
+class popularity_dist {
+public:
+	popularity_law_t law;
+	double exponent; // zipf only
+
+public:
+	// Relative popularity of the key of rank (from 0, the most popular).
+	double weight(int rank) const;
+	std::string describe() const;
+};
+
+#endif